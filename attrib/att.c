@@ -113,6 +113,99 @@ struct att_data_list *att_data_list_alloc(uint16_t num, uint16_t len)
 	return list;
 }
 
+/*
+ * Read By Type, Read By Group Type, Find Information and Find By Type Value
+ * responses carry a list of entries that all have the same length. These
+ * helpers write the entries straight into the PDU buffer, enc_list_add()
+ * returns NULL once the buffer is full or when the entry length differs
+ * from the first one.
+ */
+gboolean enc_list_init(struct att_list_enc *enc, uint8_t opcode,
+							uint8_t *pdu, int len)
+{
+	uint16_t offset;
+
+	switch (opcode) {
+	case ATT_OP_READ_BY_TYPE_RESP:
+	case ATT_OP_READ_BY_GROUP_RESP:
+	case ATT_OP_FIND_INFO_RESP:
+		/* Opcode plus length or format */
+		offset = 2;
+		break;
+	case ATT_OP_FIND_BY_TYPE_RESP:
+		offset = 1;
+		break;
+	default:
+		return FALSE;
+	}
+
+	if (pdu == NULL || len <= offset)
+		return FALSE;
+
+	memset(enc, 0, sizeof(*enc));
+	enc->pdu = pdu;
+	enc->len = MIN(len, UINT16_MAX);
+	enc->offset = offset;
+
+	pdu[0] = opcode;
+
+	return TRUE;
+}
+
+uint8_t *enc_list_add(struct att_list_enc *enc, uint16_t elen)
+{
+	uint8_t *ptr;
+
+	if (enc->num == 0) {
+		/* A single entry may be truncated to fit into the PDU */
+		elen = MIN(elen, enc->len - enc->offset);
+
+		/* The length field is one octet long */
+		if (enc->offset == 2)
+			elen = MIN(elen, UINT8_MAX);
+
+		enc->elen = elen;
+	} else if (elen != enc->elen)
+		return NULL;
+
+	if (elen == 0 || enc->offset + elen > enc->len)
+		return NULL;
+
+	ptr = &enc->pdu[enc->offset];
+	enc->offset += elen;
+	enc->num++;
+
+	return ptr;
+}
+
+/* No room left for another entry of the length set by the first one */
+gboolean enc_list_full(struct att_list_enc *enc)
+{
+	if (enc->num == 0)
+		return enc->offset >= enc->len;
+
+	return enc->offset + enc->elen > enc->len;
+}
+
+uint16_t enc_list_finish(struct att_list_enc *enc)
+{
+	if (enc->num == 0)
+		return 0;
+
+	switch (enc->pdu[0]) {
+	case ATT_OP_READ_BY_TYPE_RESP:
+	case ATT_OP_READ_BY_GROUP_RESP:
+		enc->pdu[1] = enc->elen;
+		break;
+	case ATT_OP_FIND_INFO_RESP:
+		/* Handle plus 16-bit or 128-bit UUID */
+		enc->pdu[1] = enc->elen == 4 ? 0x01 : 0x02;
+		break;
+	}
+
+	return enc->offset;
+}
+
 uint16_t enc_read_by_grp_req(uint16_t start, uint16_t end, bt_uuid_t *uuid,
 							uint8_t *pdu, int len)
 {
@@ -598,6 +691,30 @@ uint16_t enc_read_blob_req(uint16_t handle, uint16_t offset, uint8_t *pdu,
 	return min_len;
 }
 
+uint16_t enc_read_multi_req(const uint16_t *handles, int num, uint8_t *pdu,
+									int len)
+{
+	uint16_t plen = sizeof(pdu[0]) + num * sizeof(handles[0]);
+	int i;
+
+	if (pdu == NULL || handles == NULL)
+		return 0;
+
+	/* The Set Of Handles parameter holds at least two handles */
+	if (num < 2)
+		return 0;
+
+	if (len < plen)
+		return 0;
+
+	pdu[0] = ATT_OP_READ_MULTI_REQ;
+
+	for (i = 0; i < num; i++)
+		att_put_u16(handles[i], &pdu[1 + i * sizeof(handles[0])]);
+
+	return plen;
+}
+
 uint16_t dec_read_req(const uint8_t *pdu, int len, uint16_t *handle)
 {
 	const uint16_t min_len = sizeof(pdu[0]) + sizeof(*handle);
@@ -85,7 +85,7 @@
 #define ATT_CHAR_PROPER_AUTH			0x40
 #define ATT_CHAR_PROPER_EXT_PROPER		0x80
 
-#define ATT_MAX_MTU				256
+#define ATT_MAX_MTU				517
 #define ATT_DEFAULT_L2CAP_MTU			48
 #define ATT_DEFAULT_LE_MTU			23
 
@@ -103,6 +103,15 @@ struct att_range {
 	uint16_t end;
 };
 
+/* Encodes the entries of a list response directly into the PDU buffer */
+struct att_list_enc {
+	uint8_t *pdu;
+	uint16_t len;		/* Size of the PDU buffer */
+	uint16_t offset;	/* Next entry is written here */
+	uint16_t elen;		/* Entry length, set by the first entry */
+	uint16_t num;
+};
+
 /* These functions do byte conversion */
 static inline uint8_t att_get_u8(const void *ptr)
 {
@@ -195,6 +204,12 @@ static inline bt_uuid_t att_get_uuid128(const void *ptr)
 struct att_data_list *att_data_list_alloc(uint16_t num, uint16_t len);
 void att_data_list_free(struct att_data_list *list);
 
+gboolean enc_list_init(struct att_list_enc *enc, uint8_t opcode,
+							uint8_t *pdu, int len);
+uint8_t *enc_list_add(struct att_list_enc *enc, uint16_t elen);
+gboolean enc_list_full(struct att_list_enc *enc);
+uint16_t enc_list_finish(struct att_list_enc *enc);
+
 const char *att_ecode2str(uint8_t status);
 uint16_t enc_read_by_grp_req(uint16_t start, uint16_t end, bt_uuid_t *uuid,
 							uint8_t *pdu, int len);
@@ -228,6 +243,8 @@ uint16_t dec_write_resp(const uint8_t *pdu, int len);
 uint16_t enc_read_req(uint16_t handle, uint8_t *pdu, int len);
 uint16_t enc_read_blob_req(uint16_t handle, uint16_t offset, uint8_t *pdu,
 								int len);
+uint16_t enc_read_multi_req(const uint16_t *handles, int num, uint8_t *pdu,
+								int len);
 uint16_t dec_read_req(const uint8_t *pdu, int len, uint16_t *handle);
 uint16_t dec_read_blob_req(const uint8_t *pdu, int len, uint16_t *handle,
 							uint16_t *offset);
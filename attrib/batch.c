@@ -0,0 +1,588 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2012  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include <bluetooth/uuid.h>
+
+#include "att.h"
+#include "btio.h"
+#include "gattrib.h"
+#include "gatt.h"
+#include "gatttool.h"
+
+/* Script lines use the interactive command names:
+ *
+ *	char-read-hnd <handle> [offset]
+ *	char-write-req <handle> <new value>
+ *	char-write-cmd <handle> <new value>
+ *	repeat <count> <command>
+ *	listen [seconds]
+ *
+ * Everything from '#' to the end of the line is ignored. All operations are
+ * queued as soon as the link is up so the ATT bearer never idles between
+ * them, results are reported in completion order. */
+
+enum batch_type {
+	BATCH_READ,
+	BATCH_WRITE_REQ,
+	BATCH_WRITE_CMD,
+};
+
+struct batch_op {
+	unsigned int index;
+	enum batch_type type;
+	uint16_t handle;
+	uint16_t offset;
+	uint8_t *value;
+	size_t vlen;
+	gint64 submitted;
+};
+
+static GMainLoop *event_loop;
+static GAttrib *attrib = NULL;
+static GPtrArray *ops = NULL;
+static unsigned int pending = 0;
+static unsigned int failures = 0;
+static int listen_time = -1;
+static gint64 start_time = 0;
+static gint64 last_completed = 0;
+static guint64 payload = 0;
+static guint64 service_time = 0;
+static guint64 max_service_time = 0;
+static unsigned int notifications = 0;
+static gboolean stopped = FALSE;
+static gboolean got_error = FALSE;
+
+static const char *type2str(enum batch_type type)
+{
+	switch (type) {
+	case BATCH_READ:
+		return "char-read-hnd";
+	case BATCH_WRITE_REQ:
+		return "char-write-req";
+	case BATCH_WRITE_CMD:
+		return "char-write-cmd";
+	}
+
+	return "unknown";
+}
+
+static void batch_op_free(gpointer data)
+{
+	struct batch_op *op = data;
+
+	g_free(op->value);
+	g_free(op);
+}
+
+static int strtohandle(const char *src)
+{
+	char *e;
+	int dst;
+
+	errno = 0;
+	dst = strtoll(src, &e, 16);
+	if (errno != 0 || *e != '\0')
+		return -EINVAL;
+
+	return dst;
+}
+
+static struct batch_op *parse_op(int argc, char **argv)
+{
+	struct batch_op *op;
+	enum batch_type type;
+	int handle, offset = 0;
+	uint8_t *value = NULL;
+	size_t vlen = 0;
+	char *e;
+
+	if (g_str_equal(argv[0], "char-read-hnd"))
+		type = BATCH_READ;
+	else if (g_str_equal(argv[0], "char-write-req"))
+		type = BATCH_WRITE_REQ;
+	else if (g_str_equal(argv[0], "char-write-cmd"))
+		type = BATCH_WRITE_CMD;
+	else {
+		g_printerr("Unknown command: %s\n", argv[0]);
+		return NULL;
+	}
+
+	if (argc < 2) {
+		g_printerr("Missing handle for %s\n", argv[0]);
+		return NULL;
+	}
+
+	handle = strtohandle(argv[1]);
+	if (handle <= 0 || handle > 0xffff) {
+		g_printerr("Invalid handle: %s\n", argv[1]);
+		return NULL;
+	}
+
+	if (type == BATCH_READ) {
+		if (argc > 2) {
+			errno = 0;
+			offset = strtol(argv[2], &e, 0);
+			if (errno != 0 || *e != '\0' || offset < 0 ||
+							offset > 0xffff) {
+				g_printerr("Invalid offset: %s\n", argv[2]);
+				return NULL;
+			}
+		}
+	} else {
+		if (argc < 3) {
+			g_printerr("Missing value for %s\n", argv[0]);
+			return NULL;
+		}
+
+		vlen = gatt_attr_data_from_string(argv[2], &value);
+		if (vlen == 0) {
+			g_printerr("Invalid value: %s\n", argv[2]);
+			return NULL;
+		}
+	}
+
+	op = g_new0(struct batch_op, 1);
+	op->type = type;
+	op->handle = handle;
+	op->offset = offset;
+	op->value = value;
+	op->vlen = vlen;
+
+	return op;
+}
+
+static gboolean parse_command(int argc, char **argv)
+{
+	struct batch_op *op;
+	unsigned int i;
+	long count;
+	char *e;
+
+	if (g_str_equal(argv[0], "listen")) {
+		if (argc < 2) {
+			listen_time = 0;
+			return TRUE;
+		}
+
+		errno = 0;
+		count = strtol(argv[1], &e, 10);
+		if (errno != 0 || *e != '\0' || count <= 0 ||
+							count > G_MAXINT) {
+			g_printerr("Invalid listen time: %s\n", argv[1]);
+			return FALSE;
+		}
+
+		listen_time = count;
+		return TRUE;
+	}
+
+	if (g_str_equal(argv[0], "repeat")) {
+		if (argc < 3) {
+			g_printerr("Usage: repeat <count> <command>\n");
+			return FALSE;
+		}
+
+		errno = 0;
+		count = strtol(argv[1], &e, 10);
+		if (errno != 0 || *e != '\0' || count <= 0 || count > 0xffff) {
+			g_printerr("Invalid repeat count: %s\n", argv[1]);
+			return FALSE;
+		}
+
+		argc -= 2;
+		argv += 2;
+	} else
+		count = 1;
+
+	for (i = 0; i < count; i++) {
+		op = parse_op(argc, argv);
+		if (op == NULL)
+			return FALSE;
+
+		op->index = ops->len + 1;
+		g_ptr_array_add(ops, op);
+	}
+
+	return TRUE;
+}
+
+static gboolean parse_script(const gchar *script)
+{
+	GError *gerr = NULL;
+	gchar *contents, **lines;
+	gboolean ret = TRUE;
+	int i;
+
+	if (g_str_equal(script, "-")) {
+		GIOChannel *chan = g_io_channel_unix_new(fileno(stdin));
+		gsize len;
+
+		if (g_io_channel_read_to_end(chan, &contents, &len,
+					&gerr) != G_IO_STATUS_NORMAL)
+			contents = NULL;
+
+		g_io_channel_unref(chan);
+	} else if (!g_file_get_contents(script, &contents, NULL, &gerr))
+		contents = NULL;
+
+	if (contents == NULL) {
+		g_printerr("Unable to read %s: %s\n", script,
+				gerr ? gerr->message : "unknown error");
+		if (gerr)
+			g_error_free(gerr);
+		return FALSE;
+	}
+
+	lines = g_strsplit(contents, "\n", -1);
+	g_free(contents);
+
+	for (i = 0; lines[i] != NULL; i++) {
+		char *line = lines[i];
+		char *comment = strchr(line, '#');
+		gchar **argv;
+		int argc;
+
+		if (comment)
+			*comment = '\0';
+
+		g_strstrip(line);
+		if (*line == '\0')
+			continue;
+
+		if (!g_shell_parse_argv(line, &argc, &argv, &gerr)) {
+			g_printerr("%s:%d: %s\n", script, i + 1,
+							gerr->message);
+			g_error_free(gerr);
+			ret = FALSE;
+			break;
+		}
+
+		ret = parse_command(argc, argv);
+		g_strfreev(argv);
+
+		if (!ret) {
+			g_printerr("%s:%d: invalid command\n", script, i + 1);
+			break;
+		}
+	}
+
+	g_strfreev(lines);
+
+	return ret;
+}
+
+static void print_opcode_stats(const char *name, guint8 opcode)
+{
+	GAttribStats stats;
+
+	if (!g_attrib_get_stats(attrib, opcode, &stats) || stats.sent == 0)
+		return;
+
+	if (stats.completed == 0) {
+		g_print("  %-20s %u sent\n", name, stats.sent);
+		return;
+	}
+
+	g_print("  %-20s %u sent, %u completed, latency avg %.3f ms "
+			"max %.3f ms\n", name, stats.sent, stats.completed,
+			stats.total_latency / (double) stats.completed / 1000,
+			stats.max_latency / 1000.0);
+}
+
+static void print_summary(void)
+{
+	double elapsed = (last_completed - start_time) / 1000000.0;
+	guint depth, max_depth;
+
+	g_print("\n%u operations, %u failed, %.3f s\n", ops->len, failures,
+								elapsed);
+
+	if (ops->len > 0) {
+		g_print("  service time avg %.3f ms max %.3f ms\n",
+				service_time / (double) ops->len / 1000,
+				max_service_time / 1000.0);
+
+		if (elapsed > 0)
+			g_print("  %.1f ops/s, %.1f payload bytes/s\n",
+						ops->len / elapsed,
+						payload / elapsed);
+	}
+
+	print_opcode_stats("Read Request", ATT_OP_READ_REQ);
+	print_opcode_stats("Read Blob Request", ATT_OP_READ_BLOB_REQ);
+	print_opcode_stats("Write Request", ATT_OP_WRITE_REQ);
+	print_opcode_stats("Write Command", ATT_OP_WRITE_CMD);
+
+	depth = g_attrib_get_queue_depth(attrib, &max_depth);
+	g_print("  queue depth %u, max %u\n", depth, max_depth);
+}
+
+static gboolean listen_timeout(gpointer user_data)
+{
+	g_print("%u notifications/indications received\n", notifications);
+
+	g_main_loop_quit(event_loop);
+
+	return FALSE;
+}
+
+static void batch_done(void)
+{
+	print_summary();
+
+	if (listen_time < 0) {
+		g_main_loop_quit(event_loop);
+		return;
+	}
+
+	g_print("\nListening%s\n", listen_time ? "" : ", press Ctrl-C to stop");
+
+	if (listen_time > 0)
+		g_timeout_add_seconds(listen_time, listen_timeout, NULL);
+}
+
+/* With every request queued up front, the time between submitting an
+ * operation and its completion includes the whole queue ahead of it. The
+ * service time only counts from the later of the submission and the
+ * previous completion, which is what the link actually spent on it. */
+static void op_complete(struct batch_op *op, guint8 status, size_t bytes)
+{
+	gint64 now, service;
+
+	/* Commands still queued are dropped when the link goes away */
+	if (stopped)
+		return;
+
+	now = g_get_monotonic_time();
+	service = now - MAX(op->submitted, last_completed);
+
+	last_completed = now;
+	service_time += service;
+	max_service_time = MAX(max_service_time, (guint64) service);
+
+	if (status) {
+		failures++;
+		g_print("%5u %-14s 0x%04x failed: %s\n", op->index,
+				type2str(op->type), op->handle,
+				att_ecode2str(status));
+	} else {
+		payload += bytes;
+		g_print("%5u %-14s 0x%04x %4zu bytes %8.3f ms\n", op->index,
+				type2str(op->type), op->handle, bytes,
+				service / 1000.0);
+	}
+
+	if (--pending == 0)
+		batch_done();
+}
+
+static void read_cb(guint8 status, const guint8 *pdu, guint16 plen,
+							gpointer user_data)
+{
+	struct batch_op *op = user_data;
+
+	op_complete(op, status, status || plen == 0 ? 0 : plen - 1);
+}
+
+static void write_req_cb(guint8 status, const guint8 *pdu, guint16 plen,
+							gpointer user_data)
+{
+	struct batch_op *op = user_data;
+
+	if (status == 0 && !dec_write_resp(pdu, plen))
+		status = ATT_ECODE_IO;
+
+	op_complete(op, status, status ? 0 : op->vlen);
+}
+
+static void write_cmd_sent(gpointer user_data)
+{
+	struct batch_op *op = user_data;
+
+	op_complete(op, 0, op->vlen);
+}
+
+static void submit_op(struct batch_op *op)
+{
+	guint id;
+
+	op->submitted = g_get_monotonic_time();
+
+	switch (op->type) {
+	case BATCH_READ:
+		id = gatt_read_char(attrib, op->handle, op->offset, read_cb,
+									op);
+		break;
+	case BATCH_WRITE_REQ:
+		id = gatt_write_char(attrib, op->handle, op->value, op->vlen,
+							write_req_cb, op);
+		break;
+	case BATCH_WRITE_CMD:
+		id = gatt_write_cmd(attrib, op->handle, op->value, op->vlen,
+							write_cmd_sent, op);
+		break;
+	default:
+		id = 0;
+		break;
+	}
+
+	if (id == 0) {
+		failures++;
+		g_printerr("%5u %-14s 0x%04x could not be queued\n",
+				op->index, type2str(op->type), op->handle);
+		return;
+	}
+
+	pending++;
+}
+
+static void events_handler(const uint8_t *pdu, uint16_t len, gpointer user_data)
+{
+	uint8_t *opdu;
+	uint16_t handle, i, olen;
+	int plen;
+
+	if (len < 3)
+		return;
+
+	handle = att_get_u16(&pdu[1]);
+	notifications++;
+
+	g_print("%s handle = 0x%04x value: ", pdu[0] == ATT_OP_HANDLE_IND ?
+				"Indication  " : "Notification", handle);
+
+	for (i = 3; i < len; i++)
+		g_print("%02x ", pdu[i]);
+
+	g_print("\n");
+
+	if (pdu[0] != ATT_OP_HANDLE_IND)
+		return;
+
+	opdu = g_attrib_get_buffer(attrib, &plen);
+	olen = enc_confirmation(opdu, plen);
+
+	if (olen > 0)
+		g_attrib_send(attrib, 0, opdu[0], opdu, olen, NULL, NULL, NULL);
+}
+
+static gboolean channel_watcher(GIOChannel *chan, GIOCondition cond,
+							gpointer user_data)
+{
+	if (pending > 0) {
+		g_printerr("Disconnected with %u operations pending\n",
+								pending);
+		got_error = TRUE;
+	}
+
+	stopped = TRUE;
+	g_main_loop_quit(event_loop);
+
+	return FALSE;
+}
+
+static void connect_cb(GIOChannel *io, GError *err, gpointer user_data)
+{
+	unsigned int i;
+
+	if (err) {
+		g_printerr("%s\n", err->message);
+		got_error = TRUE;
+		g_main_loop_quit(event_loop);
+		return;
+	}
+
+	attrib = g_attrib_new(io);
+	g_io_add_watch(io, G_IO_HUP, channel_watcher, NULL);
+
+	if (listen_time >= 0) {
+		g_attrib_register(attrib, ATT_OP_HANDLE_NOTIFY,
+					events_handler, NULL, NULL);
+		g_attrib_register(attrib, ATT_OP_HANDLE_IND,
+					events_handler, NULL, NULL);
+	}
+
+	start_time = g_get_monotonic_time();
+	last_completed = start_time;
+
+	/* Hold a completion back until everything has been queued */
+	pending++;
+
+	for (i = 0; i < ops->len; i++)
+		submit_op(g_ptr_array_index(ops, i));
+
+	if (--pending == 0)
+		batch_done();
+}
+
+int batch(const gchar *src, const gchar *dst, const gchar *dst_type,
+				const gchar *sec_level, int psm, int mtu,
+				const gchar *script)
+{
+	GIOChannel *chan;
+
+	ops = g_ptr_array_new_with_free_func(batch_op_free);
+
+	if (!parse_script(script)) {
+		g_ptr_array_free(ops, TRUE);
+		return -EINVAL;
+	}
+
+	chan = gatt_connect(src, dst, dst_type, sec_level, psm, mtu,
+								connect_cb);
+	if (chan == NULL) {
+		g_ptr_array_free(ops, TRUE);
+		return -EIO;
+	}
+
+	event_loop = g_main_loop_new(NULL, FALSE);
+
+	g_main_loop_run(event_loop);
+
+	g_main_loop_unref(event_loop);
+
+	stopped = TRUE;
+
+	if (attrib)
+		g_attrib_unref(attrib);
+
+	g_io_channel_shutdown(chan, FALSE, NULL);
+	g_io_channel_unref(chan);
+
+	g_ptr_array_free(ops, TRUE);
+
+	if (got_error || failures > 0)
+		return -EIO;
+
+	return 0;
+}
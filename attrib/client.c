@@ -47,6 +47,7 @@
 #include "gattrib.h"
 #include "attio.h"
 #include "gatt.h"
+#include "gatt-cache.h"
 #include "client.h"
 
 #define CHAR_INTERFACE "org.bluez.Characteristic"
@@ -76,6 +77,11 @@ struct gatt_service {
 	GSList *offline_chars;
 	GSList *watchers;
 	struct query *query;
+	gboolean descs_known;	/* Descriptor handles are up to date */
+	int desc_walks;
+	gboolean desc_walk_failed;
+	gboolean chars_stale;	/* Remote database changed */
+	gboolean lens_changed;	/* Value lengths differ from the cache */
 };
 
 struct characteristic {
@@ -90,12 +96,18 @@ struct characteristic {
 	struct format *format;
 	uint8_t *value;
 	size_t vlen;
+	uint16_t value_len;	/* Last known length, even before a read */
+	uint16_t desc_handle;	/* User description descriptor */
+	uint16_t fmt_handle;	/* Presentation format descriptor */
 };
 
 struct query_data {
 	struct gatt_service *gatt;
 	struct characteristic *chr;
 	uint16_t handle;
+	uint16_t end;		/* Last handle of a Read By Type walk */
+	uint16_t type;		/* Descriptor type of a Read By Type walk */
+	GSList *batch;		/* Characteristics of a Read Multiple */
 };
 
 struct watcher {
@@ -119,6 +131,14 @@ static void characteristic_free(void *user_data)
 	g_free(chr);
 }
 
+static void query_data_free(void *user_data)
+{
+	struct query_data *data = user_data;
+
+	g_slist_free(data->batch);
+	g_free(data);
+}
+
 static void watcher_free(void *user_data)
 {
 	struct watcher *watcher = user_data;
@@ -155,6 +175,35 @@ static void remove_attio(struct gatt_service *gatt)
 	}
 }
 
+static void unregister_characteristics(struct gatt_service *gatt)
+{
+	GSList *l;
+
+	for (l = gatt->chars; l; l = l->next) {
+		struct characteristic *chr = l->data;
+		g_dbus_unregister_interface(gatt->conn, chr->path,
+							CHAR_INTERFACE);
+	}
+}
+
+/* Requests in flight and pending offline writes point to characteristics,
+ * so they are only dropped once those are done */
+static void drop_characteristics(struct gatt_service *gatt)
+{
+	if (gatt->query || gatt->offline_chars) {
+		gatt->chars_stale = TRUE;
+		return;
+	}
+
+	unregister_characteristics(gatt);
+
+	g_slist_free_full(gatt->chars, characteristic_free);
+	gatt->chars = NULL;
+	gatt->descs_known = FALSE;
+	gatt->chars_stale = FALSE;
+	gatt->lens_changed = FALSE;
+}
+
 static void gatt_get_address(struct gatt_service *gatt, bdaddr_t *sba,
 					bdaddr_t *dba, uint8_t *bdaddr_type)
 {
@@ -240,6 +289,11 @@ static int characteristic_set_value(struct characteristic *chr,
 	memcpy(chr->value, value, vlen);
 	chr->vlen = vlen;
 
+	if (chr->value_len != vlen) {
+		chr->value_len = vlen;
+		chr->gatt->lens_changed = TRUE;
+	}
+
 	return 0;
 }
 
@@ -296,10 +350,13 @@ static void events_handler(const uint8_t *pdu, uint16_t len,
 
 	switch (pdu[0]) {
 	case ATT_OP_HANDLE_IND:
-		opdu = g_attrib_get_buffer(gatt->attrib, &plen);
-		olen = enc_confirmation(opdu, plen);
-		g_attrib_send(gatt->attrib, 0, opdu[0], opdu, olen,
-						NULL, NULL, NULL);
+		/* The device confirms Service Changed itself */
+		if (handle != device_get_service_changed(gatt->dev)) {
+			opdu = g_attrib_get_buffer(gatt->attrib, &plen);
+			olen = enc_confirmation(opdu, plen);
+			g_attrib_send(gatt->attrib, 0, opdu[0], opdu, olen,
+							NULL, NULL, NULL);
+		}
 	case ATT_OP_HANDLE_NOTIFY:
 		if (characteristic_set_value(chr, &pdu[3], len - 3) < 0)
 			DBG("Can't change Characteristic 0x%02x", handle);
@@ -316,6 +373,9 @@ static void offline_char_written(gpointer user_data)
 
 	gatt->offline_chars = g_slist_remove(gatt->offline_chars, chr);
 
+	if (gatt->chars_stale)
+		drop_characteristics(gatt);
+
 	remove_attio(gatt);
 }
 
@@ -328,8 +388,7 @@ static void offline_char_write(gpointer data, gpointer user_data)
 						offline_char_written, chr);
 }
 
-static void char_discovered_cb(GSList *characteristics, guint8 status,
-							gpointer user_data);
+static void query_start(struct gatt_service *gatt, struct query_data *qchr);
 
 static void attio_connected(GAttrib *attrib, gpointer user_data)
 {
@@ -344,15 +403,8 @@ static void attio_connected(GAttrib *attrib, gpointer user_data)
 
 	g_slist_foreach(gatt->offline_chars, offline_char_write, attrib);
 
-	if (gatt->query) {
-		struct gatt_primary *prim = gatt->prim;
-		struct query_data *qchr;
-
-		qchr = g_slist_nth_data(gatt->query->list, 0);
-		gatt_discover_char(gatt->attrib, prim->range.start,
-						prim->range.end, NULL,
-						char_discovered_cb, qchr);
-	}
+	if (gatt->query)
+		query_start(gatt, g_slist_nth_data(gatt->query->list, 0));
 }
 
 static void attio_disconnected(gpointer user_data)
@@ -369,7 +421,7 @@ static void attio_disconnected(gpointer user_data)
 	}
 
 	if (gatt->query) {
-		g_slist_free_full(gatt->query->list, g_free);
+		g_slist_free_full(gatt->query->list, query_data_free);
 		gatt->query = NULL;
 	}
 
@@ -527,42 +579,6 @@ static const GDBusMethodTable char_methods[] = {
 	{ }
 };
 
-static char *characteristic_list_to_string(GSList *chars)
-{
-	GString *characteristics;
-	GSList *l;
-
-	characteristics = g_string_new(NULL);
-
-	for (l = chars; l; l = l->next) {
-		struct characteristic *chr = l->data;
-		char chr_str[64];
-
-		memset(chr_str, 0, sizeof(chr_str));
-
-		snprintf(chr_str, sizeof(chr_str), "%04X#%02X#%04X#%s ",
-				chr->handle, chr->perm, chr->end, chr->type);
-
-		characteristics = g_string_append(characteristics, chr_str);
-	}
-
-	return g_string_free(characteristics, FALSE);
-}
-
-static void store_characteristics(const bdaddr_t *sba, const bdaddr_t *dba,
-					uint8_t bdaddr_type, uint16_t start,
-								GSList *chars)
-{
-	char *characteristics;
-
-	characteristics = characteristic_list_to_string(chars);
-
-	write_device_characteristics(sba, dba, bdaddr_type, start,
-							characteristics);
-
-	g_free(characteristics);
-}
-
 static void register_characteristic(gpointer data, gpointer user_data)
 {
 	struct characteristic *chr = data;
@@ -614,15 +630,177 @@ static GSList *string_to_characteristic_list(struct gatt_service *gatt,
 	return l;
 }
 
+static int uuid_desc16_cmp(bt_uuid_t *uuid, guint16 desc)
+{
+	bt_uuid_t u16;
+
+	bt_uuid16_create(&u16, desc);
+
+	return bt_uuid_cmp(uuid, &u16);
+}
+
+static GSList *cache_to_characteristic_list(struct gatt_service *gatt,
+					struct gatt_cache_service *svc)
+{
+	GSList *l, *chrs_list = NULL;
+
+	for (l = svc->chars; l; l = l->next) {
+		struct gatt_cache_char *cchr = l->data;
+		struct characteristic *chr;
+		GSList *ld;
+
+		chr = g_new0(struct characteristic, 1);
+		chr->gatt = gatt;
+		chr->handle = cchr->value_handle;
+		chr->perm = cchr->properties;
+		chr->end = cchr->end;
+		chr->value_len = cchr->value_len;
+		strncpy(chr->type, cchr->uuid, sizeof(chr->type) - 1);
+
+		for (ld = cchr->descs; ld; ld = ld->next) {
+			struct gatt_cache_desc *desc = ld->data;
+
+			if (uuid_desc16_cmp(&desc->uuid,
+					GATT_CHARAC_USER_DESC_UUID) == 0)
+				chr->desc_handle = desc->handle;
+			else if (uuid_desc16_cmp(&desc->uuid,
+						GATT_CHARAC_FMT_UUID) == 0)
+				chr->fmt_handle = desc->handle;
+		}
+
+		chrs_list = g_slist_append(chrs_list, chr);
+	}
+
+	return chrs_list;
+}
+
+static struct gatt_cache_service *find_cached_service(
+						struct gatt_service *gatt,
+						struct gatt_cache *cache)
+{
+	struct gatt_primary *prim = gatt->prim;
+	struct gatt_cache_service *svc;
+
+	svc = gatt_cache_find_service(cache, prim->range.start);
+	if (svc == NULL || !svc->chars_valid)
+		return NULL;
+
+	if (svc->prim.range.end != prim->range.end)
+		return NULL;
+
+	return svc;
+}
+
+static gboolean cached_characteristics_valid(struct gatt_service *gatt)
+{
+	struct gatt_cache *cache;
+	bdaddr_t sba, dba;
+	uint8_t bdaddr_type;
+	gboolean valid;
+
+	gatt_get_address(gatt, &sba, &dba, &bdaddr_type);
+
+	cache = gatt_cache_load(&sba, &dba, bdaddr_type);
+	if (cache == NULL)
+		return FALSE;
+
+	valid = find_cached_service(gatt, cache) != NULL;
+
+	gatt_cache_free(cache);
+
+	return valid;
+}
+
+static void add_cached_desc(struct gatt_cache_char *cchr, uint16_t handle,
+								uint16_t type)
+{
+	struct gatt_cache_desc *desc;
+
+	desc = g_new0(struct gatt_cache_desc, 1);
+	desc->handle = handle;
+	bt_uuid16_create(&desc->uuid, type);
+
+	cchr->descs = g_slist_append(cchr->descs, desc);
+}
+
+static void store_cache(struct gatt_service *gatt)
+{
+	struct gatt_cache *cache;
+	struct gatt_cache_service *svc;
+	bdaddr_t sba, dba;
+	uint8_t bdaddr_type;
+	GSList *l;
+
+	/* Results of requests sent before the cache was invalidated */
+	if (gatt->chars_stale)
+		return;
+
+	gatt_get_address(gatt, &sba, &dba, &bdaddr_type);
+
+	cache = gatt_cache_load(&sba, &dba, bdaddr_type);
+	if (cache == NULL)
+		cache = gatt_cache_new();
+
+	svc = gatt_cache_add_service(cache, gatt->prim);
+	gatt_cache_service_clear(svc);
+
+	svc->chars_valid = TRUE;
+	svc->descs_valid = gatt->descs_known;
+
+	for (l = gatt->chars; l; l = l->next) {
+		struct characteristic *chr = l->data;
+		struct gatt_cache_char *cchr;
+
+		cchr = g_new0(struct gatt_cache_char, 1);
+		strncpy(cchr->uuid, chr->type, sizeof(cchr->uuid) - 1);
+		/* The value always follows its declaration */
+		cchr->handle = chr->handle - 1;
+		cchr->value_handle = chr->handle;
+		cchr->end = chr->end;
+		cchr->properties = chr->perm;
+		cchr->value_len = chr->value_len;
+
+		if (chr->desc_handle)
+			add_cached_desc(cchr, chr->desc_handle,
+						GATT_CHARAC_USER_DESC_UUID);
+
+		if (chr->fmt_handle)
+			add_cached_desc(cchr, chr->fmt_handle,
+						GATT_CHARAC_FMT_UUID);
+
+		svc->chars = g_slist_append(svc->chars, cchr);
+	}
+
+	gatt_cache_store(&sba, &dba, bdaddr_type, cache);
+	gatt_cache_free(cache);
+}
+
 static GSList *load_characteristics(struct gatt_service *gatt, uint16_t start)
 {
 	GSList *chrs_list;
+	struct gatt_cache *cache;
+	struct gatt_cache_service *svc;
 	bdaddr_t sba, dba;
 	uint8_t bdaddr_type;
 	char *str;
 
 	gatt_get_address(gatt, &sba, &dba, &bdaddr_type);
 
+	cache = gatt_cache_load(&sba, &dba, bdaddr_type);
+	if (cache != NULL) {
+		svc = find_cached_service(gatt, cache);
+		if (svc != NULL) {
+			chrs_list = cache_to_characteristic_list(gatt, svc);
+			gatt->descs_known = svc->descs_valid;
+			gatt_cache_free(cache);
+			return chrs_list;
+		}
+
+		gatt_cache_free(cache);
+	}
+
+	/* Characteristics stored by older versions */
+
 	str = read_device_characteristics(&sba, &dba, bdaddr_type, start);
 	if (str == NULL)
 		return NULL;
@@ -681,73 +859,81 @@ static void query_list_remove(struct gatt_service *gatt, struct query_data *data
 	g_free(query);
 	gatt->query = NULL;
 
+	if (gatt->chars_stale)
+		drop_characteristics(gatt);
+
+	/* Lengths learned by this round of reads let the next refresh,
+	 * even after a restart, pack the values in Read Multiple */
+	if (gatt->lens_changed) {
+		gatt->lens_changed = FALSE;
+		store_cache(gatt);
+	}
+
 	remove_attio(gatt);
 }
 
-static void update_char_desc(guint8 status, const guint8 *pdu, guint16 len,
-							gpointer user_data)
+static gboolean raise_security(struct gatt_service *gatt)
 {
-	struct query_data *current = user_data;
-	struct gatt_service *gatt = current->gatt;
-	struct characteristic *chr = current->chr;
+	GIOChannel *io = g_attrib_get_channel(gatt->attrib);
+	BtIOSecLevel level = BT_IO_SEC_HIGH;
 
-	if (status == 0) {
+	bt_io_get(io, BT_IO_L2CAP, NULL,
+			BT_IO_OPT_SEC_LEVEL, &level,
+			BT_IO_OPT_INVALID);
 
-		g_free(chr->desc);
-
-		chr->desc = g_malloc(len);
-		memcpy(chr->desc, pdu + 1, len - 1);
-		chr->desc[len - 1] = '\0';
-
-		store_attribute(gatt, current->handle,
-				GATT_CHARAC_USER_DESC_UUID,
-				(void *) chr->desc, len);
-	} else if (status == ATT_ECODE_INSUFF_ENC) {
-		GIOChannel *io = g_attrib_get_channel(gatt->attrib);
-		BtIOSecLevel level = BT_IO_SEC_HIGH;
+	if (level >= BT_IO_SEC_HIGH)
+		return FALSE;
 
-		bt_io_get(io, BT_IO_L2CAP, NULL,
-				BT_IO_OPT_SEC_LEVEL, &level,
-				BT_IO_OPT_INVALID);
+	return bt_io_set(io, BT_IO_L2CAP, NULL,
+			BT_IO_OPT_SEC_LEVEL, level + 1,
+			BT_IO_OPT_INVALID);
+}
 
-		if (level < BT_IO_SEC_HIGH)
-			level++;
+static void characteristic_set_desc(struct characteristic *chr,
+				uint16_t handle, const uint8_t *value,
+				uint16_t vlen)
+{
+	g_free(chr->desc);
 
-		if (bt_io_set(io, BT_IO_L2CAP, NULL,
-				BT_IO_OPT_SEC_LEVEL, level,
-				BT_IO_OPT_INVALID)) {
-			gatt_read_char(gatt->attrib, current->handle, 0,
-					update_char_desc, current);
-			return;
-		}
-	}
+	chr->desc = g_malloc(vlen + 1);
+	memcpy(chr->desc, value, vlen);
+	chr->desc[vlen] = '\0';
 
-	query_list_remove(gatt, current);
-	g_free(current);
+	store_attribute(chr->gatt, handle, GATT_CHARAC_USER_DESC_UUID,
+					(void *) chr->desc, vlen + 1);
 }
 
-static void update_char_format(guint8 status, const guint8 *pdu, guint16 len,
-								gpointer user_data)
+static void characteristic_set_format(struct characteristic *chr,
+				uint16_t handle, const uint8_t *value,
+				uint16_t vlen)
 {
-	struct query_data *current = user_data;
-	struct gatt_service *gatt = current->gatt;
-	struct characteristic *chr = current->chr;
-
-	if (status != 0)
-		goto done;
-
-	if (len < 8)
-		goto done;
+	if (vlen < 7)
+		return;
 
 	g_free(chr->format);
 
 	chr->format = g_new0(struct format, 1);
-	memcpy(chr->format, pdu + 1, 7);
+	memcpy(chr->format, value, 7);
 
-	store_attribute(gatt, current->handle, GATT_CHARAC_FMT_UUID,
+	store_attribute(chr->gatt, handle, GATT_CHARAC_FMT_UUID,
 				(void *) chr->format, sizeof(*chr->format));
+}
+
+static void update_char_desc(guint8 status, const guint8 *pdu, guint16 len,
+							gpointer user_data)
+{
+	struct query_data *current = user_data;
+	struct gatt_service *gatt = current->gatt;
+	struct characteristic *chr = current->chr;
+
+	if (status == 0)
+		characteristic_set_desc(chr, current->handle, pdu + 1, len - 1);
+	else if (status == ATT_ECODE_INSUFF_ENC && raise_security(gatt)) {
+		gatt_read_char(gatt->attrib, current->handle, 0,
+					update_char_desc, current);
+		return;
+	}
 
-done:
 	query_list_remove(gatt, current);
 	g_free(current);
 }
@@ -777,95 +963,365 @@ static void update_char_value(guint8 status, const guint8 *pdu,
 	g_free(current);
 }
 
-static int uuid_desc16_cmp(bt_uuid_t *uuid, guint16 desc)
+static void update_char_format(guint8 status, const guint8 *pdu, guint16 len,
+								gpointer user_data)
 {
-	bt_uuid_t u16;
+	struct query_data *current = user_data;
+	struct gatt_service *gatt = current->gatt;
+	struct characteristic *chr = current->chr;
 
-	bt_uuid16_create(&u16, desc);
+	if (status == 0 && len > 0)
+		characteristic_set_format(chr, current->handle, pdu + 1,
+								len - 1);
 
-	return bt_uuid_cmp(uuid, &u16);
+	query_list_remove(gatt, current);
+	g_free(current);
+}
+
+static void read_char_desc(struct gatt_service *gatt,
+				struct characteristic *chr, uint16_t handle,
+				GAttribResultFunc func)
+{
+	struct query_data *qdesc;
+
+	qdesc = g_new0(struct query_data, 1);
+	qdesc->gatt = gatt;
+	qdesc->chr = chr;
+	qdesc->handle = handle;
+
+	query_list_append(gatt, qdesc);
+
+	gatt_read_char(gatt->attrib, handle, 0, func, qdesc);
 }
 
-static void descriptor_cb(guint8 status, const guint8 *pdu, guint16 plen,
+static void read_char_value(struct gatt_service *gatt,
+						struct characteristic *chr)
+{
+	struct query_data *qvalue;
+
+	qvalue = g_new0(struct query_data, 1);
+	qvalue->gatt = gatt;
+	qvalue->chr = chr;
+
+	query_list_append(gatt, qvalue);
+
+	gatt_read_char(gatt->attrib, chr->handle, 0, update_char_value, qvalue);
+}
+
+static struct characteristic *find_char_by_desc(struct gatt_service *gatt,
+							uint16_t handle)
+{
+	GSList *l;
+
+	for (l = gatt->chars; l; l = l->next) {
+		struct characteristic *chr = l->data;
+
+		if (handle > chr->handle && handle <= chr->end)
+			return chr;
+	}
+
+	return NULL;
+}
+
+static void refresh_desc_cb(guint8 status, const guint8 *pdu, guint16 plen,
+							gpointer user_data);
+
+/* Once both walks covered the whole service the descriptor handles are
+ * cached, later refreshes read them directly */
+static void refresh_desc_done(struct gatt_service *gatt, gboolean complete)
+{
+	if (!complete)
+		gatt->desc_walk_failed = TRUE;
+
+	if (--gatt->desc_walks > 0 || gatt->desc_walk_failed)
+		return;
+
+	gatt->descs_known = TRUE;
+	store_cache(gatt);
+}
+
+static guint refresh_desc_send(struct query_data *qdesc)
+{
+	struct gatt_service *gatt = qdesc->gatt;
+	bt_uuid_t uuid;
+
+	bt_uuid16_create(&uuid, qdesc->type);
+
+	return gatt_read_char_by_uuid(gatt->attrib, qdesc->handle, qdesc->end,
+					&uuid, refresh_desc_cb, qdesc);
+}
+
+static void refresh_desc_cb(guint8 status, const guint8 *pdu, guint16 plen,
 							gpointer user_data)
 {
 	struct query_data *current = user_data;
 	struct gatt_service *gatt = current->gatt;
 	struct att_data_list *list;
-	guint8 format;
-	int i;
+	gboolean complete = FALSE;
+	uint16_t last = 0;
+	int buflen, i;
 
-	if (status != 0)
-		goto done;
+	if (status == ATT_ECODE_INSUFF_ENC && raise_security(gatt) &&
+					refresh_desc_send(current) != 0)
+		return;
+
+	/* Attribute Not Found ends the walk over the service range */
+	if (status == ATT_ECODE_ATTR_NOT_FOUND)
+		complete = TRUE;
 
-	DBG("Find Information Response received");
+	if (status != 0 || plen < 2 || pdu[1] < 2)
+		goto done;
 
-	list = dec_find_info_resp(pdu, plen, &format);
+	list = dec_read_by_type_resp(pdu, plen);
 	if (list == NULL)
 		goto done;
 
+	g_attrib_get_buffer(gatt->attrib, &buflen);
+
 	for (i = 0; i < list->num; i++) {
-		guint16 handle;
-		bt_uuid_t uuid;
-		uint8_t *info = list->data[i];
-		struct query_data *qfmt;
-
-		handle = att_get_u16(info);
-
-		if (format == 0x01) {
-			uuid = att_get_uuid16(&info[2]);
-		} else {
-			/* Currently, only "user description" and "presentation
-			 * format" descriptors are used, and both have 16-bit
-			 * UUIDs. Therefore there is no need to support format
-			 * 0x02 yet. */
+		uint8_t *data = list->data[i];
+		struct characteristic *chr;
+		uint16_t handle;
+
+		handle = att_get_u16(data);
+		last = handle;
+
+		chr = find_char_by_desc(gatt, handle);
+		if (chr == NULL)
+			continue;
+
+		if (current->type == GATT_CHARAC_FMT_UUID) {
+			chr->fmt_handle = handle;
+			characteristic_set_format(chr, handle, data + 2,
+								list->len - 2);
 			continue;
 		}
-		qfmt = g_new0(struct query_data, 1);
-		qfmt->gatt = current->gatt;
-		qfmt->chr = current->chr;
-		qfmt->handle = handle;
-
-		if (uuid_desc16_cmp(&uuid, GATT_CHARAC_USER_DESC_UUID) == 0) {
-			query_list_append(gatt, qfmt);
-			gatt_read_char(gatt->attrib, handle, 0, update_char_desc,
-									qfmt);
-		} else if (uuid_desc16_cmp(&uuid, GATT_CHARAC_FMT_UUID) == 0) {
-			query_list_append(gatt, qfmt);
-			gatt_read_char(gatt->attrib, handle, 0,
-						update_char_format, qfmt);
-		} else
-			g_free(qfmt);
+
+		chr->desc_handle = handle;
+
+		/* A lone description filling the PDU may have been
+		 * truncated, fetch it again with a long read */
+		if (list->num == 1 && plen >= buflen) {
+			read_char_desc(gatt, chr, handle, update_char_desc);
+			continue;
+		}
+
+		characteristic_set_desc(chr, handle, data + 2, list->len - 2);
 	}
 
 	att_data_list_free(list);
+
+	/* Responses stop at the first value of a different length */
+	if (last >= current->handle && last < current->end) {
+		current->handle = last + 1;
+		if (refresh_desc_send(current) != 0)
+			return;
+	} else if (last >= current->end)
+		complete = TRUE;
+
 done:
+	refresh_desc_done(gatt, complete);
 	query_list_remove(gatt, current);
-	g_free(current);
+	query_data_free(current);
 }
 
-static void update_all_chars(gpointer data, gpointer user_data)
+static void refresh_desc(struct gatt_service *gatt, uint16_t type,
+						uint16_t start, uint16_t end)
 {
-	struct query_data *qdesc, *qvalue;
-	struct characteristic *chr = data;
-	struct gatt_service *gatt = user_data;
+	struct query_data *qdesc;
 
 	qdesc = g_new0(struct query_data, 1);
 	qdesc->gatt = gatt;
-	qdesc->chr = chr;
+	qdesc->handle = start;
+	qdesc->end = end;
+	qdesc->type = type;
 
+	if (refresh_desc_send(qdesc) == 0) {
+		gatt->desc_walk_failed = TRUE;
+		query_data_free(qdesc);
+		return;
+	}
+
+	gatt->desc_walks++;
 	query_list_append(gatt, qdesc);
+}
 
-	gatt_find_info(gatt->attrib, chr->handle + 1, chr->end, descriptor_cb,
-									qdesc);
+static void refresh_multi_cb(guint8 status, const guint8 *pdu, guint16 plen,
+							gpointer user_data);
 
-	qvalue = g_new0(struct query_data, 1);
-	qvalue->gatt = gatt;
-	qvalue->chr = chr;
+static guint refresh_multi_send(struct query_data *qmulti)
+{
+	struct gatt_service *gatt = qmulti->gatt;
+	uint16_t handles[ATT_MAX_MTU / 2];
+	GSList *l;
+	int num;
 
-	query_list_append(gatt, qvalue);
+	for (l = qmulti->batch, num = 0; l && num < ATT_MAX_MTU / 2;
+							l = l->next, num++) {
+		struct characteristic *chr = l->data;
 
-	gatt_read_char(gatt->attrib, chr->handle, 0, update_char_value, qvalue);
+		handles[num] = chr->handle;
+	}
+
+	return gatt_read_char_multi(gatt->attrib, handles, num,
+						refresh_multi_cb, qmulti);
+}
+
+static void refresh_multi_cb(guint8 status, const guint8 *pdu, guint16 plen,
+							gpointer user_data)
+{
+	struct query_data *current = user_data;
+	struct gatt_service *gatt = current->gatt;
+	const guint8 *value = pdu + 1;
+	size_t total = 0;
+	GSList *l;
+
+	if (status == ATT_ECODE_INSUFF_ENC && raise_security(gatt) &&
+					refresh_multi_send(current) != 0)
+		return;
+
+	for (l = current->batch; l; l = l->next) {
+		struct characteristic *chr = l->data;
+
+		total += chr->value_len;
+	}
+
+	/* Values are concatenated without lengths, the response can only be
+	 * split if every value kept its previous length */
+	if (status != 0 || plen != total + 1) {
+		DBG("Read Multiple failed (0x%02x), reading values one by one",
+									status);
+		for (l = current->batch; l; l = l->next)
+			read_char_value(gatt, l->data);
+		goto done;
+	}
+
+	for (l = current->batch; l; l = l->next) {
+		struct characteristic *chr = l->data;
+
+		uint16_t len = chr->value_len;
+
+		characteristic_set_value(chr, value, len);
+		value += len;
+	}
+
+done:
+	query_list_remove(gatt, current);
+	query_data_free(current);
+}
+
+static void refresh_multi_flush(struct query_data *qmulti)
+{
+	struct gatt_service *gatt = qmulti->gatt;
+	GSList *l;
+
+	/* A batch of a single handle goes out as a plain Read Request */
+	if (refresh_multi_send(qmulti) != 0) {
+		query_list_append(gatt, qmulti);
+		return;
+	}
+
+	for (l = qmulti->batch; l; l = l->next)
+		read_char_value(gatt, l->data);
+
+	query_data_free(qmulti);
+}
+
+static void refresh_values(struct gatt_service *gatt)
+{
+	struct query_data *qmulti = NULL;
+	size_t rsp_len = 0;
+	int buflen, num = 0;
+	GSList *l;
+
+	g_attrib_get_buffer(gatt->attrib, &buflen);
+
+	for (l = gatt->chars; l; l = l->next) {
+		struct characteristic *chr = l->data;
+
+		/* Only values of known length can share a Read Multiple */
+		if (!(chr->perm & ATT_CHAR_PROPER_READ) ||
+							chr->value_len == 0) {
+			read_char_value(gatt, chr);
+			continue;
+		}
+
+		if (qmulti != NULL && (1 + (num + 1) * 2 > buflen ||
+				1 + rsp_len + chr->value_len > buflen)) {
+			refresh_multi_flush(qmulti);
+			qmulti = NULL;
+		}
+
+		if (qmulti == NULL) {
+			qmulti = g_new0(struct query_data, 1);
+			qmulti->gatt = gatt;
+			rsp_len = 0;
+			num = 0;
+		}
+
+		qmulti->batch = g_slist_append(qmulti->batch, chr);
+		rsp_len += chr->value_len;
+		num++;
+	}
+
+	if (qmulti != NULL)
+		refresh_multi_flush(qmulti);
+}
+
+/* Refresh descriptors and values of all characteristics, packing as many
+ * of them as possible in each PDU. ATT allows a single outstanding request,
+ * so everything is queued up front and GAttrib sends the next request as
+ * soon as the previous response arrives. */
+static void refresh_chars(struct gatt_service *gatt)
+{
+	struct gatt_primary *prim = gatt->prim;
+	struct characteristic *first;
+	GSList *l;
+
+	if (gatt->chars == NULL)
+		return;
+
+	if (gatt->descs_known) {
+		for (l = gatt->chars; l; l = l->next) {
+			struct characteristic *chr = l->data;
+
+			if (chr->desc_handle)
+				read_char_desc(gatt, chr, chr->desc_handle,
+							update_char_desc);
+
+			if (chr->fmt_handle)
+				read_char_desc(gatt, chr, chr->fmt_handle,
+							update_char_format);
+		}
+
+		refresh_values(gatt);
+		return;
+	}
+
+	for (l = gatt->chars; l; l = l->next) {
+		struct characteristic *chr = l->data;
+
+		chr->desc_handle = 0;
+		chr->fmt_handle = 0;
+	}
+
+	gatt->desc_walks = 0;
+	gatt->desc_walk_failed = FALSE;
+
+	first = gatt->chars->data;
+
+	if (first->handle < prim->range.end) {
+		refresh_desc(gatt, GATT_CHARAC_USER_DESC_UUID,
+				first->handle + 1, prim->range.end);
+		refresh_desc(gatt, GATT_CHARAC_FMT_UUID,
+				first->handle + 1, prim->range.end);
+	} else {
+		/* No room for descriptors in this service */
+		gatt->descs_known = TRUE;
+		store_cache(gatt);
+	}
+
+	refresh_values(gatt);
 }
 
 static DBusMessage *create_discover_char_reply(DBusMessage *msg, GSList *chars)
@@ -902,8 +1358,6 @@ static void char_discovered_cb(GSList *characteristics, guint8 status,
 	struct gatt_primary *prim = gatt->prim;
 	uint16_t *previous_end = NULL;
 	GSList *l;
-	bdaddr_t sba, dba;
-	uint8_t bdaddr_type;
 
 	if (status != 0) {
 		const char *str = att_ecode2str(status);
@@ -942,11 +1396,10 @@ static void char_discovered_cb(GSList *characteristics, guint8 status,
 	if (previous_end)
 		*previous_end = prim->range.end;
 
-	gatt_get_address(gatt, &sba, &dba, &bdaddr_type);
-	store_characteristics(&sba, &dba, bdaddr_type, prim->range.start,
-								gatt->chars);
+	gatt->descs_known = FALSE;
+	store_cache(gatt);
 
-	g_slist_foreach(gatt->chars, update_all_chars, gatt);
+	refresh_chars(gatt);
 
 	reply = create_discover_char_reply(gatt->query->msg, gatt->chars);
 
@@ -959,14 +1412,32 @@ fail:
 	g_free(current);
 }
 
+static void query_start(struct gatt_service *gatt, struct query_data *qchr)
+{
+	struct gatt_primary *prim = gatt->prim;
+
+	if (gatt->query->msg != NULL) {
+		gatt_discover_char(gatt->attrib, prim->range.start,
+						prim->range.end, NULL,
+						char_discovered_cb, qchr);
+		return;
+	}
+
+	refresh_chars(gatt);
+
+	query_list_remove(gatt, qchr);
+	g_free(qchr);
+}
+
 static DBusMessage *discover_char(DBusConnection *conn, DBusMessage *msg,
 								void *data)
 {
 	struct gatt_service *gatt = data;
+	DBusMessage *reply = NULL;
 	struct query *query;
 	struct query_data *qchr;
 
-	if (gatt->query)
+	if (gatt->query || gatt->chars_stale)
 		return btd_error_busy(msg);
 
 	query = g_new0(struct query, 1);
@@ -974,25 +1445,26 @@ static DBusMessage *discover_char(DBusConnection *conn, DBusMessage *msg,
 	qchr = g_new0(struct query_data, 1);
 	qchr->gatt = gatt;
 
-	query->msg = dbus_message_ref(msg);
+	/* Cached characteristics are returned right away, once connected
+	 * only their values and descriptors are refreshed */
+	if (gatt->chars != NULL && cached_characteristics_valid(gatt))
+		reply = create_discover_char_reply(msg, gatt->chars);
+	else
+		query->msg = dbus_message_ref(msg);
+
+	gatt->query = query;
+
+	query_list_append(gatt, qchr);
 
-	if (gatt->attioid == 0) {
+	if (gatt->attioid == 0)
 		gatt->attioid = btd_device_add_attio_callback(gatt->dev,
 							attio_connected,
 							attio_disconnected,
 							gatt);
-	} else if (gatt->attrib) {
-		struct gatt_primary *prim = gatt->prim;
-		gatt_discover_char(gatt->attrib, prim->range.start,
-						prim->range.end, NULL,
-						char_discovered_cb, qchr);
-	}
+	else if (gatt->attrib)
+		query_start(gatt, qchr);
 
-	gatt->query = query;
-
-	query_list_append(gatt, qchr);
-
-	return NULL;
+	return reply;
 }
 
 static DBusMessage *prim_get_properties(DBusConnection *conn, DBusMessage *msg,
@@ -1104,13 +1576,7 @@ GSList *attrib_client_register(DBusConnection *connection,
 
 static void primary_unregister(struct gatt_service *gatt)
 {
-	GSList *l;
-
-	for (l = gatt->chars; l; l = l->next) {
-		struct characteristic *chr = l->data;
-		g_dbus_unregister_interface(gatt->conn, chr->path,
-							CHAR_INTERFACE);
-	}
+	unregister_characteristics(gatt);
 
 	g_dbus_unregister_interface(gatt->conn, gatt->path, CHAR_INTERFACE);
 
@@ -1144,3 +1610,19 @@ void attrib_client_unregister(GSList *services)
 	g_slist_free(gatt_services);
 	gatt_services = left;
 }
+
+void attrib_client_invalidate(GSList *services)
+{
+	GSList *l;
+
+	for (l = gatt_services; l; l = l->next) {
+		struct gatt_service *gatt = l->data;
+
+		if (!g_slist_find_custom(services, gatt->path, path_cmp))
+			continue;
+
+		DBG("Dropping characteristics of %s", gatt->path);
+
+		drop_characteristics(gatt);
+	}
+}
@@ -26,3 +26,4 @@ GSList *attrib_client_register(DBusConnection *connection,
 					struct btd_device *device, int psm,
 					GAttrib *attrib, GSList *primaries);
 void attrib_client_unregister(GSList *services);
+void attrib_client_invalidate(GSList *services);
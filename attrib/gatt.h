@@ -37,6 +37,7 @@
 #define GATT_CHARAC_RECONNECTION_ADDRESS	0x2A03
 #define GATT_CHARAC_PERIPHERAL_PREF_CONN	0x2A04
 #define GATT_CHARAC_SERVICE_CHANGED		0x2A05
+#define GATT_CHARAC_DATABASE_HASH		0x2B2A
 
 /* GATT Characteristic Descriptors */
 #define GATT_CHARAC_EXT_PROPER_UUID	0x2900
@@ -76,6 +77,9 @@ guint gatt_discover_char(GAttrib *attrib, uint16_t start, uint16_t end,
 guint gatt_read_char(GAttrib *attrib, uint16_t handle, uint16_t offset,
 				GAttribResultFunc func, gpointer user_data);
 
+guint gatt_read_char_multi(GAttrib *attrib, const uint16_t *handles, int num,
+				GAttribResultFunc func, gpointer user_data);
+
 guint gatt_write_char(GAttrib *attrib, uint16_t handle, uint8_t *value,
 			int vlen, GAttribResultFunc func, gpointer user_data);
 
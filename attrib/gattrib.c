@@ -38,6 +38,9 @@
 
 #define GATT_TIMEOUT 30
 
+/* Maximum PDUs without response written in a single wakeup */
+#define WRITE_BUDGET 64
+
 struct _GAttrib {
 	GIOChannel *io;
 	gint refs;
@@ -53,6 +56,8 @@ struct _GAttrib {
 	GDestroyNotify destroy;
 	gpointer destroy_user_data;
 	gboolean stale;
+	GAttribStats *stats;		/* Indexed by opcode */
+	guint max_depth;
 };
 
 struct command {
@@ -62,6 +67,7 @@ struct command {
 	guint16 len;
 	guint8 expected;
 	gboolean sent;
+	gint64 sent_time;
 	GAttribResultFunc func;
 	gpointer user_data;
 	GDestroyNotify notify;
@@ -209,6 +215,7 @@ static void attrib_destroy(GAttrib *attrib)
 	if (attrib->destroy)
 		attrib->destroy(attrib->destroy_user_data);
 
+	g_free(attrib->stats);
 	g_free(attrib);
 }
 
@@ -279,6 +286,31 @@ done:
 	return FALSE;
 }
 
+static void command_sent(struct _GAttrib *attrib, struct command *cmd)
+{
+	if (attrib->stats == NULL)
+		attrib->stats = g_new0(GAttribStats, 256);
+
+	attrib->stats[cmd->opcode].sent++;
+	cmd->sent_time = g_get_monotonic_time();
+}
+
+static void command_completed(struct _GAttrib *attrib, struct command *cmd)
+{
+	GAttribStats *stats;
+	gint64 latency;
+
+	if (attrib->stats == NULL || cmd->sent_time == 0)
+		return;
+
+	stats = &attrib->stats[cmd->opcode];
+	latency = g_get_monotonic_time() - cmd->sent_time;
+
+	stats->completed++;
+	stats->total_latency += latency;
+	stats->max_latency = MAX(stats->max_latency, latency);
+}
+
 static gboolean can_write_data(GIOChannel *io, GIOCondition cond,
 								gpointer data)
 {
@@ -288,6 +320,7 @@ static gboolean can_write_data(GIOChannel *io, GIOCondition cond,
 	gsize len;
 	GIOStatus iostat;
 	GQueue *queue;
+	int budget;
 
 	if (attrib->stale)
 		return FALSE;
@@ -295,33 +328,51 @@ static gboolean can_write_data(GIOChannel *io, GIOCondition cond,
 	if (cond & (G_IO_HUP | G_IO_ERR | G_IO_NVAL))
 		return FALSE;
 
-	queue = attrib->responses;
-	cmd = g_queue_peek_head(queue);
-	if (cmd == NULL) {
-		queue = attrib->requests;
-		cmd = g_queue_peek_head(queue);
-	}
-	if (cmd == NULL)
-		return FALSE;
-
 	/*
-	 * Verify that we didn't already send this command. This can only
-	 * happen with elementes from attrib->requests.
+	 * PDUs without response are written back to back until the socket
+	 * would block, the budget is used or a request has to wait for its
+	 * response.
 	 */
-	if (cmd->sent)
-		return FALSE;
+	for (budget = WRITE_BUDGET; budget > 0; budget--) {
+		queue = attrib->responses;
+		cmd = g_queue_peek_head(queue);
+		if (cmd == NULL) {
+			queue = attrib->requests;
+			cmd = g_queue_peek_head(queue);
+		}
+		if (cmd == NULL)
+			return FALSE;
 
-	iostat = g_io_channel_write_chars(io, (gchar *) cmd->pdu, cmd->len,
-								&len, &gerr);
-	if (iostat != G_IO_STATUS_NORMAL)
-		return FALSE;
+		/*
+		 * Verify that we didn't already send this command. This can
+		 * only happen with elementes from attrib->requests.
+		 */
+		if (cmd->sent)
+			return FALSE;
+
+		iostat = g_io_channel_write_chars(io, (gchar *) cmd->pdu,
+						cmd->len, &len, &gerr);
+		if (iostat == G_IO_STATUS_AGAIN)
+			return TRUE;
+
+		if (iostat != G_IO_STATUS_NORMAL) {
+			if (gerr)
+				g_error_free(gerr);
+			return FALSE;
+		}
+
+		command_sent(attrib, cmd);
+
+		if (cmd->expected != 0)
+			break;
 
-	if (cmd->expected == 0) {
 		g_queue_pop_head(queue);
 		command_destroy(cmd);
+	}
 
+	/* Budget used, wait for the next wakeup */
+	if (budget == 0)
 		return TRUE;
-	}
 
 	cmd->sent = TRUE;
 
@@ -356,7 +407,7 @@ static gboolean received_data(GIOChannel *io, GIOCondition cond, gpointer data)
 	struct _GAttrib *attrib = data;
 	struct command *cmd = NULL;
 	GSList *l;
-	uint8_t buf[512], status;
+	uint8_t buf[ATT_MAX_MTU], status;
 	gsize len;
 	GIOStatus iostat;
 	gboolean norequests, noresponses;
@@ -421,6 +472,8 @@ done:
 			g_queue_is_empty(attrib->responses);
 
 	if (cmd) {
+		command_completed(attrib, cmd);
+
 		if (cmd->func)
 			cmd->func(status, buf, len, cmd->user_data);
 
@@ -459,7 +512,10 @@ GAttrib *g_attrib_new(GIOChannel *io)
 	if (attrib == NULL)
 		return NULL;
 
-	att_mtu = (cid == ATT_CID) ? ATT_DEFAULT_LE_MTU : imtu;
+	if (cid == ATT_CID)
+		att_mtu = ATT_DEFAULT_LE_MTU;
+	else
+		att_mtu = MIN(imtu, ATT_MAX_MTU);
 
 	attrib->buf = g_malloc0(att_mtu);
 	attrib->buflen = att_mtu;
@@ -515,6 +571,10 @@ guint g_attrib_send(GAttrib *attrib, guint id, guint8 opcode,
 		g_queue_push_tail(queue, c);
 	}
 
+	attrib->max_depth = MAX(attrib->max_depth,
+					g_queue_get_length(attrib->requests) +
+					g_queue_get_length(attrib->responses));
+
 	/*
 	 * If a command was added to the queue and it was empty before, wake up
 	 * the sender. If the sender was already woken up by the second queue,
@@ -617,6 +677,32 @@ gboolean g_attrib_set_debug(GAttrib *attrib,
 	return TRUE;
 }
 
+gboolean g_attrib_get_stats(GAttrib *attrib, guint8 opcode,
+							GAttribStats *stats)
+{
+	if (attrib == NULL || stats == NULL)
+		return FALSE;
+
+	if (attrib->stats == NULL)
+		memset(stats, 0, sizeof(*stats));
+	else
+		*stats = attrib->stats[opcode];
+
+	return TRUE;
+}
+
+guint g_attrib_get_queue_depth(GAttrib *attrib, guint *max_depth)
+{
+	if (attrib == NULL)
+		return 0;
+
+	if (max_depth)
+		*max_depth = attrib->max_depth;
+
+	return g_queue_get_length(attrib->requests) +
+				g_queue_get_length(attrib->responses);
+}
+
 uint8_t *g_attrib_get_buffer(GAttrib *attrib, int *len)
 {
 	if (len == NULL)
@@ -629,7 +715,7 @@ uint8_t *g_attrib_get_buffer(GAttrib *attrib, int *len)
 
 gboolean g_attrib_set_mtu(GAttrib *attrib, int mtu)
 {
-	if (mtu < ATT_DEFAULT_LE_MTU)
+	if (mtu < ATT_DEFAULT_LE_MTU || mtu > ATT_MAX_MTU)
 		return FALSE;
 
 	attrib->buf = g_realloc(attrib->buf, mtu);
@@ -41,6 +41,14 @@ typedef void (*GAttribDebugFunc)(const char *str, gpointer user_data);
 typedef void (*GAttribNotifyFunc)(const guint8 *pdu, guint16 len,
 							gpointer user_data);
 
+/* Per opcode counters, latencies are in microseconds */
+typedef struct {
+	guint sent;
+	guint completed;
+	guint64 total_latency;
+	guint64 max_latency;
+} GAttribStats;
+
 GAttrib *g_attrib_new(GIOChannel *io);
 GAttrib *g_attrib_ref(GAttrib *attrib);
 void g_attrib_unref(GAttrib *attrib);
@@ -66,6 +74,10 @@ guint g_attrib_register(GAttrib *attrib, guint8 opcode,
 
 gboolean g_attrib_is_encrypted(GAttrib *attrib);
 
+gboolean g_attrib_get_stats(GAttrib *attrib, guint8 opcode,
+							GAttribStats *stats);
+guint g_attrib_get_queue_depth(GAttrib *attrib, guint *max_depth);
+
 uint8_t *g_attrib_get_buffer(GAttrib *attrib, int *len);
 gboolean g_attrib_set_mtu(GAttrib *attrib, int mtu);
 
@@ -62,6 +62,7 @@ static gboolean opt_char_desc = FALSE;
 static gboolean opt_char_write = FALSE;
 static gboolean opt_char_write_req = FALSE;
 static gboolean opt_interactive = FALSE;
+static gchar *opt_batch = NULL;
 static GMainLoop *event_loop;
 static gboolean got_error = FALSE;
 static GSourceFunc operation;
@@ -521,6 +522,9 @@ static GOptionEntry gatt_options[] = {
 		"Listen for notifications and indications", NULL },
 	{ "interactive", 'I', G_OPTION_FLAG_IN_MAIN, G_OPTION_ARG_NONE,
 		&opt_interactive, "Use interactive mode", NULL },
+	{ "batch", 0, G_OPTION_FLAG_IN_MAIN, G_OPTION_ARG_STRING, &opt_batch,
+		"Run the commands in FILE back to back and report timing, "
+		"'-' reads them from stdin", "FILE" },
 	{ NULL },
 };
 
@@ -586,6 +590,13 @@ int main(int argc, char *argv[])
 		goto done;
 	}
 
+	if (opt_batch) {
+		if (batch(opt_src, opt_dst, opt_dst_type, opt_sec_level,
+					opt_psm, opt_mtu, opt_batch) < 0)
+			got_error = TRUE;
+		goto done;
+	}
+
 	if (opt_primary)
 		operation = primary;
 	else if (opt_characteristics)
@@ -625,6 +636,7 @@ done:
 	g_free(opt_dst);
 	g_free(opt_uuid);
 	g_free(opt_sec_level);
+	g_free(opt_batch);
 
 	if (got_error)
 		exit(EXIT_FAILURE);
@@ -23,6 +23,9 @@
 
 int interactive(const gchar *src, const gchar *dst, const gchar *dst_type,
 		gboolean le);
+int batch(const gchar *src, const gchar *dst, const gchar *dst_type,
+				const gchar *sec_level, int psm, int mtu,
+				const gchar *script);
 GIOChannel *gatt_connect(const gchar *src, const gchar *dst,
 			const gchar *dst_type, const gchar *sec_level,
 			int psm, int mtu, BtIOConnect connect_cb);
@@ -35,6 +35,7 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <netinet/in.h>
 
@@ -123,7 +124,6 @@ struct avctp_server {
 };
 
 struct avctp_rsp_handler {
-	uint8_t id;
 	avctp_rsp_cb func;
 	void *user_data;
 };
@@ -142,7 +142,9 @@ struct avctp {
 	uint16_t mtu;
 
 	uint8_t key_quirks[256];
-	GSList *handlers;
+
+	/* Pending responses indexed by transaction label */
+	struct avctp_rsp_handler handlers[16];
 };
 
 struct avctp_pdu_handler {
@@ -169,7 +171,8 @@ static struct {
 
 static GSList *callbacks = NULL;
 static GSList *servers = NULL;
-static GSList *handlers = NULL;
+/* PDU handlers indexed by opcode */
+static struct avctp_pdu_handler handlers[256];
 static uint8_t id = 0;
 
 static void auth_cb(DBusError *derr, void *user_data);
@@ -307,16 +310,14 @@ static size_t handle_subunit_info(struct avctp *session,
 	return operand_count;
 }
 
-static struct avctp_pdu_handler *find_handler(GSList *list, uint8_t opcode)
+static struct avctp_pdu_handler *find_handler(uint8_t opcode)
 {
-	for (; list; list = list->next) {
-		struct avctp_pdu_handler *handler = list->data;
+	struct avctp_pdu_handler *handler = &handlers[opcode];
 
-		if (handler->opcode == opcode)
-			return handler;
-	}
+	if (handler->cb == NULL)
+		return NULL;
 
-	return NULL;
+	return handler;
 }
 
 static void avctp_disconnected(struct avctp *session)
@@ -359,7 +360,6 @@ static void avctp_disconnected(struct avctp *session)
 
 	server = session->server;
 	server->sessions = g_slist_remove(server->sessions, session);
-	g_slist_free_full(session->handlers, g_free);
 	g_free(session);
 }
 
@@ -411,25 +411,18 @@ static void handle_response(struct avctp *session, struct avctp_header *avctp,
 				struct avc_header *avc, uint8_t *operands,
 				size_t operand_count)
 {
-	GSList *l;
-
-	for (l = session->handlers; l; l = l->next) {
-		struct avctp_rsp_handler *handler = l->data;
-
-		if (handler->id != avctp->transaction)
-			continue;
-
-		if (handler->func && handler->func(session, avc->code,
-						avc->subunit_type,
-						operands, operand_count,
-						handler->user_data))
-			return;
+	struct avctp_rsp_handler *handler;
 
-		session->handlers = g_slist_remove(session->handlers, handler);
-		g_free(handler);
+	handler = &session->handlers[avctp->transaction];
+	if (handler->func == NULL)
+		return;
 
+	if (handler->func(session, avc->code, avc->subunit_type,
+					operands, operand_count,
+					handler->user_data))
 		return;
-	}
+
+	memset(handler, 0, sizeof(*handler));
 }
 
 static gboolean session_cb(GIOChannel *chan, GIOCondition cond,
@@ -503,7 +496,7 @@ static gboolean session_cb(GIOChannel *chan, GIOCondition cond,
 		goto done;
 	}
 
-	handler = find_handler(handlers, avc->opcode);
+	handler = find_handler(avc->opcode);
 	if (!handler) {
 		DBG("handler not found for 0x%02x", avc->opcode);
 		packet_size += avrcp_handle_vendor_reject(&code, operands);
@@ -898,7 +891,8 @@ int avctp_send_passthrough(struct avctp *session, uint8_t op)
 
 	memset(buf, 0, sizeof(buf));
 
-	avctp->transaction = id++;
+	avctp->transaction = id;
+	id = (id + 1) % 16;
 	avctp->packet_type = AVCTP_PACKET_SINGLE;
 	avctp->cr = AVCTP_COMMAND;
 	avctp->pid = htons(AV_REMOTE_SVCLASS_ID);
@@ -916,7 +910,8 @@ int avctp_send_passthrough(struct avctp *session, uint8_t op)
 		return -errno;
 
 	/* Button release */
-	avctp->transaction = id++;
+	avctp->transaction = id;
+	id = (id + 1) % 16;
 	operands[0] |= 0x80;
 
 	if (write(sk, buf, sizeof(buf)) < 0)
@@ -929,23 +924,18 @@ static int avctp_send(struct avctp *session, uint8_t transaction, uint8_t cr,
 				uint8_t code, uint8_t subunit, uint8_t opcode,
 				uint8_t *operands, size_t operand_count)
 {
-	uint8_t *buf;
-	struct avctp_header *avctp;
-	struct avc_header *avc;
-	uint8_t *pdu;
-	int sk, err = 0;
-	uint16_t size;
+	uint8_t buf[AVCTP_HEADER_LENGTH + AVC_HEADER_LENGTH];
+	struct avctp_header *avctp = (void *) buf;
+	struct avc_header *avc = (void *) &buf[AVCTP_HEADER_LENGTH];
+	struct iovec iov[2];
+	int sk;
 
 	if (session->state != AVCTP_STATE_CONNECTED)
 		return -ENOTCONN;
 
 	sk = g_io_channel_unix_get_fd(session->io);
-	size = AVCTP_HEADER_LENGTH + AVC_HEADER_LENGTH + operand_count;
-	buf = g_malloc0(size);
 
-	avctp = (void *) buf;
-	avc = (void *) &buf[AVCTP_HEADER_LENGTH];
-	pdu = (void *) &buf[AVCTP_HEADER_LENGTH + AVC_HEADER_LENGTH];
+	memset(buf, 0, sizeof(buf));
 
 	avctp->transaction = transaction;
 	avctp->packet_type = AVCTP_PACKET_SINGLE;
@@ -956,13 +946,16 @@ static int avctp_send(struct avctp *session, uint8_t transaction, uint8_t cr,
 	avc->subunit_type = subunit;
 	avc->opcode = opcode;
 
-	memcpy(pdu, operands, operand_count);
+	/* Operands are sent straight from the caller's buffer */
+	iov[0].iov_base = buf;
+	iov[0].iov_len = sizeof(buf);
+	iov[1].iov_base = operands;
+	iov[1].iov_len = operand_count;
 
-	if (write(sk, buf, size) < 0)
-		err = -errno;
+	if (writev(sk, iov, 2) < 0)
+		return -errno;
 
-	g_free(buf);
-	return err;
+	return 0;
 }
 
 int avctp_send_vendordep(struct avctp *session, uint8_t transaction,
@@ -986,14 +979,11 @@ int avctp_send_vendordep_req(struct avctp *session, uint8_t code,
 	if (err < 0)
 		return err;
 
-	handler = g_new0(struct avctp_rsp_handler, 1);
-	handler->id = id;
+	handler = &session->handlers[id];
 	handler->func = func;
 	handler->user_data = user_data;
 
-	session->handlers = g_slist_prepend(session->handlers, handler);
-
-	id++;
+	id = (id + 1) % 16;
 
 	return 0;
 }
@@ -1035,31 +1025,28 @@ unsigned int avctp_register_pdu_handler(uint8_t opcode, avctp_pdu_cb cb,
 	struct avctp_pdu_handler *handler;
 	static unsigned int id = 0;
 
-	handler = find_handler(handlers, opcode);
+	handler = find_handler(opcode);
 	if (handler)
 		return 0;
 
-	handler = g_new(struct avctp_pdu_handler, 1);
+	handler = &handlers[opcode];
 	handler->opcode = opcode;
 	handler->cb = cb;
 	handler->user_data = user_data;
 	handler->id = ++id;
 
-	handlers = g_slist_append(handlers, handler);
-
 	return handler->id;
 }
 
 gboolean avctp_unregister_pdu_handler(unsigned int id)
 {
-	GSList *l;
+	unsigned int i;
 
-	for (l = handlers; l != NULL; l = l->next) {
-		struct avctp_pdu_handler *handler = l->data;
+	for (i = 0; i < G_N_ELEMENTS(handlers); i++) {
+		struct avctp_pdu_handler *handler = &handlers[i];
 
-		if (handler->id == id) {
-			handlers = g_slist_remove(handlers, handler);
-			g_free(handler);
+		if (handler->cb != NULL && handler->id == id) {
+			memset(handler, 0, sizeof(*handler));
 			return TRUE;
 		}
 	}
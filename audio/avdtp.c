@@ -44,10 +44,12 @@
 #include <dbus/dbus.h>
 
 #include "log.h"
+#include "textfile.h"
 
 #include "../src/adapter.h"
 #include "../src/manager.h"
 #include "../src/device.h"
+#include "../src/storage.h"
 
 #include "device.h"
 #include "manager.h"
@@ -95,6 +97,9 @@
 #define STREAM_TIMEOUT 20
 #define START_TIMEOUT 1
 
+/* Transaction labels are 4 bits wide, keep one free for session->req */
+#define MAX_PIPELINED_GETCAP 15
+
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 
 struct avdtp_common_header {
@@ -423,6 +428,13 @@ struct avdtp {
 
 	struct pending_req *req;
 
+	/* Pipelined capability requests issued during discovery */
+	uint8_t getcap_cmd;
+	GSList *getcap_queue; /* Remote SEIDs still to be queried */
+	GSList *getcap_reqs; /* Elements of type struct pending_req * */
+	int remote_sep_count; /* Number of SEPs in the last DISCOVER response */
+	gboolean caps_cached; /* Remote capabilities came from the SEP cache */
+
 	guint dc_timer;
 
 	/* Attempt stream setup instead of disconnecting */
@@ -449,6 +461,10 @@ static gboolean avdtp_parse_rej(struct avdtp *session,
 					uint8_t transaction, uint8_t signal_id,
 					void *buf, int size);
 static int process_queue(struct avdtp *session);
+static gboolean avdtp_parse_getcap_resp(struct avdtp *session,
+					struct pending_req *req,
+					uint8_t message_type,
+					void *buf, int size);
 static void connection_lost(struct avdtp *session, int err);
 static void avdtp_sep_set_state(struct avdtp *session,
 				struct avdtp_local_sep *sep,
@@ -956,6 +972,16 @@ static void cleanup_queue(struct avdtp *session, struct avdtp_stream *stream)
 	}
 }
 
+static void cleanup_getcap(struct avdtp *session)
+{
+	g_slist_free_full(session->getcap_reqs,
+					(GDestroyNotify) pending_req_free);
+	session->getcap_reqs = NULL;
+
+	g_slist_free(session->getcap_queue);
+	session->getcap_queue = NULL;
+}
+
 static void handle_unanswered_req(struct avdtp *session,
 						struct avdtp_stream *stream)
 {
@@ -1153,6 +1179,7 @@ static void connection_lost(struct avdtp *session, int err)
 
 	session->free_lock = 1;
 
+	cleanup_getcap(session);
 	finalize_discovery(session, err);
 
 	g_slist_foreach(session->streams, (GFunc) release_stream, session);
@@ -1226,6 +1253,8 @@ void avdtp_unref(struct avdtp *session)
 	if (session->req)
 		pending_req_free(session->req);
 
+	cleanup_getcap(session);
+
 	g_slist_free_full(session->seps, g_free);
 
 	g_free(session->buf);
@@ -1335,6 +1364,144 @@ static GSList *caps_to_list(uint8_t *data, int size,
 	return caps;
 }
 
+static void remote_sep_free(gpointer data)
+{
+	struct avdtp_remote_sep *sep = data;
+
+	g_slist_free_full(sep->caps, g_free);
+	g_free(sep);
+}
+
+/* Cache format: "<sep count> <seid>:<type>:<media type>:<caps> ..." with the
+ * capabilities hex encoded exactly as received in GET_CAPABILITIES */
+static void store_sep_cache(struct avdtp *session)
+{
+	GString *str;
+	GSList *l;
+
+	str = g_string_new(NULL);
+	g_string_append_printf(str, "%d", session->remote_sep_count);
+
+	for (l = session->seps; l != NULL; l = g_slist_next(l)) {
+		struct avdtp_remote_sep *sep = l->data;
+		GSList *c;
+
+		/* Don't cache incomplete capability sets */
+		if (sep->caps == NULL) {
+			g_string_free(str, TRUE);
+			return;
+		}
+
+		g_string_append_printf(str, " %02X:%02X:%02X:", sep->seid,
+						sep->type, sep->media_type);
+
+		for (c = sep->caps; c != NULL; c = g_slist_next(c)) {
+			struct avdtp_service_capability *cap = c->data;
+			uint8_t *data = (uint8_t *) cap;
+			int i;
+
+			for (i = 0; i < cap->length + 2; i++)
+				g_string_append_printf(str, "%02X", data[i]);
+		}
+	}
+
+	write_remote_seps(&session->server->src, &session->dst, str->str);
+
+	g_string_free(str, TRUE);
+}
+
+static void delete_sep_cache(struct avdtp *session)
+{
+	session->caps_cached = FALSE;
+
+	delete_remote_seps(&session->server->src, &session->dst);
+}
+
+static struct avdtp_remote_sep *remote_sep_from_string(const char *str)
+{
+	struct avdtp_remote_sep *sep;
+	unsigned int seid, type, media_type;
+	uint8_t *data;
+	size_t len, i;
+	char tmp[3];
+	int pos;
+
+	if (sscanf(str, "%02X:%02X:%02X:%n", &seid, &type, &media_type,
+								&pos) != 3)
+		return NULL;
+
+	str += pos;
+
+	len = strlen(str);
+	if (len == 0 || len % 2)
+		return NULL;
+
+	len /= 2;
+	data = g_malloc(len);
+
+	tmp[2] = '\0';
+	for (i = 0; i < len; i++) {
+		memcpy(tmp, str + (i * 2), 2);
+		data[i] = (uint8_t) strtol(tmp, NULL, 16);
+	}
+
+	sep = g_new0(struct avdtp_remote_sep, 1);
+	sep->seid = seid;
+	sep->type = type;
+	sep->media_type = media_type;
+	sep->caps = caps_to_list(data, len, &sep->codec,
+						&sep->delay_reporting);
+
+	g_free(data);
+
+	if (sep->codec == NULL) {
+		remote_sep_free(sep);
+		return NULL;
+	}
+
+	return sep;
+}
+
+/* Returns the cached SEPs of the remote device if they were stored for the
+ * same number of SEPs, stale entries are removed */
+static GSList *load_sep_cache(struct avdtp *session, int sep_count)
+{
+	char *str, **seps;
+	GSList *list = NULL;
+	int i;
+
+	str = read_remote_seps(&session->server->src, &session->dst);
+	if (str == NULL)
+		return NULL;
+
+	seps = g_strsplit(str, " ", 0);
+	free(str);
+
+	if (seps[0] == NULL || atoi(seps[0]) != sep_count)
+		goto invalid;
+
+	for (i = 1; seps[i] != NULL; i++) {
+		struct avdtp_remote_sep *sep;
+
+		sep = remote_sep_from_string(seps[i]);
+		if (sep == NULL)
+			goto invalid;
+
+		list = g_slist_append(list, sep);
+	}
+
+	g_strfreev(seps);
+
+	return list;
+
+invalid:
+	DBG("Discarding stale SEP cache");
+	g_slist_free_full(list, remote_sep_free);
+	g_strfreev(seps);
+	delete_sep_cache(session);
+	return NULL;
+}
+
 static gboolean avdtp_unknown_cmd(struct avdtp *session, uint8_t transaction,
 							uint8_t signal_id)
 {
@@ -2168,11 +2335,29 @@ static enum avdtp_parse_result avdtp_parse_data(struct avdtp *session,
 	return PARSE_SUCCESS;
 }
 
+static struct pending_req *find_getcap_req(struct avdtp *session,
+						uint8_t transaction,
+						uint8_t signal_id)
+{
+	GSList *l;
+
+	for (l = session->getcap_reqs; l != NULL; l = g_slist_next(l)) {
+		struct pending_req *req = l->data;
+
+		if (req->transaction == transaction &&
+						req->signal_id == signal_id)
+			return req;
+	}
+
+	return NULL;
+}
+
 static gboolean session_cb(GIOChannel *chan, GIOCondition cond,
 				gpointer data)
 {
 	struct avdtp *session = data;
 	struct avdtp_common_header *header;
+	struct pending_req *getcap;
 	ssize_t size;
 	int fd;
 
@@ -2230,6 +2415,20 @@ static gboolean session_cb(GIOChannel *chan, GIOCondition cond,
 		return TRUE;
 	}
 
+	getcap = find_getcap_req(session, header->transaction,
+						session->in.signal_id);
+	if (getcap) {
+		if (!avdtp_parse_getcap_resp(session, getcap,
+						header->message_type,
+						session->in.buf,
+						session->in.data_size)) {
+			error("Unable to parse capabilities response");
+			goto failed;
+		}
+
+		return TRUE;
+	}
+
 	if (session->req == NULL) {
 		error("No pending request, ignoring message");
 		return TRUE;
@@ -2723,10 +2922,109 @@ static gboolean request_timeout(gpointer user_data)
 	return FALSE;
 }
 
+static gboolean transaction_in_use(struct avdtp *session, uint8_t label)
+{
+	GSList *l;
+
+	if (session->req && session->req->transaction == label)
+		return TRUE;
+
+	for (l = session->getcap_reqs; l != NULL; l = g_slist_next(l)) {
+		struct pending_req *req = l->data;
+
+		if (req->transaction == label)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static uint8_t alloc_transaction(struct avdtp *session)
+{
+	static int transaction = 0;
+	uint8_t label;
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		label = transaction++;
+		transaction %= 16;
+
+		if (!transaction_in_use(session, label))
+			break;
+	}
+
+	return label;
+}
+
+static gboolean getcap_timeout(gpointer user_data)
+{
+	struct avdtp *session = user_data;
+
+	error("GetCapabilities: %s (%d)", strerror(ETIMEDOUT), ETIMEDOUT);
+
+	connection_lost(session, ETIMEDOUT);
+
+	return FALSE;
+}
+
+/* Keep as many GET_CAPABILITIES in flight as transaction labels allow */
+static int send_getcap_reqs(struct avdtp *session)
+{
+	while (session->getcap_queue && g_slist_length(session->getcap_reqs) <
+							MAX_PIPELINED_GETCAP) {
+		struct pending_req *req;
+		struct seid_req sreq;
+
+		memset(&sreq, 0, sizeof(sreq));
+		sreq.acp_seid = GPOINTER_TO_UINT(session->getcap_queue->data);
+
+		session->getcap_queue = g_slist_delete_link(
+							session->getcap_queue,
+							session->getcap_queue);
+
+		req = g_new0(struct pending_req, 1);
+		req->signal_id = session->getcap_cmd;
+		req->data = g_memdup(&sreq, sizeof(sreq));
+		req->data_size = sizeof(sreq);
+		req->transaction = alloc_transaction(session);
+
+		if (!avdtp_send(session, req->transaction,
+					AVDTP_MSG_TYPE_COMMAND, req->signal_id,
+					req->data, req->data_size)) {
+			pending_req_free(req);
+			return -EIO;
+		}
+
+		req->timeout = g_timeout_add_seconds(REQ_TIMEOUT,
+							getcap_timeout,
+							session);
+
+		session->getcap_reqs = g_slist_append(session->getcap_reqs,
+									req);
+	}
+
+	return 0;
+}
+
+static void getcap_complete(struct avdtp *session, int err)
+{
+	if (err < 0) {
+		g_slist_free(session->getcap_queue);
+		session->getcap_queue = NULL;
+	}
+
+	if (session->getcap_reqs || session->getcap_queue)
+		return;
+
+	if (err == 0)
+		store_sep_cache(session);
+
+	finalize_discovery(session, -err);
+}
+
 static int send_req(struct avdtp *session, gboolean priority,
 			struct pending_req *req)
 {
-	static int transaction = 0;
 	int err;
 
 	if (session->state == AVDTP_SESSION_STATE_DISCONNECTED) {
@@ -2744,8 +3042,7 @@ static int send_req(struct avdtp *session, gboolean priority,
 		return 0;
 	}
 
-	req->transaction = transaction++;
-	transaction %= 16;
+	req->transaction = alloc_transaction(session);
 
 	/* FIXME: Should we retry to send if the buffer
 	was not totally sent or in case of EINTR? */
@@ -2794,21 +3091,25 @@ static gboolean avdtp_discover_resp(struct avdtp *session,
 					struct discover_resp *resp, int size)
 {
 	int sep_count, i;
-	uint8_t getcap_cmd;
-	int ret = 0;
-	gboolean getcap_pending = FALSE;
+	GSList *cached;
+	gboolean cache_hit = TRUE;
 
 	if (session->version >= 0x0103 && session->server->version >= 0x0103)
-		getcap_cmd = AVDTP_GET_ALL_CAPABILITIES;
+		session->getcap_cmd = AVDTP_GET_ALL_CAPABILITIES;
 	else
-		getcap_cmd = AVDTP_GET_CAPABILITIES;
+		session->getcap_cmd = AVDTP_GET_CAPABILITIES;
 
 	sep_count = size / sizeof(struct seid_info);
 
+	session->remote_sep_count = sep_count;
+
+	cached = load_sep_cache(session, sep_count);
+	if (cached == NULL)
+		cache_hit = FALSE;
+
 	for (i = 0; i < sep_count; i++) {
-		struct avdtp_remote_sep *sep;
+		struct avdtp_remote_sep *sep, *cached_sep;
 		struct avdtp_stream *stream;
-		struct seid_req req;
 
 		DBG("seid %d type %d media %d in use %d",
 				resp->seps[i].seid, resp->seps[i].type,
@@ -2829,28 +3130,47 @@ static gboolean avdtp_discover_resp(struct avdtp *session,
 		sep->type = resp->seps[i].type;
 		sep->media_type = resp->seps[i].media_type;
 
-		memset(&req, 0, sizeof(req));
-		req.acp_seid = sep->seid;
+		cached_sep = find_remote_sep(cached, sep->seid);
+		if (cached_sep && cached_sep->type == sep->type &&
+				cached_sep->media_type == sep->media_type) {
+			g_slist_free_full(sep->caps, g_free);
+			sep->caps = cached_sep->caps;
+			sep->codec = cached_sep->codec;
+			sep->delay_reporting = cached_sep->delay_reporting;
+			cached_sep->caps = NULL;
+			continue;
+		}
 
-		ret = send_request(session, TRUE, NULL, getcap_cmd,
-							&req, sizeof(req));
-		if (ret < 0)
-			break;
-		getcap_pending = TRUE;
+		cache_hit = FALSE;
+
+		session->getcap_queue = g_slist_append(session->getcap_queue,
+						GUINT_TO_POINTER(sep->seid));
+	}
+
+	g_slist_free_full(cached, remote_sep_free);
+
+	session->caps_cached = cache_hit;
+
+	if (cache_hit) {
+		DBG("Using cached capabilities for %d SEPs", sep_count);
+		finalize_discovery(session, 0);
+		return TRUE;
 	}
 
-	if (!getcap_pending)
-		finalize_discovery(session, -ret);
+	if (cached)
+		delete_sep_cache(session);
+
+	getcap_complete(session, send_getcap_reqs(session));
 
 	return TRUE;
 }
 
 static gboolean avdtp_get_capabilities_resp(struct avdtp *session,
+						uint8_t seid,
 						struct getcap_resp *resp,
 						unsigned int size)
 {
 	struct avdtp_remote_sep *sep;
-	uint8_t seid;
 
 	/* Check for minimum required packet size includes:
 	 *   1. getcap resp header
@@ -2864,9 +3184,11 @@ static gboolean avdtp_get_capabilities_resp(struct avdtp *session,
 		return FALSE;
 	}
 
-	seid = ((struct seid_req *) session->req->data)->acp_seid;
-
 	sep = find_remote_sep(session->seps, seid);
+	if (sep == NULL) {
+		error("No remote SEP with seid %d", seid);
+		return TRUE;
+	}
 
 	DBG("seid %d type %d media %d", sep->seid,
 					sep->type, sep->media_type);
@@ -2884,6 +3206,43 @@ static gboolean avdtp_get_capabilities_resp(struct avdtp *session,
 	return TRUE;
 }
 
+static gboolean avdtp_parse_getcap_resp(struct avdtp *session,
+					struct pending_req *req,
+					uint8_t message_type,
+					void *buf, int size)
+{
+	uint8_t transaction = req->transaction;
+	uint8_t signal_id = req->signal_id;
+	uint8_t seid = req_get_seid(req);
+
+	session->getcap_reqs = g_slist_remove(session->getcap_reqs, req);
+	pending_req_free(req);
+
+	switch (message_type) {
+	case AVDTP_MSG_TYPE_ACCEPT:
+		DBG("GET_%sCAPABILITIES request succeeded",
+			signal_id == AVDTP_GET_ALL_CAPABILITIES ? "ALL_" : "");
+		if (!avdtp_get_capabilities_resp(session, seid, buf, size))
+			return FALSE;
+		break;
+	case AVDTP_MSG_TYPE_REJECT:
+		if (!avdtp_parse_rej(session, NULL, transaction, signal_id,
+								buf, size))
+			return FALSE;
+		break;
+	case AVDTP_MSG_TYPE_GEN_REJECT:
+		error("Received a General Reject message");
+		break;
+	default:
+		error("Unknown message type 0x%02X", message_type);
+		break;
+	}
+
+	getcap_complete(session, send_getcap_reqs(session));
+
+	return TRUE;
+}
+
 static gboolean avdtp_set_configuration_resp(struct avdtp *session,
 						struct avdtp_stream *stream,
 						struct avdtp_single_header *resp,
@@ -3000,30 +3359,10 @@ static gboolean avdtp_parse_resp(struct avdtp *session,
 					uint8_t transaction, uint8_t signal_id,
 					void *buf, int size)
 {
-	struct pending_req *next;
-	const char *get_all = "";
-
-	if (session->prio_queue)
-		next = session->prio_queue->data;
-	else if (session->req_queue)
-		next = session->req_queue->data;
-	else
-		next = NULL;
-
 	switch (signal_id) {
 	case AVDTP_DISCOVER:
 		DBG("DISCOVER request succeeded");
 		return avdtp_discover_resp(session, buf, size);
-	case AVDTP_GET_ALL_CAPABILITIES:
-		get_all = "ALL_";
-	case AVDTP_GET_CAPABILITIES:
-		DBG("GET_%sCAPABILITIES request succeeded", get_all);
-		if (!avdtp_get_capabilities_resp(session, buf, size))
-			return FALSE;
-		if (!(next && (next->signal_id == AVDTP_GET_CAPABILITIES ||
-				next->signal_id == AVDTP_GET_ALL_CAPABILITIES)))
-			finalize_discovery(session, 0);
-		return TRUE;
 	}
 
 	/* The remaining commands require an existing stream so bail out
@@ -3145,6 +3484,10 @@ static gboolean avdtp_parse_rej(struct avdtp *session,
 			return FALSE;
 		error("SET_CONFIGURATION request rejected: %s (%d)",
 				avdtp_strerror(&err), err.err.error_code);
+		/* The cached capabilities may no longer match the remote
+		 * SEPs, fetch them again on the next discovery */
+		if (session->caps_cached)
+			delete_sep_cache(session);
 		if (sep && sep->cfm && sep->cfm->set_configuration)
 			sep->cfm->set_configuration(session, sep, stream,
 							&err, sep->user_data);
@@ -143,17 +143,25 @@ struct avrcp_header {
 #define AVRCP_MTU	(AVC_MTU - AVC_HEADER_LENGTH)
 #define AVRCP_PDU_MTU	(AVRCP_MTU - AVRCP_HEADER_LENGTH)
 
+/* Defaults for the [AVRCP] section of audio.conf, in milliseconds */
+#define NOTIFY_WINDOW		100
+#define POSITION_INTERVAL	1000
+
 struct avrcp_server {
 	bdaddr_t src;
 	uint32_t tg_record_id;
 	uint32_t ct_record_id;
 	GSList *players;
 	struct avrcp_player *addressed_player;
+	guint notify_window;
+	guint position_interval;
 };
 
 struct pending_pdu {
-	uint8_t pdu_id;
-	GList *attr_ids;
+	uint8_t pdu_id;		/* 0 if there is no pending PDU */
+	uint32_t attr_ids[AVRCP_MEDIA_ATTRIBUTE_LAST];
+	uint8_t attr_count;
+	uint8_t attr_index;	/* Next attribute to be written */
 	uint16_t offset;
 };
 
@@ -165,7 +173,14 @@ struct avrcp_player {
 	unsigned int handler;
 	uint16_t registered_events;
 	uint8_t transaction_events[AVRCP_EVENT_LAST + 1];
-	struct pending_pdu *pending_pdu;
+	struct pending_pdu pending_pdu;
+
+	/* Events changed within the current coalescing window */
+	uint16_t changed_events;
+	guint notify_id;
+
+	guint position_interval;
+	guint position_id;
 
 	struct avrcp_player_cb *cb;
 	void *user_data;
@@ -175,6 +190,12 @@ struct avrcp_player {
 static GSList *servers = NULL;
 static unsigned int avctp_id = 0;
 
+/* Common part of every notification response, params follow */
+static const uint8_t notification_template[AVRCP_HEADER_LENGTH] = {
+	(IEEEID_BTSIG >> 16) & 0xff, (IEEEID_BTSIG >> 8) & 0xff,
+	IEEEID_BTSIG & 0xff, AVRCP_REGISTER_NOTIFICATION,
+};
+
 /* Company IDs supported by this device */
 static uint32_t company_ids[] = {
 	IEEEID_BTSIG,
@@ -375,62 +396,186 @@ static void set_company_id(uint8_t cid[3], const uint32_t cid_in)
 	cid[2] = cid_in;
 }
 
-int avrcp_player_event(struct avrcp_player *player, uint8_t id, void *data)
+/* Fill in the current value of an event, returns the params length */
+static uint16_t player_event_params(struct avrcp_player *player, uint8_t id,
+							uint8_t *params)
+{
+	uint64_t uid;
+	uint32_t position;
+
+	params[0] = id;
+
+	switch (id) {
+	case AVRCP_EVENT_STATUS_CHANGED:
+		params[1] = player->cb->get_status(player->user_data);
+		return 2;
+	case AVRCP_EVENT_TRACK_CHANGED:
+		uid = player->cb->get_uid(player->user_data);
+		memcpy(&params[1], &uid, sizeof(uint64_t));
+		return 9;
+	case AVRCP_EVENT_TRACK_REACHED_END:
+	case AVRCP_EVENT_TRACK_REACHED_START:
+		return 1;
+	case AVRCP_EVENT_PLAYBACK_POS_CHANGED:
+		position = player->cb->get_position(player->user_data);
+		position = htonl(position);
+		memcpy(&params[1], &position, sizeof(uint32_t));
+		return 5;
+	default:
+		return 0;
+	}
+}
+
+static void player_stop_position(struct avrcp_player *player)
+{
+	if (player->position_id == 0)
+		return;
+
+	g_source_remove(player->position_id);
+	player->position_id = 0;
+}
+
+static void player_stop_events(struct avrcp_player *player)
+{
+	player_stop_position(player);
+
+	if (player->notify_id > 0) {
+		g_source_remove(player->notify_id);
+		player->notify_id = 0;
+	}
+
+	player->changed_events = 0;
+	player->registered_events = 0;
+}
+
+static int player_send_event(struct avrcp_player *player, uint8_t id)
 {
 	uint8_t buf[AVRCP_HEADER_LENGTH + 9];
 	struct avrcp_header *pdu = (void *) buf;
 	uint16_t size;
 	int err;
 
+	memcpy(buf, notification_template, sizeof(notification_template));
+
+	size = player_event_params(player, id, pdu->params);
+	pdu->params_len = htons(size);
+
+	DBG("id=%u", id);
+
+	err = avctp_send_vendordep(player->session, player->transaction_events[id],
+					AVC_CTYPE_CHANGED, AVC_SUBUNIT_PANEL,
+					buf, size + AVRCP_HEADER_LENGTH);
+	if (err < 0)
+		return err;
+
+	/* Unregister event as per AVRCP 1.3 spec, section 5.4.2 */
+	player->registered_events &= ~(1 << id);
+
+	if (id == AVRCP_EVENT_PLAYBACK_POS_CHANGED)
+		player_stop_position(player);
+
+	return 0;
+}
+
+static gboolean player_flush_events(gpointer user_data)
+{
+	struct avrcp_player *player = user_data;
+	uint16_t events;
+	uint8_t id;
+
+	player->notify_id = 0;
+
+	events = player->changed_events & player->registered_events;
+	player->changed_events = 0;
+
 	if (player->session == NULL)
-		return -ENOTCONN;
+		return FALSE;
 
-	if (!(player->registered_events & (1 << id)))
-		return 0;
+	/* Send only the latest state of each event, lowest event ID first */
+	for (id = 1; id <= AVRCP_EVENT_LAST && events; id++) {
+		if (!(events & (1 << id)))
+			continue;
 
-	memset(buf, 0, sizeof(buf));
+		events &= ~(1 << id);
 
-	set_company_id(pdu->company_id, IEEEID_BTSIG);
+		if (player_send_event(player, id) < 0)
+			break;
+	}
 
-	pdu->pdu_id = AVRCP_REGISTER_NOTIFICATION;
-	pdu->params[0] = id;
+	return FALSE;
+}
 
-	DBG("id=%u", id);
+int avrcp_player_event(struct avrcp_player *player, uint8_t id)
+{
+	uint16_t events = 1 << id;
+
+	if (player->session == NULL)
+		return -ENOTCONN;
 
 	switch (id) {
 	case AVRCP_EVENT_STATUS_CHANGED:
-		size = 2;
-		pdu->params[1] = *((uint8_t *)data);
-
-		break;
 	case AVRCP_EVENT_TRACK_CHANGED:
-		size = 9;
-		memcpy(&pdu->params[1], data, sizeof(uint64_t));
-
+		/* Position has to be reported on status and track changes */
+		events |= 1 << AVRCP_EVENT_PLAYBACK_POS_CHANGED;
 		break;
 	case AVRCP_EVENT_TRACK_REACHED_END:
 	case AVRCP_EVENT_TRACK_REACHED_START:
-		size = 1;
+	case AVRCP_EVENT_PLAYBACK_POS_CHANGED:
 		break;
 	default:
 		error("Unknown event %u", id);
 		return -EINVAL;
 	}
 
-	pdu->params_len = htons(size);
+	events &= player->registered_events;
+	if (events == 0)
+		return 0;
 
-	err = avctp_send_vendordep(player->session, player->transaction_events[id],
-					AVC_CTYPE_CHANGED, AVC_SUBUNIT_PANEL,
-					buf, size + AVRCP_HEADER_LENGTH);
-	if (err < 0)
-		return err;
+	/*
+	 * Changes are reported when the window expires so a burst of updates
+	 * results in a single notification per event carrying the final
+	 * state.
+	 */
+	player->changed_events |= events;
 
-	/* Unregister event as per AVRCP 1.3 spec, section 5.4.2 */
-	player->registered_events ^= 1 << id;
+	if (player->notify_id == 0)
+		player->notify_id = g_timeout_add(
+					player->server->notify_window,
+					player_flush_events, player);
 
 	return 0;
 }
 
+static gboolean player_position_timeout(gpointer user_data)
+{
+	struct avrcp_player *player = user_data;
+	uint8_t status;
+
+	status = player->cb->get_status(player->user_data);
+	if (status != AVRCP_PLAY_STATUS_PLAYING)
+		return TRUE;
+
+	avrcp_player_event(player, AVRCP_EVENT_PLAYBACK_POS_CHANGED);
+
+	return TRUE;
+}
+
+static void player_start_position(struct avrcp_player *player,
+							uint32_t interval)
+{
+	guint64 msec;
+
+	player_stop_position(player);
+
+	/* Interval is given in seconds by the remote, never go below the
+	 * configured one */
+	msec = MIN((guint64) interval * 1000, G_MAXUINT);
+	player->position_interval = MAX(msec,
+					player->server->position_interval);
+	player->position_id = g_timeout_add(player->position_interval,
+					player_position_timeout, player);
+}
+
 static uint16_t player_write_media_attribute(struct avrcp_player *player,
 						uint32_t id, uint8_t *buf,
 						uint16_t *pos,
@@ -443,12 +588,14 @@ static uint16_t player_write_media_attribute(struct avrcp_player *player,
 
 	DBG("%u", id);
 
-	value = player->cb->get_metadata(id, player->user_data);
-	if (value == NULL) {
+	/* Numbers are passed as pointers, so 0 is a valid value */
+	if (!player->cb->has_metadata(id, player->user_data)) {
 		*offset = 0;
 		return 0;
 	}
 
+	value = player->cb->get_metadata(id, player->user_data);
+
 	switch (id) {
 	case AVRCP_MEDIA_ATTRIBUTE_TRACK:
 	case AVRCP_MEDIA_ATTRIBUTE_N_TRACKS:
@@ -458,6 +605,11 @@ static uint16_t player_write_media_attribute(struct avrcp_player *player,
 		break;
 	}
 
+	if (value == NULL) {
+		*offset = 0;
+		return 0;
+	}
+
 	attr_len = strlen(value);
 	value = ((char *) value) + *offset;
 	len = attr_len - *offset;
@@ -475,22 +627,23 @@ static uint16_t player_write_media_attribute(struct avrcp_player *player,
 	return attr_len;
 }
 
-static GList *player_fill_media_attribute(struct avrcp_player *player,
-					GList *attr_ids, uint8_t *buf,
-					uint16_t *pos, uint16_t *offset)
+/* Returns TRUE if attributes remain to be sent in a continuing response */
+static gboolean player_fill_media_attribute(struct avrcp_player *player,
+						struct pending_pdu *pending,
+						uint8_t *buf, uint16_t *pos)
 {
 	struct media_attribute_header {
 		uint32_t id;
 		uint16_t charset;
 		uint16_t len;
 	} *hdr = NULL;
-	GList *l;
 
-	for (l = attr_ids; l != NULL; l = g_list_delete_link(l, l)) {
-		uint32_t attr = GPOINTER_TO_UINT(l->data);
+	for (; pending->attr_index < pending->attr_count;
+						pending->attr_index++) {
+		uint32_t attr = pending->attr_ids[pending->attr_index];
 		uint16_t attr_len;
 
-		if (*offset == 0) {
+		if (pending->offset == 0) {
 			if (*pos + sizeof(*hdr) >= AVRCP_PDU_MTU)
 				break;
 
@@ -501,38 +654,24 @@ static GList *player_fill_media_attribute(struct avrcp_player *player,
 		}
 
 		attr_len = player_write_media_attribute(player, attr, buf,
-								pos, offset);
+							pos, &pending->offset);
 
 		if (hdr != NULL)
 			hdr->len = htons(attr_len);
 
-		if (*offset > 0)
+		if (pending->offset > 0)
 			break;
 	}
 
-	return l;
-}
-
-static struct pending_pdu *pending_pdu_new(uint8_t pdu_id, GList *attr_ids,
-							unsigned int offset)
-{
-	struct pending_pdu *pending = g_new(struct pending_pdu, 1);
-
-	pending->pdu_id = pdu_id;
-	pending->attr_ids = attr_ids;
-	pending->offset = offset;
-
-	return pending;
+	return pending->attr_index < pending->attr_count;
 }
 
 static gboolean player_abort_pending_pdu(struct avrcp_player *player)
 {
-	if (player->pending_pdu == NULL)
+	if (player->pending_pdu.pdu_id == 0)
 		return FALSE;
 
-	g_list_free(player->pending_pdu->attr_ids);
-	g_free(player->pending_pdu);
-	player->pending_pdu = NULL;
+	memset(&player->pending_pdu, 0, sizeof(player->pending_pdu));
 
 	return TRUE;
 }
@@ -582,11 +721,12 @@ static uint8_t avrcp_handle_get_capabilities(struct avrcp_player *player,
 
 		return AVC_CTYPE_STABLE;
 	case CAP_EVENTS_SUPPORTED:
-		pdu->params[1] = 4;
+		pdu->params[1] = 5;
 		pdu->params[2] = AVRCP_EVENT_STATUS_CHANGED;
 		pdu->params[3] = AVRCP_EVENT_TRACK_CHANGED;
 		pdu->params[4] = AVRCP_EVENT_TRACK_REACHED_START;
 		pdu->params[5] = AVRCP_EVENT_TRACK_REACHED_END;
+		pdu->params[6] = AVRCP_EVENT_PLAYBACK_POS_CHANGED;
 
 		pdu->params_len = htons(2 + pdu->params[1]);
 		return AVC_CTYPE_STABLE;
@@ -665,10 +805,10 @@ static uint8_t avrcp_handle_get_element_attributes(struct avrcp_player *player,
 {
 	uint16_t len = ntohs(pdu->params_len);
 	uint64_t *identifier = (uint64_t *) &pdu->params[0];
+	struct pending_pdu *pending = &player->pending_pdu;
 	uint16_t pos;
 	uint8_t nattr;
-	GList *attr_ids;
-	uint16_t offset;
+	uint32_t id;
 
 	if (len < 9 || *identifier != 0)
 		goto err;
@@ -678,49 +818,49 @@ static uint8_t avrcp_handle_get_element_attributes(struct avrcp_player *player,
 	if (len < nattr * sizeof(uint32_t) + 1)
 		goto err;
 
+	player_abort_pending_pdu(player);
+
 	if (!nattr) {
 		/*
 		 * Return all available information, at least
 		 * title must be returned if there's a track selected.
 		 */
-		attr_ids = player->cb->list_metadata(player->user_data);
-		len = g_list_length(attr_ids);
+		for (id = AVRCP_MEDIA_ATTRIBUTE_TITLE;
+				id <= AVRCP_MEDIA_ATTRIBUTE_LAST; id++) {
+			if (player->cb->has_metadata(id, player->user_data))
+				pending->attr_ids[pending->attr_count++] = id;
+		}
 	} else {
 		unsigned int i;
 		uint32_t *attr = (uint32_t *) &pdu->params[9];
+		uint8_t requested = 0;
 
-		for (i = 0, len = 0, attr_ids = NULL; i < nattr; i++, attr++) {
-			uint32_t id = ntohl(bt_get_unaligned(attr));
+		for (i = 0; i < nattr; i++, attr++) {
+			id = ntohl(bt_get_unaligned(attr));
 
-			/* Don't add invalid attributes */
+			/* Don't add invalid or repeated attributes */
 			if (id == AVRCP_MEDIA_ATTRIBUTE_ILLEGAL ||
-					id > AVRCP_MEDIA_ATTRIBUTE_LAST)
+					id > AVRCP_MEDIA_ATTRIBUTE_LAST ||
+					requested & (1 << id))
 				continue;
 
-			len++;
-			attr_ids = g_list_prepend(attr_ids,
-							GUINT_TO_POINTER(id));
+			requested |= 1 << id;
+			pending->attr_ids[pending->attr_count++] = id;
 		}
-
-		attr_ids = g_list_reverse(attr_ids);
 	}
 
-	if (!len)
+	if (!pending->attr_count)
 		goto err;
 
-	player_abort_pending_pdu(player);
+	pdu->params[0] = pending->attr_count;
 	pos = 1;
-	offset = 0;
-	attr_ids = player_fill_media_attribute(player, attr_ids, pdu->params,
-								&pos, &offset);
 
-	if (attr_ids != NULL) {
-		player->pending_pdu = pending_pdu_new(pdu->pdu_id, attr_ids,
-								offset);
+	if (player_fill_media_attribute(player, pending, pdu->params, &pos)) {
+		pending->pdu_id = pdu->pdu_id;
 		pdu->packet_type = AVRCP_PACKET_TYPE_START;
-	}
+	} else
+		player_abort_pending_pdu(player);
 
-	pdu->params[0] = len;
 	pdu->params_len = htons(pos);
 
 	return AVC_CTYPE_STABLE;
@@ -909,7 +1049,8 @@ static uint8_t avrcp_handle_register_notification(struct avrcp_player *player,
 						uint8_t transaction)
 {
 	uint16_t len = ntohs(pdu->params_len);
-	uint64_t uid;
+	uint32_t interval;
+	uint8_t id;
 
 	/*
 	 * 1 byte for EventID, 4 bytes for Playback interval but the latest
@@ -919,30 +1060,23 @@ static uint8_t avrcp_handle_register_notification(struct avrcp_player *player,
 	if (len != 5)
 		goto err;
 
-	switch (pdu->params[0]) {
-	case AVRCP_EVENT_STATUS_CHANGED:
-		len = 2;
-		pdu->params[1] = player->cb->get_status(player->user_data);
+	id = pdu->params[0];
+	interval = bt_get_be32(&pdu->params[1]);
 
-		break;
-	case AVRCP_EVENT_TRACK_CHANGED:
-		len = 9;
-		uid = player->cb->get_uid(player->user_data);
-		memcpy(&pdu->params[1], &uid, sizeof(uint64_t));
+	/* All other events are not supported yet */
+	if (id == AVRCP_EVENT_VOLUME_CHANGED)
+		goto err;
 
-		break;
-	case AVRCP_EVENT_TRACK_REACHED_END:
-	case AVRCP_EVENT_TRACK_REACHED_START:
-		len = 1;
-		break;
-	default:
-		/* All other events are not supported yet */
+	len = player_event_params(player, id, pdu->params);
+	if (len == 0)
 		goto err;
-	}
+
+	if (id == AVRCP_EVENT_PLAYBACK_POS_CHANGED)
+		player_start_position(player, interval);
 
 	/* Register event and save the transaction used */
-	player->registered_events |= (1 << pdu->params[0]);
-	player->transaction_events[pdu->params[0]] = transaction;
+	player->registered_events |= (1 << id);
+	player->transaction_events[id] = transaction;
 
 	pdu->params_len = htons(len);
 
@@ -959,30 +1093,22 @@ static uint8_t avrcp_handle_request_continuing(struct avrcp_player *player,
 						uint8_t transaction)
 {
 	uint16_t len = ntohs(pdu->params_len);
-	struct pending_pdu *pending;
+	struct pending_pdu *pending = &player->pending_pdu;
 
-	if (len != 1 || player->pending_pdu == NULL)
+	if (len != 1 || pending->pdu_id == 0)
 		goto err;
 
-	pending = player->pending_pdu;
-
 	if (pending->pdu_id != pdu->params[0])
 		goto err;
 
-
 	len = 0;
-	pending->attr_ids = player_fill_media_attribute(player,
-							pending->attr_ids,
-							pdu->params, &len,
-							&pending->offset);
 	pdu->pdu_id = pending->pdu_id;
 
-	if (pending->attr_ids == NULL) {
-		g_free(player->pending_pdu);
-		player->pending_pdu = NULL;
-		pdu->packet_type = AVRCP_PACKET_TYPE_END;
-	} else {
+	if (player_fill_media_attribute(player, pending, pdu->params, &len))
 		pdu->packet_type = AVRCP_PACKET_TYPE_CONTINUING;
+	else {
+		player_abort_pending_pdu(player);
+		pdu->packet_type = AVRCP_PACKET_TYPE_END;
 	}
 
 	pdu->params_len = htons(len);
@@ -999,13 +1125,11 @@ static uint8_t avrcp_handle_abort_continuing(struct avrcp_player *player,
 						uint8_t transaction)
 {
 	uint16_t len = ntohs(pdu->params_len);
-	struct pending_pdu *pending;
+	struct pending_pdu *pending = &player->pending_pdu;
 
-	if (len != 1 || player->pending_pdu == NULL)
+	if (len != 1 || pending->pdu_id == 0)
 		goto err;
 
-	pending = player->pending_pdu;
-
 	if (pending->pdu_id != pdu->params[0])
 		goto err;
 
@@ -1020,42 +1144,46 @@ err:
 	return AVC_CTYPE_REJECTED;
 }
 
-static struct pdu_handler {
+struct pdu_handler {
 	uint8_t pdu_id;
 	uint8_t code;
 	uint8_t (*func) (struct avrcp_player *player,
 					struct avrcp_header *pdu,
 					uint8_t transaction);
-} handlers[] = {
-		{ AVRCP_GET_CAPABILITIES, AVC_CTYPE_STATUS,
-					avrcp_handle_get_capabilities },
-		{ AVRCP_LIST_PLAYER_ATTRIBUTES, AVC_CTYPE_STATUS,
-					avrcp_handle_list_player_attributes },
-		{ AVRCP_LIST_PLAYER_VALUES, AVC_CTYPE_STATUS,
-					avrcp_handle_list_player_values },
-		{ AVRCP_GET_ELEMENT_ATTRIBUTES, AVC_CTYPE_STATUS,
-					avrcp_handle_get_element_attributes },
-		{ AVRCP_GET_CURRENT_PLAYER_VALUE, AVC_CTYPE_STATUS,
-					avrcp_handle_get_current_player_value },
-		{ AVRCP_SET_PLAYER_VALUE, AVC_CTYPE_CONTROL,
-					avrcp_handle_set_player_value },
-		{ AVRCP_GET_PLAYER_ATTRIBUTE_TEXT, AVC_CTYPE_STATUS,
-					NULL },
-		{ AVRCP_GET_PLAYER_VALUE_TEXT, AVC_CTYPE_STATUS,
-					NULL },
-		{ AVRCP_DISPLAYABLE_CHARSET, AVC_CTYPE_STATUS,
-					avrcp_handle_displayable_charset },
-		{ AVRCP_CT_BATTERY_STATUS, AVC_CTYPE_STATUS,
-					avrcp_handle_ct_battery_status },
-		{ AVRCP_GET_PLAY_STATUS, AVC_CTYPE_STATUS,
-					avrcp_handle_get_play_status },
-		{ AVRCP_REGISTER_NOTIFICATION, AVC_CTYPE_NOTIFY,
-					avrcp_handle_register_notification },
-		{ AVRCP_REQUEST_CONTINUING, AVC_CTYPE_CONTROL,
-					avrcp_handle_request_continuing },
-		{ AVRCP_ABORT_CONTINUING, AVC_CTYPE_CONTROL,
-					avrcp_handle_abort_continuing },
-		{ },
+};
+
+#define PDU_HANDLER(id, c, f) [id] = { .pdu_id = id, .code = c, .func = f }
+
+/* Indexed by PDU ID, unknown PDUs have pdu_id 0 */
+static const struct pdu_handler handlers[256] = {
+	PDU_HANDLER(AVRCP_GET_CAPABILITIES, AVC_CTYPE_STATUS,
+					avrcp_handle_get_capabilities),
+	PDU_HANDLER(AVRCP_LIST_PLAYER_ATTRIBUTES, AVC_CTYPE_STATUS,
+					avrcp_handle_list_player_attributes),
+	PDU_HANDLER(AVRCP_LIST_PLAYER_VALUES, AVC_CTYPE_STATUS,
+					avrcp_handle_list_player_values),
+	PDU_HANDLER(AVRCP_GET_ELEMENT_ATTRIBUTES, AVC_CTYPE_STATUS,
+					avrcp_handle_get_element_attributes),
+	PDU_HANDLER(AVRCP_GET_CURRENT_PLAYER_VALUE, AVC_CTYPE_STATUS,
+					avrcp_handle_get_current_player_value),
+	PDU_HANDLER(AVRCP_SET_PLAYER_VALUE, AVC_CTYPE_CONTROL,
+					avrcp_handle_set_player_value),
+	PDU_HANDLER(AVRCP_GET_PLAYER_ATTRIBUTE_TEXT, AVC_CTYPE_STATUS,
+					NULL),
+	PDU_HANDLER(AVRCP_GET_PLAYER_VALUE_TEXT, AVC_CTYPE_STATUS,
+					NULL),
+	PDU_HANDLER(AVRCP_DISPLAYABLE_CHARSET, AVC_CTYPE_STATUS,
+					avrcp_handle_displayable_charset),
+	PDU_HANDLER(AVRCP_CT_BATTERY_STATUS, AVC_CTYPE_STATUS,
+					avrcp_handle_ct_battery_status),
+	PDU_HANDLER(AVRCP_GET_PLAY_STATUS, AVC_CTYPE_STATUS,
+					avrcp_handle_get_play_status),
+	PDU_HANDLER(AVRCP_REGISTER_NOTIFICATION, AVC_CTYPE_NOTIFY,
+					avrcp_handle_register_notification),
+	PDU_HANDLER(AVRCP_REQUEST_CONTINUING, AVC_CTYPE_CONTROL,
+					avrcp_handle_request_continuing),
+	PDU_HANDLER(AVRCP_ABORT_CONTINUING, AVC_CTYPE_CONTROL,
+					avrcp_handle_abort_continuing),
 };
 
 /* handle vendordep pdu inside an avctp packet */
@@ -1065,7 +1193,7 @@ static size_t handle_vendordep_pdu(struct avctp *session, uint8_t transaction,
 					void *user_data)
 {
 	struct avrcp_player *player = user_data;
-	struct pdu_handler *handler;
+	const struct pdu_handler *handler;
 	struct avrcp_header *pdu = (void *) operands;
 	uint32_t company_id = get_company_id(pdu->company_id);
 
@@ -1085,12 +1213,9 @@ static size_t handle_vendordep_pdu(struct avctp *session, uint8_t transaction,
 		goto err_metadata;
 	}
 
-	for (handler = handlers; handler; handler++) {
-		if (handler->pdu_id == pdu->pdu_id)
-			break;
-	}
+	handler = &handlers[pdu->pdu_id];
 
-	if (!handler || handler->code != *code) {
+	if (handler->pdu_id == 0 || handler->code != *code) {
 		pdu->params[0] = AVRCP_STATUS_INVALID_COMMAND;
 		goto err_metadata;
 	}
@@ -1210,7 +1335,7 @@ static void state_changed(struct audio_device *dev, avctp_state_t old_state,
 	case AVCTP_STATE_DISCONNECTED:
 		player->session = NULL;
 		player->dev = NULL;
-		player->registered_events = 0;
+		player_stop_events(player);
 
 		if (player->handler) {
 			avctp_unregister_pdu_handler(player->handler);
@@ -1273,20 +1398,41 @@ int avrcp_register(DBusConnection *conn, const bdaddr_t *src, GKeyFile *config)
 {
 	sdp_record_t *record;
 	gboolean tmp, master = TRUE;
+	guint notify_window = NOTIFY_WINDOW;
+	guint position_interval = POSITION_INTERVAL;
 	GError *err = NULL;
 	struct avrcp_server *server;
+	int val;
 
 	if (config) {
 		tmp = g_key_file_get_boolean(config, "General",
 							"Master", &err);
 		if (err) {
 			DBG("audio.conf: %s", err->message);
-			g_error_free(err);
+			g_clear_error(&err);
 		} else
 			master = tmp;
+
+		val = g_key_file_get_integer(config, "AVRCP",
+							"NotifyWindow", &err);
+		if (err) {
+			DBG("audio.conf: %s", err->message);
+			g_clear_error(&err);
+		} else if (val >= 0)
+			notify_window = val;
+
+		val = g_key_file_get_integer(config, "AVRCP",
+						"PositionInterval", &err);
+		if (err) {
+			DBG("audio.conf: %s", err->message);
+			g_clear_error(&err);
+		} else if (val > 0)
+			position_interval = val;
 	}
 
 	server = g_new0(struct avrcp_server, 1);
+	server->notify_window = notify_window;
+	server->position_interval = position_interval;
 
 	record = avrcp_tg_record();
 	if (!record) {
@@ -1340,6 +1486,7 @@ static void player_destroy(gpointer data)
 		player->destroy(player->user_data);
 
 	player_abort_pending_pdu(player);
+	player_stop_events(player);
 
 	if (player->handler)
 		avctp_unregister_pdu_handler(player->handler);
@@ -0,0 +1,97 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2012  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+
+#include <glib.h>
+
+#include "latency.h"
+
+/* Rolling window of the most recent end-to-end latency samples */
+struct media_latency {
+	uint32_t *samples;
+	unsigned int window;
+	unsigned int count;
+	unsigned int next;
+};
+
+struct media_latency *media_latency_new(unsigned int window)
+{
+	struct media_latency *latency;
+
+	latency = g_new0(struct media_latency, 1);
+	latency->samples = g_new0(uint32_t, window);
+	latency->window = window;
+
+	return latency;
+}
+
+void media_latency_free(struct media_latency *latency)
+{
+	g_free(latency->samples);
+	g_free(latency);
+}
+
+void media_latency_reset(struct media_latency *latency)
+{
+	latency->count = 0;
+	latency->next = 0;
+}
+
+void media_latency_add(struct media_latency *latency, uint32_t usec)
+{
+	latency->samples[latency->next] = usec;
+	latency->next = (latency->next + 1) % latency->window;
+
+	if (latency->count < latency->window)
+		latency->count++;
+}
+
+gboolean media_latency_get(struct media_latency *latency, uint32_t *min,
+						uint32_t *avg, uint32_t *max)
+{
+	uint64_t sum = 0;
+	unsigned int i;
+
+	if (latency->count == 0)
+		return FALSE;
+
+	*min = UINT32_MAX;
+	*max = 0;
+
+	for (i = 0; i < latency->count; i++) {
+		uint32_t usec = latency->samples[i];
+
+		*min = MIN(*min, usec);
+		*max = MAX(*max, usec);
+		sum += usec;
+	}
+
+	*avg = sum / latency->count;
+
+	return TRUE;
+}
@@ -1272,28 +1272,26 @@ static int set_setting(uint8_t attr, uint8_t val, void *user_data)
 	return 0;
 }
 
-static GList *list_metadata(void *user_data)
+static uint64_t get_uid(void *user_data)
 {
 	struct media_player *mp = user_data;
 
-	DBG("");
+	DBG("%p", mp->track);
 
 	if (mp->track == NULL)
-		return NULL;
+		return UINT64_MAX;
 
-	return g_hash_table_get_keys(mp->track);
+	return 0;
 }
 
-static uint64_t get_uid(void *user_data)
+static gboolean has_metadata(uint32_t id, void *user_data)
 {
 	struct media_player *mp = user_data;
 
-	DBG("%p", mp->track);
-
 	if (mp->track == NULL)
-		return UINT64_MAX;
+		return FALSE;
 
-	return 0;
+	return g_hash_table_lookup(mp->track, GUINT_TO_POINTER(id)) != NULL;
 }
 
 static void *get_metadata(uint32_t id, void *user_data)
@@ -1373,8 +1371,8 @@ static void set_volume(uint8_t volume, struct audio_device *dev, void *user_data
 static struct avrcp_player_cb player_cb = {
 	.get_setting = get_setting,
 	.set_setting = set_setting,
-	.list_metadata = list_metadata,
 	.get_uid = get_uid,
+	.has_metadata = has_metadata,
 	.get_metadata = get_metadata,
 	.get_position = get_position,
 	.get_status = get_status,
@@ -1414,7 +1412,7 @@ static gboolean set_status(struct media_player *mp, DBusMessageIter *iter)
 
 	mp->status = val;
 
-	avrcp_player_event(mp->player, AVRCP_EVENT_STATUS_CHANGED, &val);
+	avrcp_player_event(mp->player, AVRCP_EVENT_STATUS_CHANGED);
 
 	return TRUE;
 }
@@ -1433,9 +1431,11 @@ static gboolean set_position(struct media_player *mp, DBusMessageIter *iter)
 	mp->position = value;
 	g_timer_start(mp->timer);
 
+	avrcp_player_event(mp->player, AVRCP_EVENT_PLAYBACK_POS_CHANGED);
+
 	if (!mp->position) {
 		avrcp_player_event(mp->player,
-					AVRCP_EVENT_TRACK_REACHED_START, NULL);
+					AVRCP_EVENT_TRACK_REACHED_START);
 		return TRUE;
 	}
 
@@ -1448,8 +1448,7 @@ static gboolean set_position(struct media_player *mp, DBusMessageIter *iter)
 	 */
 	if (mp->position == UINT32_MAX ||
 			(duration && mp->position >= duration->value.num))
-		avrcp_player_event(mp->player, AVRCP_EVENT_TRACK_REACHED_END,
-									NULL);
+		avrcp_player_event(mp->player, AVRCP_EVENT_TRACK_REACHED_END);
 
 	return TRUE;
 }
@@ -1541,7 +1540,6 @@ static gboolean parse_player_metadata(struct media_player *mp,
 	GHashTable *track;
 	int ctype;
 	gboolean title = FALSE;
-	uint64_t uid;
 
 	ctype = dbus_message_iter_get_arg_type(iter);
 	if (ctype != DBUS_TYPE_ARRAY)
@@ -1639,11 +1637,9 @@ static gboolean parse_player_metadata(struct media_player *mp,
 	mp->track = track;
 	mp->position = 0;
 	g_timer_start(mp->timer);
-	uid = get_uid(mp);
 
-	avrcp_player_event(mp->player, AVRCP_EVENT_TRACK_CHANGED, &uid);
-	avrcp_player_event(mp->player, AVRCP_EVENT_TRACK_REACHED_START,
-								NULL);
+	avrcp_player_event(mp->player, AVRCP_EVENT_TRACK_CHANGED);
+	avrcp_player_event(mp->player, AVRCP_EVENT_TRACK_REACHED_START);
 
 	return TRUE;
 
@@ -0,0 +1,400 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2012  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+
+#include <glib.h>
+
+#include "log.h"
+#include "rtp.h"
+#include "ring.h"
+
+#define RING_DATA_OFFSET	4096
+#define RTP_PAYLOAD_TYPE	96
+#define SBC_SYNCWORD		0x9C
+#define MAX_FRAMES_PER_PACKET	15
+
+/* How long to wait before retrying a send that would have blocked */
+#define RETRY_DELAY		1000
+
+struct media_ring {
+	int sock;
+	uint16_t omtu;
+	int fd;
+	int event_fd;
+	struct media_ring_header *hdr;
+	uint8_t *data;
+	uint32_t size;
+	uint32_t tail;		/* Authoritative copy, hdr is client writable */
+	guint event_watch;
+	guint timer;
+	uint8_t *buf;
+	uint16_t seq_num;
+	uint32_t rtp_ts;
+	gint64 deadline;	/* Monotonic usec when the next packet is due */
+	gboolean streaming;
+};
+
+static const unsigned int sbc_frequencies[] = { 16000, 32000, 44100, 48000 };
+
+static gboolean sbc_frame_info(const uint8_t *header, unsigned int *len,
+						unsigned int *samples,
+						unsigned int *frequency)
+{
+	unsigned int subbands, blocks, channels, bitpool, mode, bits;
+
+	if (header[0] != SBC_SYNCWORD)
+		return FALSE;
+
+	*frequency = sbc_frequencies[(header[1] >> 6) & 0x03];
+	blocks = (((header[1] >> 4) & 0x03) + 1) * 4;
+	mode = (header[1] >> 2) & 0x03;
+	subbands = header[1] & 0x01 ? 8 : 4;
+	bitpool = header[2];
+
+	channels = mode == 0x00 ? 1 : 2;
+
+	*len = 4 + (4 * subbands * channels) / 8;
+
+	/* Mono and dual channel code each channel separately */
+	if (mode == 0x00 || mode == 0x01)
+		bits = blocks * channels * bitpool;
+	else
+		bits = (mode == 0x03 ? subbands : 0) + blocks * bitpool;
+
+	*len += (bits + 7) / 8;
+	*samples = blocks * subbands;
+
+	return TRUE;
+}
+
+static void ring_read(struct media_ring *ring, uint32_t pos, uint8_t *dst,
+								uint32_t len)
+{
+	uint32_t offset = pos & (ring->size - 1);
+	uint32_t first = MIN(len, ring->size - offset);
+
+	memcpy(dst, ring->data + offset, first);
+	memcpy(dst + first, ring->data, len - first);
+}
+
+static void ring_report(struct media_ring *ring, uint32_t bytes)
+{
+	struct media_ring_header *hdr = ring->hdr;
+
+	ring->tail += bytes;
+
+	hdr->seq++;
+	__sync_synchronize();
+
+	hdr->tail = ring->tail;
+	hdr->consumed += bytes;
+	hdr->timestamp = g_get_monotonic_time();
+
+	__sync_synchronize();
+	hdr->seq++;
+}
+
+/* Returns the playback duration in usec of the packet sent, 0 if there was
+ * no complete frame available or a negative error code */
+static int ring_send_packet(struct media_ring *ring)
+{
+	struct rtp_header *rtp = (void *) ring->buf;
+	struct rtp_payload *payload = (void *) (ring->buf + sizeof(*rtp));
+	size_t offset = sizeof(*rtp) + sizeof(*payload);
+	unsigned int frames = 0, samples = 0, frequency = 0;
+	uint32_t head, avail, used = 0;
+
+	head = ring->hdr->head;
+	__sync_synchronize();
+
+	avail = head - ring->tail;
+	if (avail > ring->size) {
+		error("Media ring head out of range");
+		return -EINVAL;
+	}
+
+	while (frames < MAX_FRAMES_PER_PACKET) {
+		uint8_t header[3];
+		unsigned int len, frame_samples;
+
+		if (avail - used < sizeof(header))
+			break;
+
+		ring_read(ring, ring->tail + used, header, sizeof(header));
+
+		if (!sbc_frame_info(header, &len, &frame_samples, &frequency)) {
+			error("Invalid SBC frame in media ring");
+			return -EINVAL;
+		}
+
+		if (avail - used < len)
+			break;
+
+		if (offset + len > ring->omtu) {
+			if (frames > 0)
+				break;
+
+			error("SBC frame of %u bytes exceeds MTU", len);
+			return -EMSGSIZE;
+		}
+
+		ring_read(ring, ring->tail + used, ring->buf + offset, len);
+
+		offset += len;
+		used += len;
+		samples += frame_samples;
+		frames++;
+	}
+
+	if (frames == 0)
+		return 0;
+
+	memset(rtp, 0, sizeof(*rtp));
+	rtp->v = 2;
+	rtp->pt = RTP_PAYLOAD_TYPE;
+	rtp->sequence_number = htons(ring->seq_num);
+	rtp->timestamp = htonl(ring->rtp_ts);
+	rtp->ssrc = htonl(1);
+
+	memset(payload, 0, sizeof(*payload));
+	payload->frame_count = frames;
+
+	if (send(ring->sock, ring->buf, offset, MSG_DONTWAIT) < 0)
+		return -errno;
+
+	ring->seq_num++;
+	ring->rtp_ts += samples;
+
+	ring_report(ring, used);
+
+	return (uint64_t) samples * G_USEC_PER_SEC / frequency;
+}
+
+static gboolean ring_timeout(gpointer user_data);
+
+static void ring_process(struct media_ring *ring)
+{
+	gint64 now = g_get_monotonic_time();
+
+	while (ring->deadline <= now) {
+		int duration;
+
+		duration = ring_send_packet(ring);
+		if (duration == -EAGAIN) {
+			ring->deadline = now + RETRY_DELAY;
+			break;
+		}
+
+		if (duration < 0) {
+			error("Media ring: %s (%d)", strerror(-duration),
+								-duration);
+			ring->streaming = FALSE;
+			return;
+		}
+
+		if (duration == 0) {
+			/* Wait for the client to signal more data */
+			ring->hdr->underruns++;
+			ring->streaming = FALSE;
+			return;
+		}
+
+		ring->deadline += duration;
+	}
+
+	ring->timer = g_timeout_add((ring->deadline - now + 999) / 1000,
+							ring_timeout, ring);
+}
+
+static gboolean ring_timeout(gpointer user_data)
+{
+	struct media_ring *ring = user_data;
+
+	ring->timer = 0;
+
+	ring_process(ring);
+
+	return FALSE;
+}
+
+static gboolean ring_event(GIOChannel *io, GIOCondition cond,
+							gpointer user_data)
+{
+	struct media_ring *ring = user_data;
+	uint64_t count;
+
+	if (cond & (G_IO_ERR | G_IO_HUP | G_IO_NVAL)) {
+		ring->event_watch = 0;
+		return FALSE;
+	}
+
+	if (read(ring->event_fd, &count, sizeof(count)) < 0 &&
+							errno != EAGAIN)
+		error("Media ring event: %s (%d)", strerror(errno), errno);
+
+	if (ring->streaming)
+		return TRUE;
+
+	ring->streaming = TRUE;
+	ring->deadline = g_get_monotonic_time();
+
+	ring_process(ring);
+
+	return TRUE;
+}
+
+static int create_shm(size_t size)
+{
+	int fd, err;
+#ifdef HAVE_MEMFD_CREATE
+	fd = memfd_create("bluez-media-ring", MFD_CLOEXEC);
+#else
+	char path[] = "/dev/shm/bluez-ring-XXXXXX";
+
+	fd = mkstemp(path);
+	if (fd >= 0)
+		unlink(path);
+#endif
+	if (fd < 0)
+		return -errno;
+
+	if (ftruncate(fd, size) < 0) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+
+	return fd;
+}
+
+struct media_ring *media_ring_new(int sock, uint16_t omtu)
+{
+	struct media_ring *ring;
+	GIOChannel *io;
+	void *map;
+
+	ring = g_new0(struct media_ring, 1);
+	ring->sock = sock;
+	ring->omtu = omtu;
+	ring->size = MEDIA_RING_SIZE;
+	ring->event_fd = -1;
+
+	ring->fd = create_shm(RING_DATA_OFFSET + ring->size);
+	if (ring->fd < 0) {
+		error("Unable to create media ring: %s (%d)",
+					strerror(-ring->fd), -ring->fd);
+		goto failed;
+	}
+
+	map = mmap(NULL, RING_DATA_OFFSET + ring->size,
+				PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+	if (map == MAP_FAILED) {
+		error("Unable to map media ring: %s (%d)", strerror(errno),
+									errno);
+		goto failed;
+	}
+
+	ring->hdr = map;
+	ring->data = (uint8_t *) map + RING_DATA_OFFSET;
+
+	ring->hdr->magic = MEDIA_RING_MAGIC;
+	ring->hdr->version = MEDIA_RING_VERSION;
+	ring->hdr->size = ring->size;
+	ring->hdr->data_offset = RING_DATA_OFFSET;
+
+	ring->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ring->event_fd < 0) {
+		error("Unable to create media ring event: %s (%d)",
+						strerror(errno), errno);
+		goto failed;
+	}
+
+	io = g_io_channel_unix_new(ring->event_fd);
+	ring->event_watch = g_io_add_watch(io,
+					G_IO_IN | G_IO_ERR | G_IO_HUP | G_IO_NVAL,
+					ring_event, ring);
+	g_io_channel_unref(io);
+
+	ring->buf = g_malloc(omtu);
+
+	DBG("Media ring %p: size %u omtu %u", ring, ring->size, omtu);
+
+	return ring;
+
+failed:
+	media_ring_free(ring);
+	return NULL;
+}
+
+void media_ring_free(struct media_ring *ring)
+{
+	DBG("Media ring %p", ring);
+
+	if (ring->timer > 0)
+		g_source_remove(ring->timer);
+
+	if (ring->event_watch > 0)
+		g_source_remove(ring->event_watch);
+
+	if (ring->hdr)
+		munmap(ring->hdr, RING_DATA_OFFSET + ring->size);
+
+	if (ring->event_fd >= 0)
+		close(ring->event_fd);
+
+	if (ring->fd >= 0)
+		close(ring->fd);
+
+	g_free(ring->buf);
+	g_free(ring);
+}
+
+int media_ring_get_fd(struct media_ring *ring)
+{
+	return ring->fd;
+}
+
+int media_ring_get_event_fd(struct media_ring *ring)
+{
+	return ring->event_fd;
+}
+
+uint32_t media_ring_get_depth(struct media_ring *ring)
+{
+	uint32_t depth = ring->hdr->head - ring->tail;
+
+	return MIN(depth, ring->size);
+}
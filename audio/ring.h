@@ -0,0 +1,52 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2012  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#define MEDIA_RING_MAGIC	0x474e5242	/* "BRNG" */
+#define MEDIA_RING_VERSION	1
+#define MEDIA_RING_SIZE		(64 * 1024)
+
+/* Shared memory layout, the data area follows the header at data_offset.
+ * head is only written by the client, tail and the consumption report only
+ * by bluetoothd. Positions are free running byte counters and the client
+ * writes whole SBC frames only. */
+struct media_ring_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;		/* Size of the data area, power of two */
+	uint32_t data_offset;	/* Offset of the data area */
+	uint32_t head;		/* Producer position */
+	uint32_t tail;		/* Consumer position */
+	uint32_t seq;		/* Odd while the report below is updated */
+	uint32_t underruns;	/* Times the ring ran dry while streaming */
+	uint64_t consumed;	/* Total bytes handed to the socket */
+	uint64_t timestamp;	/* CLOCK_MONOTONIC usec of the last report */
+};
+
+struct media_ring;
+
+struct media_ring *media_ring_new(int sock, uint16_t omtu);
+void media_ring_free(struct media_ring *ring);
+
+int media_ring_get_fd(struct media_ring *ring);
+int media_ring_get_event_fd(struct media_ring *ring);
+uint32_t media_ring_get_depth(struct media_ring *ring);
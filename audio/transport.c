@@ -27,6 +27,9 @@
 #endif
 
 #include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <termios.h>
 
 #include <bluetooth/uuid.h>
 
@@ -46,9 +49,15 @@
 #include "headset.h"
 #include "gateway.h"
 #include "avrcp.h"
+#include "a2dp-codecs.h"
+#include "ring.h"
+#include "latency.h"
 
 #define MEDIA_TRANSPORT_INTERFACE "org.bluez.MediaTransport"
 
+#define LATENCY_INTERVAL 1	/* Seconds between latency samples */
+#define LATENCY_WINDOW 10	/* Samples used for min/avg/max */
+
 struct media_request {
 	DBusMessage		*msg;
 	guint			id;
@@ -59,6 +68,7 @@ struct media_owner {
 	struct media_request	*pending;
 	char			*name;
 	char			*accesstype;
+	gboolean		ring;		/* Acquired through AcquireRing */
 	guint			watch;
 };
 
@@ -66,6 +76,13 @@ struct a2dp_transport {
 	struct avdtp		*session;
 	uint16_t		delay;
 	uint16_t		volume;
+	struct media_ring	*ring;
+	uint32_t		bitrate;	/* Encoded bits per second */
+	struct media_latency	*latency;
+	guint			latency_timer;
+	uint32_t		latency_min;	/* Last reported values */
+	uint32_t		latency_avg;
+	uint32_t		latency_max;
 };
 
 struct headset_transport {
@@ -195,6 +212,17 @@ static void media_owner_free(struct media_owner *owner)
 	g_free(owner);
 }
 
+static void media_transport_stop_ring(struct media_transport *transport)
+{
+	struct a2dp_transport *a2dp = transport->data;
+
+	if (a2dp->ring == NULL)
+		return;
+
+	media_ring_free(a2dp->ring);
+	a2dp->ring = NULL;
+}
+
 static void media_transport_remove(struct media_transport *transport,
 						struct media_owner *owner)
 {
@@ -202,6 +230,9 @@ static void media_transport_remove(struct media_transport *transport,
 
 	media_transport_release(transport, owner->accesstype);
 
+	if (owner->ring)
+		media_transport_stop_ring(transport);
+
 	/* Reply if owner has a pending request */
 	if (owner->pending)
 		media_request_reply(owner->pending, transport->conn, EIO);
@@ -233,6 +264,81 @@ static gboolean media_transport_set_fd(struct media_transport *transport,
 	return TRUE;
 }
 
+static void latency_emit(struct media_transport *transport, const char *name,
+					uint32_t *reported, uint32_t value)
+{
+	if (*reported == value)
+		return;
+
+	*reported = value;
+
+	emit_property_changed(transport->conn, transport->path,
+				MEDIA_TRANSPORT_INTERFACE, name,
+				DBUS_TYPE_UINT32, reported);
+}
+
+/* Bytes queued in the socket, the kernel reports the free space left in
+ * the send buffer for TIOCOUTQ on Bluetooth sockets */
+static uint32_t socket_outq(int fd)
+{
+	int sndbuf, space;
+	socklen_t len = sizeof(sndbuf);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) < 0)
+		return 0;
+
+	if (ioctl(fd, TIOCOUTQ, &space) < 0)
+		return 0;
+
+	return space < sndbuf ? sndbuf - space : 0;
+}
+
+static gboolean latency_sample(gpointer user_data)
+{
+	struct media_transport *transport = user_data;
+	struct a2dp_transport *a2dp = transport->data;
+	uint32_t bytes, usec, min, avg, max;
+
+	if (transport->in_use == FALSE || transport->fd < 0) {
+		a2dp->latency_timer = 0;
+		media_latency_reset(a2dp->latency);
+		return FALSE;
+	}
+
+	/* Delay reports are in 1/10 milliseconds */
+	usec = a2dp->delay * 100;
+
+	bytes = socket_outq(transport->fd);
+	if (a2dp->ring)
+		bytes += media_ring_get_depth(a2dp->ring);
+
+	if (a2dp->bitrate > 0)
+		usec += (uint64_t) bytes * 8 * G_USEC_PER_SEC / a2dp->bitrate;
+
+	media_latency_add(a2dp->latency, usec);
+
+	if (!media_latency_get(a2dp->latency, &min, &avg, &max))
+		return TRUE;
+
+	latency_emit(transport, "LatencyMin", &a2dp->latency_min, min);
+	latency_emit(transport, "LatencyAvg", &a2dp->latency_avg, avg);
+	latency_emit(transport, "LatencyMax", &a2dp->latency_max, max);
+
+	return TRUE;
+}
+
+static void a2dp_start_latency(struct media_transport *transport)
+{
+	struct a2dp_transport *a2dp = transport->data;
+
+	if (a2dp->latency_timer > 0)
+		return;
+
+	a2dp->latency_timer = g_timeout_add_seconds(LATENCY_INTERVAL,
+							latency_sample,
+							transport);
+}
+
 static void a2dp_resume_complete(struct avdtp *session,
 				struct avdtp_error *err, void *user_data)
 {
@@ -260,6 +366,33 @@ static void a2dp_resume_complete(struct avdtp *session,
 
 	media_transport_set_fd(transport, fd, imtu, omtu);
 
+	a2dp_start_latency(transport);
+
+	if (owner->ring) {
+		struct a2dp_transport *a2dp = transport->data;
+		int ring_fd, event_fd;
+
+		if (a2dp->ring == NULL)
+			a2dp->ring = media_ring_new(fd, omtu);
+
+		if (a2dp->ring == NULL)
+			goto fail;
+
+		ring_fd = media_ring_get_fd(a2dp->ring);
+		event_fd = media_ring_get_event_fd(a2dp->ring);
+
+		ret = g_dbus_send_reply(transport->conn, req->msg,
+						DBUS_TYPE_UNIX_FD, &ring_fd,
+						DBUS_TYPE_UNIX_FD, &event_fd,
+						DBUS_TYPE_INVALID);
+		if (ret == FALSE)
+			goto fail;
+
+		media_owner_remove(owner);
+
+		return;
+	}
+
 	if (g_strstr_len(owner->accesstype, -1, "r") == NULL)
 		imtu = 0;
 
@@ -655,20 +788,17 @@ static struct media_owner *media_transport_find_owner(
 	return NULL;
 }
 
-static DBusMessage *acquire(DBusConnection *conn, DBusMessage *msg,
-					void *data)
+static DBusMessage *acquire_transport(struct media_transport *transport,
+						DBusConnection *conn,
+						DBusMessage *msg,
+						const char *accesstype,
+						gboolean ring)
 {
-	struct media_transport *transport = data;
 	struct media_owner *owner;
 	struct media_request *req;
-	const char *accesstype, *sender;
+	const char *sender;
 	guint id;
 
-	if (!dbus_message_get_args(msg, NULL,
-				DBUS_TYPE_STRING, &accesstype,
-				DBUS_TYPE_INVALID))
-		return NULL;
-
 	sender = dbus_message_get_sender(msg);
 
 	owner = media_transport_find_owner(transport, sender);
@@ -679,6 +809,8 @@ static DBusMessage *acquire(DBusConnection *conn, DBusMessage *msg,
 		return btd_error_not_authorized(msg);
 
 	owner = media_owner_create(conn, msg, accesstype);
+	owner->ring = ring;
+
 	id = transport->resume(transport, owner);
 	if (id == 0) {
 		media_transport_release(transport, accesstype);
@@ -693,6 +825,36 @@ static DBusMessage *acquire(DBusConnection *conn, DBusMessage *msg,
 	return NULL;
 }
 
+static DBusMessage *acquire(DBusConnection *conn, DBusMessage *msg,
+					void *data)
+{
+	struct media_transport *transport = data;
+	const char *accesstype;
+
+	if (!dbus_message_get_args(msg, NULL,
+				DBUS_TYPE_STRING, &accesstype,
+				DBUS_TYPE_INVALID))
+		return NULL;
+
+	return acquire_transport(transport, conn, msg, accesstype, FALSE);
+}
+
+static DBusMessage *acquire_ring(DBusConnection *conn, DBusMessage *msg,
+					void *data)
+{
+	struct media_transport *transport = data;
+	const char *uuid;
+
+	/* Only SBC streams towards a remote sink are paced by us */
+	uuid = media_endpoint_get_uuid(transport->endpoint);
+	if (strcasecmp(uuid, A2DP_SOURCE_UUID) != 0 ||
+			media_endpoint_get_codec(transport->endpoint) !=
+							A2DP_CODEC_SBC)
+		return btd_error_not_supported(msg);
+
+	return acquire_transport(transport, conn, msg, "w", TRUE);
+}
+
 static DBusMessage *release(DBusConnection *conn, DBusMessage *msg,
 					void *data)
 {
@@ -874,6 +1036,16 @@ static void get_properties_a2dp(struct media_transport *transport,
 	if (a2dp->volume <= 127)
 		dict_append_entry(dict, "Volume", DBUS_TYPE_UINT16,
 							&a2dp->volume);
+
+	if (a2dp->latency_timer == 0)
+		return;
+
+	dict_append_entry(dict, "LatencyMin", DBUS_TYPE_UINT32,
+							&a2dp->latency_min);
+	dict_append_entry(dict, "LatencyAvg", DBUS_TYPE_UINT32,
+							&a2dp->latency_avg);
+	dict_append_entry(dict, "LatencyMax", DBUS_TYPE_UINT32,
+							&a2dp->latency_max);
 }
 
 static void get_properties_headset(struct media_transport *transport,
@@ -956,6 +1128,9 @@ static const GDBusMethodTable transport_methods[] = {
 			GDBUS_ARGS({ "fd", "h" }, { "mtu_r", "q" },
 							{ "mtu_w", "q" } ),
 			acquire) },
+	{ GDBUS_ASYNC_METHOD("AcquireRing",
+			NULL, GDBUS_ARGS({ "ring", "h" }, { "event", "h" }),
+			acquire_ring) },
 	{ GDBUS_ASYNC_METHOD("Release",
 			GDBUS_ARGS({ "access_type", "s" }), NULL,
 			release ) },
@@ -978,6 +1153,14 @@ static void destroy_a2dp(void *data)
 	if (a2dp->session)
 		avdtp_unref(a2dp->session);
 
+	if (a2dp->ring)
+		media_ring_free(a2dp->ring);
+
+	if (a2dp->latency_timer > 0)
+		g_source_remove(a2dp->latency_timer);
+
+	media_latency_free(a2dp->latency);
+
 	g_free(a2dp);
 }
 
@@ -1027,6 +1210,65 @@ static void headset_nrec_changed(struct audio_device *dev, gboolean nrec,
 				DBUS_TYPE_BOOLEAN, &nrec);
 }
 
+static uint32_t sbc_bitrate(const uint8_t *configuration, size_t size)
+{
+	const a2dp_sbc_t *sbc = (const void *) configuration;
+	unsigned int frequency, blocks, subbands, channels, bits, len;
+
+	if (size < sizeof(*sbc))
+		return 0;
+
+	switch (sbc->frequency) {
+	case SBC_SAMPLING_FREQ_16000:
+		frequency = 16000;
+		break;
+	case SBC_SAMPLING_FREQ_32000:
+		frequency = 32000;
+		break;
+	case SBC_SAMPLING_FREQ_44100:
+		frequency = 44100;
+		break;
+	case SBC_SAMPLING_FREQ_48000:
+		frequency = 48000;
+		break;
+	default:
+		return 0;
+	}
+
+	switch (sbc->block_length) {
+	case SBC_BLOCK_LENGTH_4:
+		blocks = 4;
+		break;
+	case SBC_BLOCK_LENGTH_8:
+		blocks = 8;
+		break;
+	case SBC_BLOCK_LENGTH_12:
+		blocks = 12;
+		break;
+	case SBC_BLOCK_LENGTH_16:
+		blocks = 16;
+		break;
+	default:
+		return 0;
+	}
+
+	subbands = sbc->subbands == SBC_SUBBANDS_4 ? 4 : 8;
+	channels = sbc->channel_mode == SBC_CHANNEL_MODE_MONO ? 1 : 2;
+
+	/* Assume the encoder runs at the highest bitpool allowed */
+	if (sbc->channel_mode == SBC_CHANNEL_MODE_MONO ||
+			sbc->channel_mode == SBC_CHANNEL_MODE_DUAL_CHANNEL)
+		bits = blocks * channels * sbc->max_bitpool;
+	else if (sbc->channel_mode == SBC_CHANNEL_MODE_JOINT_STEREO)
+		bits = subbands + blocks * sbc->max_bitpool;
+	else
+		bits = blocks * sbc->max_bitpool;
+
+	len = 4 + (4 * subbands * channels) / 8 + (bits + 7) / 8;
+
+	return (uint64_t) len * 8 * frequency / (blocks * subbands);
+}
+
 struct media_transport *media_transport_create(DBusConnection *conn,
 						struct media_endpoint *endpoint,
 						struct audio_device *device,
@@ -1054,6 +1296,10 @@ struct media_transport *media_transport_create(DBusConnection *conn,
 
 		a2dp = g_new0(struct a2dp_transport, 1);
 		a2dp->volume = -1;
+		a2dp->latency = media_latency_new(LATENCY_WINDOW);
+
+		if (media_endpoint_get_codec(endpoint) == A2DP_CODEC_SBC)
+			a2dp->bitrate = sbc_bitrate(configuration, size);
 
 		transport->resume = resume_a2dp;
 		transport->suspend = suspend_a2dp;
@@ -67,10 +67,182 @@ static uint128_t bluetooth_base_uuid = {
 
 #define SDP_MAX_ATTR_LEN 65535
 
+struct sdp_arena;
+
 static sdp_data_t *sdp_copy_seq(sdp_data_t *data);
 static int sdp_attr_add_new_with_length(sdp_record_t *rec,
 	uint16_t attr, uint8_t dtd, const void *value, uint32_t len);
 static int sdp_gen_buffer(sdp_buf_t *buf, sdp_data_t *d);
+static void sdp_record_copy_arena(sdp_record_t *rec, struct sdp_arena *arena);
+static void sdp_record_detach_arena(sdp_record_t *rec);
+static sdp_data_t *extract_attr(const uint8_t *p, int bufsize, int *size,
+				sdp_record_t *rec, struct sdp_arena **arena);
+
+/*
+ * Records extracted with sdp_extract_pdu_arena() take their attribute
+ * list, data elements and strings from a few large blocks, released all
+ * at once with the record.
+ */
+#define SDP_ARENA_BLOCK_SIZE 4096
+
+struct sdp_arena {
+	struct sdp_arena *next;
+	size_t size;
+	size_t used;
+	uint64_t data[0];
+};
+
+/* Falls back to malloc when there is no arena */
+static void *arena_alloc(struct sdp_arena **arena, size_t size)
+{
+	struct sdp_arena *block;
+	void *ptr;
+
+	if (!arena)
+		return malloc(size);
+
+	size = (size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+
+	block = *arena;
+	if (!block || block->size - block->used < size) {
+		size_t block_size = size > SDP_ARENA_BLOCK_SIZE ? size :
+							SDP_ARENA_BLOCK_SIZE;
+
+		block = malloc(sizeof(struct sdp_arena) + block_size);
+		if (!block)
+			return NULL;
+
+		block->next = *arena;
+		block->size = block_size;
+		block->used = 0;
+		*arena = block;
+	}
+
+	ptr = (uint8_t *) block->data + block->used;
+	block->used += size;
+
+	return ptr;
+}
+
+/* Memory taken from an arena is only released with the whole arena */
+static void arena_release(struct sdp_arena **arena, void *ptr)
+{
+	if (!arena)
+		free(ptr);
+}
+
+static void arena_free(struct sdp_arena *arena)
+{
+	while (arena) {
+		struct sdp_arena *next = arena->next;
+
+		free(arena);
+		arena = next;
+	}
+}
+
+/*
+ * The arena of a record is found through a table keyed by the record
+ * address, so sdp_record_t keeps its layout. The table is only touched
+ * once a record has been extracted into an arena.
+ */
+#define SDP_ARENA_TABLE_SIZE 64
+
+struct sdp_arena_entry {
+	const sdp_record_t *rec;
+	struct sdp_arena *arena;
+	struct sdp_arena_entry *next;
+};
+
+static struct sdp_arena_entry **arena_table = NULL;
+static unsigned int arena_table_size = 0;
+static unsigned int arena_records = 0;
+
+static unsigned int arena_hash(const sdp_record_t *rec, unsigned int size)
+{
+	return ((uintptr_t) rec / sizeof(sdp_record_t)) % size;
+}
+
+static void arena_table_resize(unsigned int size)
+{
+	struct sdp_arena_entry **table;
+	unsigned int i;
+
+	table = calloc(size, sizeof(*table));
+	if (!table)
+		return;
+
+	for (i = 0; i < arena_table_size; i++) {
+		struct sdp_arena_entry *entry = arena_table[i];
+
+		while (entry) {
+			struct sdp_arena_entry *next = entry->next;
+			unsigned int h = arena_hash(entry->rec, size);
+
+			entry->next = table[h];
+			table[h] = entry;
+			entry = next;
+		}
+	}
+
+	free(arena_table);
+	arena_table = table;
+	arena_table_size = size;
+}
+
+static int arena_attach(const sdp_record_t *rec, struct sdp_arena *arena)
+{
+	struct sdp_arena_entry *entry;
+	unsigned int h;
+
+	if (arena_records >= arena_table_size)
+		arena_table_resize(arena_table_size ? arena_table_size * 2 :
+							SDP_ARENA_TABLE_SIZE);
+
+	if (!arena_table)
+		return -ENOMEM;
+
+	entry = malloc(sizeof(*entry));
+	if (!entry)
+		return -ENOMEM;
+
+	h = arena_hash(rec, arena_table_size);
+
+	entry->rec = rec;
+	entry->arena = arena;
+	entry->next = arena_table[h];
+	arena_table[h] = entry;
+	arena_records++;
+
+	return 0;
+}
+
+/* Removes the record from the table, returning its arena if it had one */
+static struct sdp_arena *arena_detach(const sdp_record_t *rec)
+{
+	struct sdp_arena_entry **pos;
+
+	if (arena_records == 0)
+		return NULL;
+
+	for (pos = &arena_table[arena_hash(rec, arena_table_size)]; *pos;
+						pos = &(*pos)->next) {
+		struct sdp_arena_entry *entry = *pos;
+		struct sdp_arena *arena;
+
+		if (entry->rec != rec)
+			continue;
+
+		arena = entry->arena;
+		*pos = entry->next;
+		free(entry);
+		arena_records--;
+
+		return arena;
+	}
+
+	return NULL;
+}
 
 /* Message structure. */
 struct tupla {
@@ -587,6 +759,8 @@ int sdp_attr_add(sdp_record_t *rec, uint16_t attr, sdp_data_t *d)
 	if (p)
 		return -1;
 
+	sdp_record_detach_arena(rec);
+
 	d->attrId = attr;
 	rec->attrlist = sdp_list_insert_sorted(rec->attrlist, d, sdp_attrid_comp_func);
 
@@ -598,8 +772,11 @@ int sdp_attr_add(sdp_record_t *rec, uint16_t attr, sdp_data_t *d)
 
 void sdp_attr_remove(sdp_record_t *rec, uint16_t attr)
 {
-	sdp_data_t *d = sdp_data_get(rec, attr);
+	sdp_data_t *d;
+
+	sdp_record_detach_arena(rec);
 
+	d = sdp_data_get(rec, attr);
 	if (d)
 		rec->attrlist = sdp_list_remove(rec->attrlist, d);
 
@@ -938,7 +1115,11 @@ int sdp_gen_record_pdu(const sdp_record_t *rec, sdp_buf_t *buf)
 
 void sdp_attr_replace(sdp_record_t *rec, uint16_t attr, sdp_data_t *d)
 {
-	sdp_data_t *p = sdp_data_get(rec, attr);
+	sdp_data_t *p;
+
+	sdp_record_detach_arena(rec);
+
+	p = sdp_data_get(rec, attr);
 
 	if (p) {
 		rec->attrlist = sdp_list_remove(rec->attrlist, p);
@@ -1036,7 +1217,8 @@ int sdp_uuid_extract(const uint8_t *p, int bufsize, uuid_t *uuid, int *scanned)
 	return 0;
 }
 
-static sdp_data_t *extract_int(const void *p, int bufsize, int *len)
+static sdp_data_t *extract_int(const void *p, int bufsize, int *len,
+						struct sdp_arena **arena)
 {
 	sdp_data_t *d;
 
@@ -1045,7 +1227,7 @@ static sdp_data_t *extract_int(const void *p, int bufsize, int *len)
 		return NULL;
 	}
 
-	d = malloc(sizeof(sdp_data_t));
+	d = arena_alloc(arena, sizeof(sdp_data_t));
 	if (!d)
 		return NULL;
 
@@ -1064,7 +1246,7 @@ static sdp_data_t *extract_int(const void *p, int bufsize, int *len)
 	case SDP_UINT8:
 		if (bufsize < (int) sizeof(uint8_t)) {
 			SDPERR("Unexpected end of packet");
-			free(d);
+			arena_release(arena, d);
 			return NULL;
 		}
 		*len += sizeof(uint8_t);
@@ -1074,7 +1256,7 @@ static sdp_data_t *extract_int(const void *p, int bufsize, int *len)
 	case SDP_UINT16:
 		if (bufsize < (int) sizeof(uint16_t)) {
 			SDPERR("Unexpected end of packet");
-			free(d);
+			arena_release(arena, d);
 			return NULL;
 		}
 		*len += sizeof(uint16_t);
@@ -1084,7 +1266,7 @@ static sdp_data_t *extract_int(const void *p, int bufsize, int *len)
 	case SDP_UINT32:
 		if (bufsize < (int) sizeof(uint32_t)) {
 			SDPERR("Unexpected end of packet");
-			free(d);
+			arena_release(arena, d);
 			return NULL;
 		}
 		*len += sizeof(uint32_t);
@@ -1094,7 +1276,7 @@ static sdp_data_t *extract_int(const void *p, int bufsize, int *len)
 	case SDP_UINT64:
 		if (bufsize < (int) sizeof(uint64_t)) {
 			SDPERR("Unexpected end of packet");
-			free(d);
+			arena_release(arena, d);
 			return NULL;
 		}
 		*len += sizeof(uint64_t);
@@ -1104,23 +1286,23 @@ static sdp_data_t *extract_int(const void *p, int bufsize, int *len)
 	case SDP_UINT128:
 		if (bufsize < (int) sizeof(uint128_t)) {
 			SDPERR("Unexpected end of packet");
-			free(d);
+			arena_release(arena, d);
 			return NULL;
 		}
 		*len += sizeof(uint128_t);
 		ntoh128((uint128_t *) p, &d->val.uint128);
 		break;
 	default:
-		free(d);
+		arena_release(arena, d);
 		d = NULL;
 	}
 	return d;
 }
 
 static sdp_data_t *extract_uuid(const uint8_t *p, int bufsize, int *len,
-							sdp_record_t *rec)
+				sdp_record_t *rec, struct sdp_arena **arena)
 {
-	sdp_data_t *d = malloc(sizeof(sdp_data_t));
+	sdp_data_t *d = arena_alloc(arena, sizeof(sdp_data_t));
 
 	if (!d)
 		return NULL;
@@ -1128,7 +1310,7 @@ static sdp_data_t *extract_uuid(const uint8_t *p, int bufsize, int *len,
 	SDPDBG("Extracting UUID");
 	memset(d, 0, sizeof(sdp_data_t));
 	if (sdp_uuid_extract(p, bufsize, &d->val.uuid, len) < 0) {
-		free(d);
+		arena_release(arena, d);
 		return NULL;
 	}
 	d->dtd = *p;
@@ -1140,7 +1322,8 @@ static sdp_data_t *extract_uuid(const uint8_t *p, int bufsize, int *len,
 /*
  * Extract strings from the PDU (could be service description and similar info)
  */
-static sdp_data_t *extract_str(const void *p, int bufsize, int *len)
+static sdp_data_t *extract_str(const void *p, int bufsize, int *len,
+						struct sdp_arena **arena)
 {
 	char *s;
 	int n;
@@ -1151,7 +1334,7 @@ static sdp_data_t *extract_str(const void *p, int bufsize, int *len)
 		return NULL;
 	}
 
-	d = malloc(sizeof(sdp_data_t));
+	d = arena_alloc(arena, sizeof(sdp_data_t));
 	if (!d)
 		return NULL;
 
@@ -1166,7 +1349,7 @@ static sdp_data_t *extract_str(const void *p, int bufsize, int *len)
 	case SDP_URL_STR8:
 		if (bufsize < (int) sizeof(uint8_t)) {
 			SDPERR("Unexpected end of packet");
-			free(d);
+			arena_release(arena, d);
 			return NULL;
 		}
 		n = *(uint8_t *) p;
@@ -1178,7 +1361,7 @@ static sdp_data_t *extract_str(const void *p, int bufsize, int *len)
 	case SDP_URL_STR16:
 		if (bufsize < (int) sizeof(uint16_t)) {
 			SDPERR("Unexpected end of packet");
-			free(d);
+			arena_release(arena, d);
 			return NULL;
 		}
 		n = ntohs(bt_get_unaligned((uint16_t *) p));
@@ -1188,20 +1371,20 @@ static sdp_data_t *extract_str(const void *p, int bufsize, int *len)
 		break;
 	default:
 		SDPERR("Sizeof text string > UINT16_MAX\n");
-		free(d);
+		arena_release(arena, d);
 		return NULL;
 	}
 
 	if (bufsize < n) {
 		SDPERR("String too long to fit in packet");
-		free(d);
+		arena_release(arena, d);
 		return NULL;
 	}
 
-	s = malloc(n + 1);
+	s = arena_alloc(arena, n + 1);
 	if (!s) {
 		SDPERR("Not enough memory for incoming string");
-		free(d);
+		arena_release(arena, d);
 		return NULL;
 	}
 	memset(s, 0, n + 1);
@@ -1271,11 +1454,11 @@ int sdp_extract_seqtype(const uint8_t *buf, int bufsize, uint8_t *dtdp, int *siz
 }
 
 static sdp_data_t *extract_seq(const void *p, int bufsize, int *len,
-							sdp_record_t *rec)
+				sdp_record_t *rec, struct sdp_arena **arena)
 {
 	int seqlen, n = 0;
 	sdp_data_t *curr, *prev;
-	sdp_data_t *d = malloc(sizeof(sdp_data_t));
+	sdp_data_t *d = arena_alloc(arena, sizeof(sdp_data_t));
 
 	if (!d)
 		return NULL;
@@ -1290,7 +1473,7 @@ static sdp_data_t *extract_seq(const void *p, int bufsize, int *len,
 
 	if (*len > bufsize) {
 		SDPERR("Packet not big enough to hold sequence.");
-		free(d);
+		arena_release(arena, d);
 		return NULL;
 	}
 
@@ -1299,7 +1482,7 @@ static sdp_data_t *extract_seq(const void *p, int bufsize, int *len,
 	prev = NULL;
 	while (n < seqlen) {
 		int attrlen = 0;
-		curr = sdp_extract_attr(p, bufsize, &attrlen, rec);
+		curr = extract_attr(p, bufsize, &attrlen, rec, arena);
 		if (curr == NULL)
 			break;
 
@@ -1319,8 +1502,8 @@ static sdp_data_t *extract_seq(const void *p, int bufsize, int *len,
 	return d;
 }
 
-sdp_data_t *sdp_extract_attr(const uint8_t *p, int bufsize, int *size,
-							sdp_record_t *rec)
+static sdp_data_t *extract_attr(const uint8_t *p, int bufsize, int *size,
+				sdp_record_t *rec, struct sdp_arena **arena)
 {
 	sdp_data_t *elem;
 	int n = 0;
@@ -1347,12 +1530,12 @@ sdp_data_t *sdp_extract_attr(const uint8_t *p, int bufsize, int *size,
 	case SDP_INT32:
 	case SDP_INT64:
 	case SDP_INT128:
-		elem = extract_int(p, bufsize, &n);
+		elem = extract_int(p, bufsize, &n, arena);
 		break;
 	case SDP_UUID16:
 	case SDP_UUID32:
 	case SDP_UUID128:
-		elem = extract_uuid(p, bufsize, &n, rec);
+		elem = extract_uuid(p, bufsize, &n, rec, arena);
 		break;
 	case SDP_TEXT_STR8:
 	case SDP_TEXT_STR16:
@@ -1360,7 +1543,7 @@ sdp_data_t *sdp_extract_attr(const uint8_t *p, int bufsize, int *size,
 	case SDP_URL_STR8:
 	case SDP_URL_STR16:
 	case SDP_URL_STR32:
-		elem = extract_str(p, bufsize, &n);
+		elem = extract_str(p, bufsize, &n, arena);
 		break;
 	case SDP_SEQ8:
 	case SDP_SEQ16:
@@ -1368,7 +1551,7 @@ sdp_data_t *sdp_extract_attr(const uint8_t *p, int bufsize, int *size,
 	case SDP_ALT8:
 	case SDP_ALT16:
 	case SDP_ALT32:
-		elem = extract_seq(p, bufsize, &n, rec);
+		elem = extract_seq(p, bufsize, &n, rec, arena);
 		break;
 	default:
 		SDPERR("Unknown data descriptor : 0x%x terminating\n", dtd);
@@ -1378,6 +1561,12 @@ sdp_data_t *sdp_extract_attr(const uint8_t *p, int bufsize, int *size,
 	return elem;
 }
 
+sdp_data_t *sdp_extract_attr(const uint8_t *p, int bufsize, int *size,
+							sdp_record_t *rec)
+{
+	return extract_attr(p, bufsize, size, rec, NULL);
+}
+
 #ifdef SDP_DEBUG
 static void attr_print_func(void *value, void *userData)
 {
@@ -1401,14 +1590,67 @@ void sdp_print_service_attr(sdp_list_t *svcAttrList)
 }
 #endif
 
-sdp_record_t *sdp_extract_pdu(const uint8_t *buf, int bufsize, int *scanned)
+/*
+ * Attributes normally come in ascending order and are appended after the
+ * last one, anything else is inserted in order. A repeated attribute
+ * replaces the earlier one, as sdp_attr_replace would.
+ */
+static void extract_attr_insert(sdp_record_t *rec, sdp_list_t **last,
+				uint16_t attr, sdp_data_t *data,
+				struct sdp_arena **arena)
+{
+	sdp_list_t **pos = &rec->attrlist, *node;
+
+	data->attrId = attr;
+
+	if (*last && ((sdp_data_t *) (*last)->data)->attrId < attr)
+		pos = &(*last)->next;
+
+	for (; *pos; pos = &(*pos)->next) {
+		sdp_data_t *d = (*pos)->data;
+
+		if (d->attrId == attr) {
+			if (!arena)
+				sdp_data_free(d);
+			(*pos)->data = data;
+			return;
+		}
+
+		if (d->attrId > attr)
+			break;
+	}
+
+	node = arena_alloc(arena, sizeof(sdp_list_t));
+	if (!node) {
+		if (!arena)
+			sdp_data_free(data);
+		return;
+	}
+
+	node->data = data;
+	node->next = *pos;
+	*pos = node;
+
+	if (node->next == NULL)
+		*last = node;
+}
+
+static sdp_record_t *extract_pdu(const uint8_t *buf, int bufsize,
+					int *scanned, int use_arena)
 {
 	int extracted = 0, seqlen = 0;
 	uint8_t dtd;
 	uint16_t attr;
 	sdp_record_t *rec = sdp_record_alloc();
+	struct sdp_arena *head = NULL, **arena;
+	sdp_list_t *last = NULL;
 	const uint8_t *p = buf;
 
+	if (!rec)
+		return NULL;
+
+	arena = use_arena ? &head : NULL;
+
 	*scanned = sdp_extract_seqtype(buf, bufsize, &dtd, &seqlen);
 	p += *scanned;
 	bufsize -= *scanned;
@@ -1432,7 +1674,7 @@ sdp_record_t *sdp_extract_pdu(const uint8_t *buf, int bufsize, int *scanned)
 
 		SDPDBG("DTD of attrId : %d Attr id : 0x%x \n", dtd, attr);
 
-		data = sdp_extract_attr(p + n, bufsize - n, &attrlen, rec);
+		data = extract_attr(p + n, bufsize - n, &attrlen, rec, arena);
 
 		SDPDBG("Attr id : 0x%x attrValueLength : %d\n", attr, attrlen);
 
@@ -1451,7 +1693,7 @@ sdp_record_t *sdp_extract_pdu(const uint8_t *buf, int bufsize, int *scanned)
 		extracted += n;
 		p += n;
 		bufsize -= n;
-		sdp_attr_replace(rec, attr, data);
+		extract_attr_insert(rec, &last, attr, data, arena);
 
 		SDPDBG("Extract PDU, seqLength: %d localExtractedLength: %d",
 							seqlen, extracted);
@@ -1461,9 +1703,24 @@ sdp_record_t *sdp_extract_pdu(const uint8_t *buf, int bufsize, int *scanned)
 	sdp_print_service_attr(rec->attrlist);
 #endif
 	*scanned += seqlen;
+
+	if (head && arena_attach(rec, head) < 0)
+		sdp_record_copy_arena(rec, head);
+
 	return rec;
 }
 
+sdp_record_t *sdp_extract_pdu(const uint8_t *buf, int bufsize, int *scanned)
+{
+	return extract_pdu(buf, bufsize, scanned, 0);
+}
+
+sdp_record_t *sdp_extract_pdu_arena(const uint8_t *buf, int bufsize,
+								int *scanned)
+{
+	return extract_pdu(buf, bufsize, scanned, 1);
+}
+
 static void sdp_copy_pattern(void *value, void *udata)
 {
 	uuid_t *uuid = value;
@@ -1597,6 +1854,30 @@ sdp_record_t *sdp_copy_record(sdp_record_t *rec)
 	return cpy;
 }
 
+/*
+ * Data elements of an arena record can not be freed one by one, so the
+ * attributes are moved to regular allocations before the record is
+ * modified.
+ */
+static void sdp_record_copy_arena(sdp_record_t *rec, struct sdp_arena *arena)
+{
+	sdp_record_t tmp;
+
+	memset(&tmp, 0, sizeof(tmp));
+	sdp_list_foreach(rec->attrlist, sdp_copy_attrlist, &tmp);
+
+	arena_free(arena);
+	rec->attrlist = tmp.attrlist;
+}
+
+static void sdp_record_detach_arena(sdp_record_t *rec)
+{
+	struct sdp_arena *arena = arena_detach(rec);
+
+	if (arena)
+		sdp_record_copy_arena(rec, arena);
+}
+
 #ifdef SDP_DEBUG
 static void print_dataseq(sdp_data_t *p)
 {
@@ -3134,7 +3415,14 @@ sdp_record_t *sdp_record_alloc(void)
  */
 void sdp_record_free(sdp_record_t *rec)
 {
-	sdp_list_free(rec->attrlist, (sdp_free_func_t) sdp_data_free);
+	struct sdp_arena *arena = arena_detach(rec);
+
+	if (arena)
+		arena_free(arena);
+	else
+		sdp_list_free(rec->attrlist,
+					(sdp_free_func_t) sdp_data_free);
+
 	sdp_list_free(rec->pattern, free);
 	free(rec);
 }
@@ -407,6 +407,7 @@ extern "C" {
 #define SDP_INVALID_SYNTAX		0x0003
 #define SDP_INVALID_PDU_SIZE		0x0004
 #define SDP_INVALID_CSTATE		0x0005
+#define SDP_INSUFFICIENT_RESOURCES	0x0006
 
 /*
  * SDP PDU
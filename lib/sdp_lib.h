@@ -600,6 +600,15 @@ int sdp_set_supp_feat(sdp_record_t *rec, const sdp_list_t *sf);
 int sdp_get_supp_feat(const sdp_record_t *rec, sdp_list_t **seqp);
 
 sdp_record_t *sdp_extract_pdu(const uint8_t *pdata, int bufsize, int *scanned);
+/*
+ * Same as sdp_extract_pdu, with all data elements of the record taken from
+ * a few blocks released together by sdp_record_free. Data elements of such
+ * a record must not be freed with sdp_data_free. The blocks are tracked in
+ * a process wide table, so such records must be extracted and freed from
+ * one thread only.
+ */
+sdp_record_t *sdp_extract_pdu_arena(const uint8_t *pdata, int bufsize,
+								int *scanned);
 sdp_record_t *sdp_copy_record(sdp_record_t *rec);
 
 void sdp_data_print(sdp_data_t *data);
@@ -130,6 +130,7 @@ struct btd_adapter {
 	guint auth_idle_id;		/* Ongoing authorization */
 	GSList *connections;		/* Connected devices */
 	GSList *devices;		/* Devices structure pointers */
+	GHashTable *stored_devices;	/* Known devices not loaded yet */
 	GSList *mode_sessions;		/* Request Mode sessions */
 	GSList *disc_sessions;		/* Discovery sessions */
 	guint discov_id;		/* Discovery timer */
@@ -771,6 +772,186 @@ static DBusMessage *set_name(DBusConnection *conn, DBusMessage *msg,
 	return dbus_message_new_method_return(msg);
 }
 
+static void probe_stored_profiles(struct btd_device *device, GSList *uuids)
+{
+	GSList *list;
+
+	list = device_services_from_record(device, uuids);
+	if (list)
+		device_register_services(connection, device, list, ATT_PSM);
+
+	device_probe_drivers(device, uuids);
+}
+
+static struct btd_device *load_stored_device(struct btd_adapter *adapter,
+						const char *address,
+						uint8_t bdaddr_type)
+{
+	char filename[PATH_MAX + 1], srcaddr[18], *str;
+	struct btd_device *device;
+	GSList *uuids;
+
+	DBG("%s", address);
+
+	device = device_create(connection, adapter, address, bdaddr_type);
+	if (!device)
+		return NULL;
+
+	device_set_temporary(device, FALSE);
+	adapter->devices = g_slist_append(adapter->devices, device);
+
+	ba2str(&adapter->bdaddr, srcaddr);
+	create_name(filename, PATH_MAX, STORAGEDIR, srcaddr, "profiles");
+
+	str = textfile_get(filename, address);
+	if (str == NULL)
+		return device;
+
+	uuids = bt_string2list(str);
+	probe_stored_profiles(device, uuids);
+
+	g_slist_free_full(uuids, g_free);
+	free(str);
+
+	return device;
+}
+
+/* With LazyDeviceLoading known devices are only indexed at startup, their
+ * objects are created once looked up or listed */
+static gboolean index_stored_device(struct btd_adapter *adapter,
+					const char *address,
+					uint8_t bdaddr_type)
+{
+	char *key;
+
+	if (!main_opts.lazy_devices)
+		return FALSE;
+
+	if (adapter->stored_devices == NULL)
+		adapter->stored_devices = g_hash_table_new_full(g_str_hash,
+						g_str_equal, g_free, NULL);
+
+	key = g_ascii_strup(address, -1);
+
+	if (g_hash_table_lookup_extended(adapter->stored_devices, key,
+								NULL, NULL))
+		g_free(key);
+	else
+		g_hash_table_insert(adapter->stored_devices, key,
+						GUINT_TO_POINTER(bdaddr_type));
+
+	return TRUE;
+}
+
+static struct btd_device *load_indexed_device(struct btd_adapter *adapter,
+							const char *address)
+{
+	gpointer value;
+	char *key;
+
+	if (adapter->stored_devices == NULL)
+		return NULL;
+
+	key = g_ascii_strup(address, -1);
+
+	if (!g_hash_table_lookup_extended(adapter->stored_devices, key,
+								NULL, &value)) {
+		g_free(key);
+		return NULL;
+	}
+
+	g_hash_table_remove(adapter->stored_devices, key);
+	g_free(key);
+
+	return load_stored_device(adapter, address, GPOINTER_TO_UINT(value));
+}
+
+static char *indexed_device_path(struct btd_adapter *adapter,
+							const char *address)
+{
+	char *path;
+
+	path = g_strdup_printf("%s/dev_%s", adapter->path, address);
+	g_strdelimit(path, ":", '_');
+
+	return path;
+}
+
+static struct btd_device *load_indexed_device_by_path(
+						struct btd_adapter *adapter,
+						const char *path)
+{
+	struct btd_device *device;
+	GHashTableIter iter;
+	gpointer key;
+	char *address = NULL;
+
+	if (adapter->stored_devices == NULL)
+		return NULL;
+
+	g_hash_table_iter_init(&iter, adapter->stored_devices);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		char *dev_path = indexed_device_path(adapter, key);
+		gboolean match = strcasecmp(dev_path, path) == 0;
+
+		g_free(dev_path);
+
+		if (match) {
+			address = g_strdup(key);
+			break;
+		}
+	}
+
+	if (address == NULL)
+		return NULL;
+
+	device = load_indexed_device(adapter, address);
+	g_free(address);
+
+	return device;
+}
+
+static void load_indexed_devices(struct btd_adapter *adapter,
+							gboolean le_only)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	GSList *addresses = NULL, *l;
+
+	if (adapter->stored_devices == NULL)
+		return;
+
+	g_hash_table_iter_init(&iter, adapter->stored_devices);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		if (le_only && GPOINTER_TO_UINT(value) == BDADDR_BREDR)
+			continue;
+
+		addresses = g_slist_prepend(addresses, g_strdup(key));
+	}
+
+	for (l = addresses; l; l = l->next)
+		load_indexed_device(adapter, l->data);
+
+	g_slist_free_full(addresses, g_free);
+}
+
+/* Only devices with an object are listed, indexed ones appear once loaded */
+static char **get_device_paths(struct btd_adapter *adapter, int *count)
+{
+	char **devices;
+	GSList *l;
+	int i = 0;
+
+	devices = g_new0(char *, g_slist_length(adapter->devices) + 1);
+
+	for (l = adapter->devices; l; l = l->next)
+		devices[i++] = (char *) device_get_path(l->data);
+
+	*count = i;
+
+	return devices;
+}
+
 struct btd_device *adapter_find_device(struct btd_adapter *adapter,
 							const char *dest)
 {
@@ -783,7 +964,7 @@ struct btd_device *adapter_find_device(struct btd_adapter *adapter,
 	l = g_slist_find_custom(adapter->devices, dest,
 					(GCompareFunc) device_address_cmp);
 	if (!l)
-		return NULL;
+		return load_indexed_device(adapter, dest);
 
 	device = l->data;
 
@@ -793,19 +974,14 @@ struct btd_device *adapter_find_device(struct btd_adapter *adapter,
 static void adapter_update_devices(struct btd_adapter *adapter)
 {
 	char **devices;
-	int i;
-	GSList *l;
+	int count;
 
 	/* Devices */
-	devices = g_new0(char *, g_slist_length(adapter->devices) + 1);
-	for (i = 0, l = adapter->devices; l; l = l->next, i++) {
-		struct btd_device *dev = l->data;
-		devices[i] = (char *) device_get_path(dev);
-	}
+	devices = get_device_paths(adapter, &count);
 
 	emit_array_property_changed(connection, adapter->path,
 					ADAPTER_INTERFACE, "Devices",
-					DBUS_TYPE_OBJECT_PATH, &devices, i);
+					DBUS_TYPE_OBJECT_PATH, &devices, count);
 	g_free(devices);
 }
 
@@ -1081,7 +1257,6 @@ static DBusMessage *get_properties(DBusConnection *conn,
 	gboolean value;
 	char **devices, **uuids;
 	int i;
-	GSList *l;
 	sdp_list_t *list;
 
 	ba2str(&adapter->bdaddr, srcaddr);
@@ -1138,12 +1313,10 @@ static DBusMessage *get_properties(DBusConnection *conn,
 	dict_append_entry(&dict, "Discovering", DBUS_TYPE_BOOLEAN,
 							&adapter->discovering);
 
-	/* Devices */
-	devices = g_new0(char *, g_slist_length(adapter->devices) + 1);
-	for (i = 0, l = adapter->devices; l; l = l->next, i++) {
-		struct btd_device *dev = l->data;
-		devices[i] = (char *) device_get_path(dev);
-	}
+	/* Devices, listing them creates the indexed ones */
+	load_indexed_devices(adapter, FALSE);
+
+	devices = get_device_paths(adapter, &i);
 	dict_append_array(&dict, "Devices", DBUS_TYPE_OBJECT_PATH,
 								&devices, i);
 	g_free(devices);
@@ -1498,10 +1671,13 @@ static DBusMessage *remove_device(DBusConnection *conn, DBusMessage *msg,
 
 	l = g_slist_find_custom(adapter->devices,
 			path, (GCompareFunc) device_path_cmp);
-	if (!l)
-		return btd_error_does_not_exist(msg);
+	if (l)
+		device = l->data;
+	else
+		device = load_indexed_device_by_path(adapter, path);
 
-	device = l->data;
+	if (!device)
+		return btd_error_does_not_exist(msg);
 
 	if (device_is_temporary(device) || device_is_busy(device))
 		return g_dbus_create_error(msg,
@@ -1526,20 +1702,16 @@ static DBusMessage *find_device(DBusConnection *conn, DBusMessage *msg,
 	struct btd_device *device;
 	DBusMessage *reply;
 	const gchar *address;
-	GSList *l;
 	const gchar *dev_path;
 
 	if (!dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, &address,
 						DBUS_TYPE_INVALID))
 		return btd_error_invalid_args(msg);
 
-	l = g_slist_find_custom(adapter->devices,
-			address, (GCompareFunc) device_address_cmp);
-	if (!l)
+	device = adapter_find_device(adapter, address);
+	if (!device)
 		return btd_error_does_not_exist(msg);
 
-	device = l->data;
-
 	reply = dbus_message_new_method_return(msg);
 	if (!reply)
 		return NULL;
@@ -1675,13 +1847,16 @@ static void create_stored_device_from_profiles(char *key, char *value,
 						void *user_data)
 {
 	struct btd_adapter *adapter = user_data;
-	GSList *list, *uuids = bt_string2list(value);
 	struct btd_device *device;
+	GSList *uuids;
 
 	if (g_slist_find_custom(adapter->devices,
 				key, (GCompareFunc) device_address_cmp))
 		return;
 
+	if (index_stored_device(adapter, key, BDADDR_BREDR))
+		return;
+
 	device = device_create(connection, adapter, key, BDADDR_BREDR);
 	if (!device)
 		return;
@@ -1689,11 +1864,8 @@ static void create_stored_device_from_profiles(char *key, char *value,
 	device_set_temporary(device, FALSE);
 	adapter->devices = g_slist_append(adapter->devices, device);
 
-	list = device_services_from_record(device, uuids);
-	if (list)
-		device_register_services(connection, device, list, ATT_PSM);
-
-	device_probe_drivers(device, uuids);
+	uuids = bt_string2list(value);
+	probe_stored_profiles(device, uuids);
 
 	g_slist_free_full(uuids, g_free);
 }
@@ -1801,6 +1973,9 @@ static void create_stored_device_from_linkkeys(char *key, char *value,
 					(GCompareFunc) device_address_cmp))
 		return;
 
+	if (index_stored_device(adapter, key, BDADDR_BREDR))
+		return;
+
 	device = device_create(connection, adapter, key, BDADDR_BREDR);
 	if (device) {
 		device_set_temporary(device, FALSE);
@@ -1838,6 +2013,9 @@ static void create_stored_device_from_ltks(char *key, char *value,
 	if (g_strcmp0(srcaddr, address) == 0)
 		return;
 
+	if (index_stored_device(adapter, address, bdaddr_type))
+		return;
+
 	device = device_create(connection, adapter, address, bdaddr_type);
 	if (device) {
 		device_set_temporary(device, FALSE);
@@ -1851,8 +2029,8 @@ static void create_stored_device_from_blocked(char *key, char *value,
 	struct btd_adapter *adapter = user_data;
 	struct btd_device *device;
 
-	if (g_slist_find_custom(adapter->devices,
-				key, (GCompareFunc) device_address_cmp))
+	/* Blocked devices are always loaded so they get blocked again */
+	if (adapter_find_device(adapter, key))
 		return;
 
 	device = device_create(connection, adapter, key, BDADDR_BREDR);
@@ -1909,8 +2087,8 @@ static void create_stored_device_from_primaries(char *key, char *value,
 	if (sscanf(key, "%17s#%hhu", address, &bdaddr_type) < 2)
 		return;
 
-	if (g_slist_find_custom(adapter->devices,
-			address, (GCompareFunc) device_address_cmp))
+	/* LE devices are always loaded so their drivers can reconnect */
+	if (adapter_find_device(adapter, address))
 		return;
 
 	device = device_create(connection, adapter, address, bdaddr_type);
@@ -2195,7 +2373,7 @@ static void reply_pending_requests(struct btd_adapter *adapter)
 	if (!adapter)
 		return;
 
-	/* pending bonding */
+	/* pending bonding, devices still in the index have none */
 	for (l = adapter->devices; l; l = l->next) {
 		struct btd_device *device = l->data;
 
@@ -2460,6 +2638,9 @@ void adapter_remove(struct btd_adapter *adapter)
 		device_remove(l->data, FALSE);
 	g_slist_free(adapter->devices);
 
+	if (adapter->stored_devices)
+		g_hash_table_destroy(adapter->stored_devices);
+
 	unload_drivers(adapter);
 	if (main_opts.gatt_enabled)
 		btd_adapter_gatt_server_stop(adapter);
@@ -2803,14 +2984,11 @@ static gboolean pairing_is_legacy(bdaddr_t *local, bdaddr_t *peer,
 
 static char *read_stored_data(bdaddr_t *local, bdaddr_t *peer, const char *file)
 {
-	char local_addr[18], peer_addr[18], filename[PATH_MAX + 1];
+	char peer_addr[18];
 
-	ba2str(local, local_addr);
 	ba2str(peer, peer_addr);
 
-	create_name(filename, PATH_MAX, STORAGEDIR, local_addr, file);
-
-	return textfile_get(filename, peer_addr);
+	return read_entry(local, file, peer_addr);
 }
 
 void adapter_update_found_devices(struct btd_adapter *adapter,
@@ -3309,6 +3487,9 @@ void btd_adapter_enable_auto_connect(struct btd_adapter *adapter)
 	if (adapter->auto_timeout_id)
 		return;
 
+	/* Only LE devices reconnect automatically */
+	load_indexed_devices(adapter, TRUE);
+
 	g_slist_foreach(adapter->devices, set_auto_connect, NULL);
 
 	adapter->auto_timeout_id = g_timeout_add_seconds(main_opts.autoto,
@@ -53,6 +53,11 @@
 
 #include "attrib-server.h"
 
+#define CCC_FLUSH_TIMEOUT 2
+
+/* Values waiting to be sent to a single client */
+#define NOTIFY_QUEUE_MAX 16
+
 static GSList *servers = NULL;
 
 struct gatt_server {
@@ -61,12 +66,41 @@ struct gatt_server {
 	GIOChannel *le_io;
 	uint32_t gatt_sdp_handle;
 	uint32_t gap_sdp_handle;
-	GList *database;
+	GPtrArray *database;	/* Attributes sorted by handle */
+	GHashTable *uuid_index;	/* Attributes sorted by handle, per type */
 	GSList *clients;
+	GSList *ccc_caches;
+	guint ccc_flush_id;
+	struct attrib_notify_stats stats;
 	uint16_t name_handle;
 	uint16_t appearance_handle;
 };
 
+/* Notification PDU shared by all the channels it is queued on */
+struct notify_value {
+	gint refs;
+	uint16_t handle;
+	uint16_t ccc_handle;
+	uint16_t len;
+	uint8_t pdu[0];
+};
+
+/* Tracks a PDU given to GAttrib, channel is NULL once it goes away */
+struct notify_token {
+	struct gatt_channel *channel;
+	uint8_t opcode;
+};
+
+/* Client Characteristic Configuration values of a peer */
+struct ccc_cache {
+	bdaddr_t dst;
+	uint8_t bdaddr_type;
+	GHashTable *values;	/* CCC handle to configuration value */
+	GHashTable *dirty;	/* Handles not written to storage yet */
+	gboolean bonded;	/* Values are written back to storage */
+	unsigned int refs;
+};
+
 struct gatt_channel {
 	bdaddr_t src;
 	bdaddr_t dst;
@@ -78,13 +112,10 @@ struct gatt_channel {
 	struct gatt_server *server;
 	guint cleanup_id;
 	struct btd_device *device;
-};
-
-struct group_elem {
-	uint16_t handle;
-	uint16_t end;
-	uint8_t *data;
-	uint16_t len;
+	struct ccc_cache *ccc;
+	GQueue *notify_queue;
+	struct notify_token *notify_token;
+	guint notify_id;
 };
 
 static bt_uuid_t prim_uuid = {
@@ -95,6 +126,10 @@ static bt_uuid_t snd_uuid = {
 			.type = BT_UUID16,
 			.value.u16 = GATT_SND_SVC_UUID
 };
+static bt_uuid_t chr_uuid = {
+			.type = BT_UUID16,
+			.value.u16 = GATT_CHARAC_UUID
+};
 static bt_uuid_t ccc_uuid = {
 			.type = BT_UUID16,
 			.value.u16 = GATT_CLIENT_CHARAC_CFG_UUID
@@ -108,12 +143,333 @@ static void attrib_free(void *data)
 	g_free(a);
 }
 
+static void ccc_cache_free(struct ccc_cache *cache)
+{
+	g_hash_table_destroy(cache->values);
+	g_hash_table_destroy(cache->dirty);
+	g_free(cache);
+}
+
+static void ccc_cache_flush(struct gatt_server *server,
+						struct ccc_cache *cache)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	bdaddr_t src;
+
+	if (g_hash_table_size(cache->dirty) == 0)
+		return;
+
+	adapter_get_address(server->adapter, &src);
+
+	g_hash_table_iter_init(&iter, cache->dirty);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		uint16_t handle = GPOINTER_TO_UINT(key);
+
+		value = g_hash_table_lookup(cache->values, key);
+		write_device_ccc(&src, &cache->dst, cache->bdaddr_type,
+					handle, GPOINTER_TO_UINT(value));
+	}
+
+	g_hash_table_remove_all(cache->dirty);
+}
+
+static void ccc_flush_all(struct gatt_server *server)
+{
+	GSList *l, *next;
+
+	if (server->ccc_flush_id > 0) {
+		g_source_remove(server->ccc_flush_id);
+		server->ccc_flush_id = 0;
+	}
+
+	for (l = server->ccc_caches; l; l = next) {
+		struct ccc_cache *cache = l->data;
+
+		next = l->next;
+
+		ccc_cache_flush(server, cache);
+
+		/* Values of disconnected peers are loaded again on connect */
+		if (cache->refs > 0)
+			continue;
+
+		server->ccc_caches = g_slist_remove(server->ccc_caches, cache);
+		ccc_cache_free(cache);
+	}
+}
+
+static gboolean ccc_flush_timeout(gpointer user_data)
+{
+	struct gatt_server *server = user_data;
+
+	server->ccc_flush_id = 0;
+	ccc_flush_all(server);
+
+	return FALSE;
+}
+
+static void ccc_load_value(uint16_t handle, uint16_t value, void *user_data)
+{
+	struct ccc_cache *cache = user_data;
+
+	g_hash_table_insert(cache->values, GUINT_TO_POINTER(handle),
+						GUINT_TO_POINTER(value));
+}
+
+static struct ccc_cache *ccc_cache_get(struct gatt_server *server,
+						const bdaddr_t *src,
+						const bdaddr_t *dst,
+						uint8_t bdaddr_type,
+						gboolean bonded)
+{
+	struct ccc_cache *cache;
+	GSList *l;
+
+	for (l = server->ccc_caches; l; l = l->next) {
+		cache = l->data;
+
+		if (bacmp(&cache->dst, dst) == 0 &&
+					cache->bdaddr_type == bdaddr_type)
+			goto done;
+	}
+
+	cache = g_new0(struct ccc_cache, 1);
+	bacpy(&cache->dst, dst);
+	cache->bdaddr_type = bdaddr_type;
+	cache->values = g_hash_table_new(NULL, NULL);
+	cache->dirty = g_hash_table_new(NULL, NULL);
+
+	server->ccc_caches = g_slist_prepend(server->ccc_caches, cache);
+
+	/* Configuration of unbonded peers does not persist */
+	if (bonded)
+		read_device_ccc_all((bdaddr_t *) src, &cache->dst, bdaddr_type,
+							ccc_load_value, cache);
+
+done:
+	if (!bonded) {
+		g_hash_table_remove_all(cache->values);
+		g_hash_table_remove_all(cache->dirty);
+		delete_device_ccc((bdaddr_t *) src, (bdaddr_t *) dst);
+	}
+
+	cache->bonded = bonded;
+	cache->refs++;
+
+	return cache;
+}
+
+static void ccc_cache_put(struct gatt_server *server, struct ccc_cache *cache)
+{
+	if (--cache->refs > 0)
+		return;
+
+	/* Last connection to the peer is gone, write back its values */
+	ccc_flush_all(server);
+}
+
+static gboolean ccc_cache_lookup(struct ccc_cache *cache, uint16_t handle,
+							uint16_t *value)
+{
+	gpointer val;
+
+	if (!g_hash_table_lookup_extended(cache->values,
+					GUINT_TO_POINTER(handle), NULL, &val))
+		return FALSE;
+
+	*value = GPOINTER_TO_UINT(val);
+
+	return TRUE;
+}
+
+static void ccc_cache_set(struct gatt_server *server, struct ccc_cache *cache,
+				uint16_t handle, uint16_t value, gboolean bonded)
+{
+	GHashTableIter iter;
+	gpointer key;
+
+	g_hash_table_insert(cache->values, GUINT_TO_POINTER(handle),
+						GUINT_TO_POINTER(value));
+
+	/* A peer that pairs while connected keeps what it configured so far */
+	if (bonded && !cache->bonded) {
+		cache->bonded = TRUE;
+
+		g_hash_table_iter_init(&iter, cache->values);
+		while (g_hash_table_iter_next(&iter, &key, NULL))
+			g_hash_table_insert(cache->dirty, key, NULL);
+	}
+
+	/* Only kept in memory for unbonded peers, never flushed */
+	if (!cache->bonded)
+		return;
+
+	g_hash_table_insert(cache->dirty, GUINT_TO_POINTER(handle), NULL);
+
+	if (server->ccc_flush_id == 0)
+		server->ccc_flush_id = g_timeout_add_seconds(CCC_FLUSH_TIMEOUT,
+						ccc_flush_timeout, server);
+}
+
+static struct notify_value *notify_value_ref(struct notify_value *value)
+{
+	g_atomic_int_inc(&value->refs);
+
+	return value;
+}
+
+static void notify_value_unref(gpointer data)
+{
+	struct notify_value *value = data;
+
+	if (g_atomic_int_dec_and_test(&value->refs))
+		g_free(value);
+}
+
+static void channel_send_next(struct gatt_channel *channel);
+
+static void notify_token_free(gpointer user_data)
+{
+	struct notify_token *token = user_data;
+	struct gatt_channel *channel = token->channel;
+
+	g_free(token);
+
+	if (channel == NULL || channel->notify_token != token)
+		return;
+
+	channel->notify_token = NULL;
+	channel->notify_id = 0;
+
+	/* The notification was written or the indication completed */
+	channel_send_next(channel);
+}
+
+static void indication_cb(guint8 status, const guint8 *pdu, guint16 len,
+							gpointer user_data)
+{
+	struct notify_token *token = user_data;
+
+	if (token->channel == NULL || status != 0)
+		return;
+
+	token->channel->server->stats.confirmations++;
+}
+
+static void channel_send_next(struct gatt_channel *channel)
+{
+	struct gatt_server *server = channel->server;
+	struct notify_value *value;
+	struct notify_token *token;
+	GAttribResultFunc func;
+	uint16_t cccval, len;
+	uint8_t *buf;
+	int buflen;
+
+	/* Only one PDU per channel is handed to GAttrib, so values still
+	 * in the queue can be coalesced and indications are flow
+	 * controlled by the confirmations */
+	while (channel->notify_token == NULL &&
+			(value = g_queue_pop_head(channel->notify_queue))) {
+		if (!ccc_cache_lookup(channel->ccc, value->ccc_handle,
+								&cccval))
+			cccval = 0;
+
+		token = g_new0(struct notify_token, 1);
+		token->channel = channel;
+
+		if (cccval & GATT_CLIENT_CHARAC_CFG_IND_BIT) {
+			token->opcode = ATT_OP_HANDLE_IND;
+			func = indication_cb;
+		} else if (cccval & GATT_CLIENT_CHARAC_CFG_NOTIF_BIT) {
+			token->opcode = ATT_OP_HANDLE_NOTIFY;
+			func = NULL;
+		} else {
+			/* Unsubscribed while the value was queued */
+			g_free(token);
+			notify_value_unref(value);
+			server->stats.dropped++;
+			continue;
+		}
+
+		buf = g_attrib_get_buffer(channel->attrib, &buflen);
+		len = MIN(value->len, MIN(buflen, channel->mtu));
+		memcpy(buf, value->pdu, len);
+		buf[0] = token->opcode;
+
+		notify_value_unref(value);
+
+		channel->notify_token = token;
+		channel->notify_id = g_attrib_send(channel->attrib, 0,
+						token->opcode, buf, len, func,
+						token, notify_token_free);
+		if (channel->notify_id == 0) {
+			channel->notify_token = NULL;
+			g_free(token);
+			server->stats.dropped++;
+			continue;
+		}
+
+		if (token->opcode == ATT_OP_HANDLE_IND)
+			server->stats.indications++;
+		else
+			server->stats.notifications++;
+	}
+}
+
+static void channel_queue_value(struct gatt_channel *channel,
+						struct notify_value *value)
+{
+	struct gatt_server *server = channel->server;
+	GList *l;
+
+	/* A value still waiting in the queue is superseded by the new one */
+	for (l = channel->notify_queue->head; l; l = l->next) {
+		struct notify_value *old = l->data;
+
+		if (old->handle != value->handle)
+			continue;
+
+		l->data = notify_value_ref(value);
+		notify_value_unref(old);
+		server->stats.coalesced++;
+
+		return;
+	}
+
+	if (g_queue_get_length(channel->notify_queue) >= NOTIFY_QUEUE_MAX) {
+		notify_value_unref(g_queue_pop_head(channel->notify_queue));
+		server->stats.dropped++;
+	}
+
+	g_queue_push_tail(channel->notify_queue, notify_value_ref(value));
+	server->stats.queued++;
+
+	channel_send_next(channel);
+}
+
 static void channel_free(struct gatt_channel *channel)
 {
+	struct notify_value *value;
+
+	if (channel->notify_token) {
+		channel->notify_token->channel = NULL;
+		channel->notify_token = NULL;
+		g_attrib_cancel(channel->attrib, channel->notify_id);
+	}
+
+	while ((value = g_queue_pop_head(channel->notify_queue)))
+		notify_value_unref(value);
+
+	g_queue_free(channel->notify_queue);
 
 	if (channel->cleanup_id)
 		g_source_remove(channel->cleanup_id);
 
+	if (channel->ccc)
+		ccc_cache_put(channel->server, channel->ccc);
+
 	if (channel->device)
 		btd_device_unref(channel->device);
 
@@ -123,7 +479,13 @@ static void channel_free(struct gatt_channel *channel)
 
 static void gatt_server_free(struct gatt_server *server)
 {
-	g_list_free_full(server->database, attrib_free);
+	g_slist_free_full(server->clients, (GDestroyNotify) channel_free);
+	server->clients = NULL;
+
+	ccc_flush_all(server);
+
+	g_ptr_array_free(server->database, TRUE);
+	g_hash_table_destroy(server->uuid_index);
 
 	if (server->l2cap_io != NULL) {
 		g_io_channel_unref(server->l2cap_io);
@@ -135,8 +497,6 @@ static void gatt_server_free(struct gatt_server *server)
 		g_io_channel_shutdown(server->le_io, FALSE, NULL);
 	}
 
-	g_slist_free_full(server->clients, (GDestroyNotify) channel_free);
-
 	if (server->gatt_sdp_handle > 0)
 		remove_record_from_server(server->gatt_sdp_handle);
 
@@ -242,55 +602,247 @@ static sdp_record_t *server_record_new(uuid_t *uuid, uint16_t start, uint16_t en
 	return record;
 }
 
-static int handle_cmp(gconstpointer a, gconstpointer b)
+/* Index of the first attribute with a handle not lower than the given one */
+static guint attrib_lower_bound(GPtrArray *list, uint32_t handle)
 {
-	const struct attribute *attrib = a;
-	uint16_t handle = GPOINTER_TO_UINT(b);
+	guint low = 0, high = list->len;
+
+	while (low < high) {
+		guint mid = (low + high) / 2;
+		struct attribute *a = g_ptr_array_index(list, mid);
 
-	return attrib->handle - handle;
+		if (a->handle < handle)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
 }
 
-static int attribute_cmp(gconstpointer a1, gconstpointer a2)
+static void attrib_list_insert(GPtrArray *list, struct attribute *a)
 {
-	const struct attribute *attrib1 = a1;
-	const struct attribute *attrib2 = a2;
+	guint index = attrib_lower_bound(list, a->handle);
 
-	return attrib1->handle - attrib2->handle;
+	g_ptr_array_add(list, NULL);
+	memmove(&list->pdata[index + 1], &list->pdata[index],
+				(list->len - index - 1) * sizeof(gpointer));
+	list->pdata[index] = a;
 }
 
-static struct attribute *find_svc_range(struct gatt_server *server,
-					uint16_t start, uint16_t *end)
+static void attrib_list_remove(GPtrArray *list, struct attribute *a)
 {
-	struct attribute *attrib;
-	guint h = start;
-	GList *l;
+	guint index = attrib_lower_bound(list, a->handle);
 
-	if (end == NULL)
+	if (index < list->len && g_ptr_array_index(list, index) == a)
+		g_ptr_array_remove_index(list, index);
+}
+
+static guint uuid_hash(gconstpointer key)
+{
+	const bt_uuid_t *uuid = key;
+	const uint8_t *data = (const uint8_t *) &uuid->value.u128;
+	guint i, h = 0;
+
+	for (i = 0; i < sizeof(uuid->value.u128); i++)
+		h = (h << 5) - h + data[i];
+
+	return h;
+}
+
+static gboolean uuid_equal(gconstpointer a, gconstpointer b)
+{
+	return bt_uuid_cmp(a, b) == 0;
+}
+
+static GPtrArray *find_uuid_list(struct gatt_server *server,
+							const bt_uuid_t *uuid)
+{
+	bt_uuid_t key;
+
+	bt_uuid_to_uuid128(uuid, &key);
+
+	return g_hash_table_lookup(server->uuid_index, &key);
+}
+
+static void uuid_index_add(struct gatt_server *server, struct attribute *a)
+{
+	GPtrArray *list;
+	bt_uuid_t *key;
+
+	list = find_uuid_list(server, &a->uuid);
+	if (list == NULL) {
+		key = g_new0(bt_uuid_t, 1);
+		bt_uuid_to_uuid128(&a->uuid, key);
+
+		list = g_ptr_array_new();
+		g_hash_table_insert(server->uuid_index, key, list);
+	}
+
+	attrib_list_insert(list, a);
+}
+
+static void uuid_index_remove(struct gatt_server *server, struct attribute *a)
+{
+	GPtrArray *list;
+	bt_uuid_t key;
+
+	bt_uuid_to_uuid128(&a->uuid, &key);
+
+	list = g_hash_table_lookup(server->uuid_index, &key);
+	if (list == NULL)
+		return;
+
+	attrib_list_remove(list, a);
+
+	if (list->len == 0)
+		g_hash_table_remove(server->uuid_index, &key);
+}
+
+static void uuid_list_free(gpointer data)
+{
+	g_ptr_array_free(data, TRUE);
+}
+
+static struct attribute *find_attribute(struct gatt_server *server,
+							uint16_t handle)
+{
+	struct attribute *a;
+	guint index;
+
+	index = attrib_lower_bound(server->database, handle);
+	if (index == server->database->len)
 		return NULL;
 
-	l = g_list_find_custom(server->database, GUINT_TO_POINTER(h),
-								handle_cmp);
-	if (!l)
+	a = g_ptr_array_index(server->database, index);
+	if (a->handle != handle)
 		return NULL;
 
-	attrib = l->data;
+	return a;
+}
 
-	if (bt_uuid_cmp(&attrib->uuid, &prim_uuid) != 0 &&
-			bt_uuid_cmp(&attrib->uuid, &snd_uuid) != 0)
-		return NULL;
+/* Handle of the first service declaration not lower than the given one */
+static uint32_t next_service(struct gatt_server *server, uint32_t handle)
+{
+	const bt_uuid_t *types[] = { &prim_uuid, &snd_uuid };
+	uint32_t next = 0x10000;
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(types); i++) {
+		GPtrArray *list = find_uuid_list(server, types[i]);
+		struct attribute *a;
+		guint index;
+
+		if (list == NULL)
+			continue;
+
+		index = attrib_lower_bound(list, handle);
+		if (index == list->len)
+			continue;
+
+		a = g_ptr_array_index(list, index);
+		next = MIN(next, a->handle);
+	}
+
+	return next;
+}
 
-	*end = start;
+/* Handle of the last attribute lower than limit, 0 if there is none */
+static uint16_t last_handle_before(struct gatt_server *server, uint32_t limit)
+{
+	struct attribute *a;
+	guint index;
+
+	index = attrib_lower_bound(server->database, limit);
+	if (index == 0)
+		return 0;
 
-	for (l = l->next; l; l = l->next) {
-		struct attribute *a = l->data;
+	a = g_ptr_array_index(server->database, index - 1);
 
-		if (bt_uuid_cmp(&a->uuid, &prim_uuid) == 0 ||
+	return a->handle;
+}
+
+/* Handle of the CCC descriptor of a characteristic value, 0 if none */
+static uint16_t find_ccc_handle(struct gatt_server *server, uint16_t handle)
+{
+	GPtrArray *database = server->database;
+	guint index;
+
+	index = attrib_lower_bound(database, (uint32_t) handle + 1);
+	for (; index < database->len; index++) {
+		struct attribute *a = g_ptr_array_index(database, index);
+
+		/* Descriptors end where the next definition starts */
+		if (bt_uuid_cmp(&a->uuid, &chr_uuid) == 0 ||
+				bt_uuid_cmp(&a->uuid, &prim_uuid) == 0 ||
 				bt_uuid_cmp(&a->uuid, &snd_uuid) == 0)
 			break;
 
-		*end = a->handle;
+		if (bt_uuid_cmp(&a->uuid, &ccc_uuid) == 0)
+			return a->handle;
 	}
 
+	return 0;
+}
+
+static void notify_clients(struct gatt_server *server, struct attribute *a)
+{
+	struct notify_value *value = NULL;
+	uint16_t ccc_handle, cccval;
+	GSList *l;
+
+	if (server->clients == NULL)
+		return;
+
+	ccc_handle = find_ccc_handle(server, a->handle);
+	if (ccc_handle == 0)
+		return;
+
+	for (l = server->clients; l; l = l->next) {
+		struct gatt_channel *channel = l->data;
+
+		if (!ccc_cache_lookup(channel->ccc, ccc_handle, &cccval))
+			continue;
+
+		if (!(cccval & (GATT_CLIENT_CHARAC_CFG_NOTIF_BIT |
+					GATT_CLIENT_CHARAC_CFG_IND_BIT)))
+			continue;
+
+		/* Encoded once, each channel truncates it to its MTU */
+		if (value == NULL) {
+			value = g_malloc0(sizeof(*value) + a->len + 3);
+			value->refs = 1;
+			value->handle = a->handle;
+			value->ccc_handle = ccc_handle;
+			value->len = enc_notification(a->handle, a->data,
+						a->len, value->pdu, a->len + 3);
+		}
+
+		channel_queue_value(channel, value);
+	}
+
+	if (value)
+		notify_value_unref(value);
+}
+
+static struct attribute *find_svc_range(struct gatt_server *server,
+					uint16_t start, uint16_t *end)
+{
+	struct attribute *attrib;
+
+	if (end == NULL)
+		return NULL;
+
+	attrib = find_attribute(server, start);
+	if (attrib == NULL)
+		return NULL;
+
+	if (bt_uuid_cmp(&attrib->uuid, &prim_uuid) != 0 &&
+			bt_uuid_cmp(&attrib->uuid, &snd_uuid) != 0)
+		return NULL;
+
+	*end = last_handle_before(server, next_service(server, start + 1));
+
 	return attrib;
 }
 
@@ -342,12 +894,10 @@ static struct attribute *attrib_db_add_new(struct gatt_server *server,
 				int write_reqs, const uint8_t *value, int len)
 {
 	struct attribute *a;
-	guint h = handle;
 
 	DBG("handle=0x%04x", handle);
 
-	if (g_list_find_custom(server->database, GUINT_TO_POINTER(h),
-								handle_cmp))
+	if (find_attribute(server, handle))
 		return NULL;
 
 	a = g_new0(struct attribute, 1);
@@ -358,8 +908,8 @@ static struct attribute *attrib_db_add_new(struct gatt_server *server,
 	a->read_reqs = read_reqs;
 	a->write_reqs = write_reqs;
 
-	server->database = g_list_insert_sorted(server->database, a,
-								attribute_cmp);
+	attrib_list_insert(server->database, a);
+	uuid_index_add(server, a);
 
 	return a;
 }
@@ -402,14 +952,14 @@ static uint16_t read_by_group(struct gatt_channel *channel, uint16_t start,
 						uint16_t end, bt_uuid_t *uuid,
 						uint8_t *pdu, int len)
 {
-	struct att_data_list *adl;
+	struct gatt_server *server = channel->server;
+	struct att_list_enc enc;
 	struct attribute *a;
-	struct group_elem *cur, *old = NULL;
-	GSList *l, *groups;
-	GList *dl, *database;
-	uint16_t length, last_handle, last_size = 0;
-	uint8_t status;
-	int i;
+	GPtrArray *list;
+	uint16_t group_end;
+	uint32_t next;
+	uint8_t status, *value;
+	guint index;
 
 	if (start > end || start == 0x0000)
 		return enc_error_resp(ATT_OP_READ_BY_GROUP_REQ, start,
@@ -425,33 +975,25 @@ static uint16_t read_by_group(struct gatt_channel *channel, uint16_t start,
 		return enc_error_resp(ATT_OP_READ_BY_GROUP_REQ, 0x0000,
 					ATT_ECODE_UNSUPP_GRP_TYPE, pdu, len);
 
-	last_handle = end;
-	database = channel->server->database;
-	for (dl = database, groups = NULL, cur = NULL; dl; dl = dl->next) {
+	list = find_uuid_list(server, uuid);
+	if (list == NULL || !enc_list_init(&enc, ATT_OP_READ_BY_GROUP_RESP,
+								pdu, len))
+		return enc_error_resp(ATT_OP_READ_BY_GROUP_REQ, start,
+					ATT_ECODE_ATTR_NOT_FOUND, pdu, len);
 
-		a = dl->data;
+	index = attrib_lower_bound(list, start);
+	for (; index < list->len; index++) {
 
-		if (a->handle < start)
-			continue;
+		a = g_ptr_array_index(list, index);
 
 		if (a->handle >= end)
 			break;
 
-		/* The old group ends when a new one starts */
-		if (old && (bt_uuid_cmp(&a->uuid, &prim_uuid) == 0 ||
-				bt_uuid_cmp(&a->uuid, &snd_uuid) == 0)) {
-			old->end = last_handle;
-			old = NULL;
-		}
-
-		if (bt_uuid_cmp(&a->uuid, uuid) != 0) {
-			/* Still inside a service, update its last handle */
-			if (old)
-				last_handle = a->handle;
-			continue;
-		}
+		if (enc.num && (enc.elen != a->len + 4))
+			break;
 
-		if (last_size && (last_size != a->len))
+		/* Nothing is read once the PDU is full */
+		if (enc_list_full(&enc))
 			break;
 
 		status = att_check_reqs(channel, ATT_OP_READ_BY_GROUP_REQ,
@@ -461,88 +1003,63 @@ static uint16_t read_by_group(struct gatt_channel *channel, uint16_t start,
 			status = a->read_cb(a, channel->device,
 							a->cb_user_data);
 
-		if (status) {
-			g_slist_free_full(groups, g_free);
+		if (status)
 			return enc_error_resp(ATT_OP_READ_BY_GROUP_REQ,
 						a->handle, status, pdu, len);
-		}
 
-		cur = g_new0(struct group_elem, 1);
-		cur->handle = a->handle;
-		cur->data = a->data;
-		cur->len = a->len;
+		/* Attribute Grouping Type found, stop once the PDU is full */
+		value = enc_list_add(&enc, a->len + 4);
+		if (value == NULL)
+			break;
 
-		/* Attribute Grouping Type found */
-		groups = g_slist_append(groups, cur);
+		/* The group ends when a new one starts */
+		next = next_service(server, a->handle + 1);
+		group_end = last_handle_before(server, MIN(next, end));
 
-		last_size = a->len;
-		old = cur;
-		last_handle = cur->handle;
+		att_put_u16(a->handle, value);
+		att_put_u16(group_end, &value[2]);
+		/* Attribute Value */
+		memcpy(&value[4], a->data, enc.elen - 4);
 	}
 
-	if (groups == NULL)
+	if (enc.num == 0)
 		return enc_error_resp(ATT_OP_READ_BY_GROUP_REQ, start,
 					ATT_ECODE_ATTR_NOT_FOUND, pdu, len);
 
-	if (dl == NULL)
-		cur->end = a->handle;
-	else
-		cur->end = last_handle;
-
-	length = g_slist_length(groups);
-
-	adl = att_data_list_alloc(length, last_size + 4);
-
-	for (i = 0, l = groups; l; l = l->next, i++) {
-		uint8_t *value;
-
-		cur = l->data;
-
-		value = (void *) adl->data[i];
-
-		att_put_u16(cur->handle, value);
-		att_put_u16(cur->end, &value[2]);
-		/* Attribute Value */
-		memcpy(&value[4], cur->data, cur->len);
-	}
-
-	length = enc_read_by_grp_resp(adl, pdu, len);
-
-	att_data_list_free(adl);
-	g_slist_free_full(groups, g_free);
-
-	return length;
+	return enc_list_finish(&enc);
 }
 
 static uint16_t read_by_type(struct gatt_channel *channel, uint16_t start,
 						uint16_t end, bt_uuid_t *uuid,
 						uint8_t *pdu, int len)
 {
-	struct att_data_list *adl;
-	GSList *l, *types;
-	GList *dl, *database;
+	struct att_list_enc enc;
+	GPtrArray *list;
 	struct attribute *a;
-	uint16_t num, length;
-	uint8_t status;
-	int i;
+	uint8_t status, *value;
+	guint index;
 
 	if (start > end || start == 0x0000)
 		return enc_error_resp(ATT_OP_READ_BY_TYPE_REQ, start,
 					ATT_ECODE_INVALID_HANDLE, pdu, len);
 
-	database = channel->server->database;
-	for (dl = database, length = 0, types = NULL; dl; dl = dl->next) {
+	list = find_uuid_list(channel->server, uuid);
+	if (list == NULL || !enc_list_init(&enc, ATT_OP_READ_BY_TYPE_RESP,
+								pdu, len))
+		return enc_error_resp(ATT_OP_READ_BY_TYPE_REQ, start,
+					ATT_ECODE_ATTR_NOT_FOUND, pdu, len);
 
-		a = dl->data;
+	index = attrib_lower_bound(list, start);
+	for (; index < list->len; index++) {
 
-		if (a->handle < start)
-			continue;
+		a = g_ptr_array_index(list, index);
 
 		if (a->handle > end)
 			break;
 
-		if (bt_uuid_cmp(&a->uuid, uuid)  != 0)
-			continue;
+		/* Nothing is read once the PDU is full */
+		if (enc_list_full(&enc))
+			break;
 
 		status = att_check_reqs(channel, ATT_OP_READ_BY_TYPE_REQ,
 								a->read_reqs);
@@ -551,113 +1068,61 @@ static uint16_t read_by_type(struct gatt_channel *channel, uint16_t start,
 			status = a->read_cb(a, channel->device,
 							a->cb_user_data);
 
-		if (status) {
-			g_slist_free(types);
+		if (status)
 			return enc_error_resp(ATT_OP_READ_BY_TYPE_REQ,
 						a->handle, status, pdu, len);
-		}
 
-		/* All elements must have the same length */
-		if (length == 0)
-			length = a->len;
-		else if (a->len != length)
+		/* All elements must have the same length: handle length
+		 * plus attribute value length */
+		value = enc_list_add(&enc, a->len + 2);
+		if (value == NULL)
 			break;
 
-		types = g_slist_append(types, a);
-	}
-
-	if (types == NULL)
-		return enc_error_resp(ATT_OP_READ_BY_TYPE_REQ, start,
-					ATT_ECODE_ATTR_NOT_FOUND, pdu, len);
-
-	num = g_slist_length(types);
-
-	/* Handle length plus attribute value length */
-	length += 2;
-
-	adl = att_data_list_alloc(num, length);
-
-	for (i = 0, l = types; l; i++, l = l->next) {
-		uint8_t *value;
-
-		a = l->data;
-
-		value = (void *) adl->data[i];
-
 		att_put_u16(a->handle, value);
 
 		/* Attribute Value */
-		memcpy(&value[2], a->data, a->len);
+		memcpy(&value[2], a->data, enc.elen - 2);
 	}
 
-	length = enc_read_by_type_resp(adl, pdu, len);
-
-	att_data_list_free(adl);
-	g_slist_free(types);
+	if (enc.num == 0)
+		return enc_error_resp(ATT_OP_READ_BY_TYPE_REQ, start,
+					ATT_ECODE_ATTR_NOT_FOUND, pdu, len);
 
-	return length;
+	return enc_list_finish(&enc);
 }
 
 static int find_info(struct gatt_channel *channel, uint16_t start, uint16_t end,
 							uint8_t *pdu, int len)
 {
 	struct attribute *a;
-	struct att_data_list *adl;
-	GSList *l, *info;
-	GList *dl, *database;
-	uint8_t format, last_type = BT_UUID_UNSPEC;
-	uint16_t length, num;
-	int i;
+	struct att_list_enc enc;
+	GPtrArray *database;
+	uint8_t *value;
+	guint index;
 
 	if (start > end || start == 0x0000)
 		return enc_error_resp(ATT_OP_FIND_INFO_REQ, start,
 					ATT_ECODE_INVALID_HANDLE, pdu, len);
 
-	database = channel->server->database;
-	for (dl = database, info = NULL, num = 0; dl; dl = dl->next) {
-		a = dl->data;
+	if (!enc_list_init(&enc, ATT_OP_FIND_INFO_RESP, pdu, len))
+		return 0;
 
-		if (a->handle < start)
-			continue;
+	database = channel->server->database;
+	index = attrib_lower_bound(database, start);
+	for (; index < database->len; index++) {
+		a = g_ptr_array_index(database, index);
 
 		if (a->handle > end)
 			break;
 
-		if (last_type == BT_UUID_UNSPEC)
-			last_type = a->uuid.type;
-
-		if (a->uuid.type != last_type)
+		if (a->uuid.type != BT_UUID16 && a->uuid.type != BT_UUID128)
 			break;
 
-		info = g_slist_append(info, a);
-		num++;
-
-		last_type = a->uuid.type;
-	}
-
-	if (info == NULL)
-		return enc_error_resp(ATT_OP_FIND_INFO_REQ, start,
-					ATT_ECODE_ATTR_NOT_FOUND, pdu, len);
-
-	if (last_type == BT_UUID16) {
-		length = 2;
-		format = 0x01;
-	} else if (last_type == BT_UUID128) {
-		length = 16;
-		format = 0x02;
-	} else {
-		g_slist_free(info);
-		return 0;
-	}
-
-	adl = att_data_list_alloc(num, length + 2);
-
-	for (i = 0, l = info; l; i++, l = l->next) {
-		uint8_t *value;
-
-		a = l->data;
-
-		value = (void *) adl->data[i];
+		/* Stops when the UUID format changes or the PDU is full */
+		value = enc_list_add(&enc,
+					a->uuid.type == BT_UUID16 ? 4 : 18);
+		if (value == NULL)
+			break;
 
 		att_put_u16(a->handle, value);
 
@@ -665,71 +1130,74 @@ static int find_info(struct gatt_channel *channel, uint16_t start, uint16_t end,
 		att_put_uuid(a->uuid, &value[2]);
 	}
 
-	length = enc_find_info_resp(format, adl, pdu, len);
-
-	att_data_list_free(adl);
-	g_slist_free(info);
+	if (enc.num == 0)
+		return enc_error_resp(ATT_OP_FIND_INFO_REQ, start,
+					ATT_ECODE_ATTR_NOT_FOUND, pdu, len);
 
-	return length;
+	return enc_list_finish(&enc);
 }
 
 static int find_by_type(struct gatt_channel *channel, uint16_t start,
 			uint16_t end, bt_uuid_t *uuid, const uint8_t *value,
 					int vlen, uint8_t *opdu, int mtu)
 {
+	struct gatt_server *server = channel->server;
+	struct att_list_enc enc;
 	struct attribute *a;
-	struct att_range *range;
-	GSList *matches;
-	GList *dl, *database;
-	int len;
+	GPtrArray *list;
+	uint8_t *range, *last = NULL;
+	uint32_t next;
+	guint index;
 
 	if (start > end || start == 0x0000)
 		return enc_error_resp(ATT_OP_FIND_BY_TYPE_REQ, start,
 					ATT_ECODE_INVALID_HANDLE, opdu, mtu);
 
+	list = find_uuid_list(server, uuid);
+	if (list == NULL || !enc_list_init(&enc, ATT_OP_FIND_BY_TYPE_RESP,
+								opdu, mtu))
+		return enc_error_resp(ATT_OP_FIND_BY_TYPE_REQ, start,
+				ATT_ECODE_ATTR_NOT_FOUND, opdu, mtu);
+
 	/* Searching first requested handle number */
-	database = channel->server->database;
-	for (dl = database, matches = NULL, range = NULL; dl; dl = dl->next) {
-		a = dl->data;
+	index = attrib_lower_bound(list, start);
+	for (; index < list->len; index++) {
+		a = g_ptr_array_index(list, index);
 
-		if (a->handle < start)
+		if (a->handle > end)
+			break;
+
+		/* Attribute value matches? */
+		if (a->len != vlen || memcmp(a->data, value, vlen) != 0)
 			continue;
 
-		if (a->handle > end)
+		/* A new match also ends the previous group */
+		if (last && att_get_u16(&last[2]) >= a->handle)
+			att_put_u16(last_handle_before(server, a->handle),
+								&last[2]);
+
+		range = enc_list_add(&enc, 4);
+		if (range == NULL)
 			break;
 
-		/* Primary service? Attribute value matches? */
-		if ((bt_uuid_cmp(&a->uuid, uuid) == 0) && (a->len == vlen) &&
-					(memcmp(a->data, value, vlen) == 0)) {
-
-			range = g_new0(struct att_range, 1);
-			range->start = a->handle;
-			/* It is allowed to have end group handle the same as
-			 * start handle, for groups with only one attribute. */
-			range->end = a->handle;
-
-			matches = g_slist_append(matches, range);
-		} else if (range) {
-			/* Update the last found handle or reset the pointer
-			 * to track that a new group started: Primary or
-			 * Secondary service. */
-			if (bt_uuid_cmp(&a->uuid, &prim_uuid) == 0 ||
-					bt_uuid_cmp(&a->uuid, &snd_uuid) == 0)
-				range = NULL;
-			else
-				range->end = a->handle;
-		}
+		/* The group ends when a new Primary or Secondary service
+		 * starts. It is allowed to have end group handle the same
+		 * as start handle, for groups with only one attribute. */
+		next = next_service(server, a->handle + 1);
+
+		att_put_u16(a->handle, range);
+		att_put_u16(last_handle_before(server,
+					MIN(next, (uint32_t) end + 1)),
+					&range[2]);
+
+		last = range;
 	}
 
-	if (matches == NULL)
+	if (enc.num == 0)
 		return enc_error_resp(ATT_OP_FIND_BY_TYPE_REQ, start,
 				ATT_ECODE_ATTR_NOT_FOUND, opdu, mtu);
 
-	len = enc_find_by_type_resp(matches, opdu, mtu);
-
-	g_slist_free_full(matches, g_free);
-
-	return len;
+	return enc_list_finish(&enc);
 }
 
 static uint16_t read_value(struct gatt_channel *channel, uint16_t handle,
@@ -737,24 +1205,15 @@ static uint16_t read_value(struct gatt_channel *channel, uint16_t handle,
 {
 	struct attribute *a;
 	uint8_t status;
-	GList *l;
 	uint16_t cccval;
-	uint8_t bdaddr_type;
-	guint h = handle;
 
-	l = g_list_find_custom(channel->server->database,
-					GUINT_TO_POINTER(h), handle_cmp);
-	if (!l)
+	a = find_attribute(channel->server, handle);
+	if (a == NULL)
 		return enc_error_resp(ATT_OP_READ_REQ, handle,
 					ATT_ECODE_INVALID_HANDLE, pdu, len);
 
-	a = l->data;
-
-	bdaddr_type = device_get_addr_type(channel->device);
-
 	if (bt_uuid_cmp(&ccc_uuid, &a->uuid) == 0 &&
-		read_device_ccc(&channel->src, &channel->dst, bdaddr_type,
-							handle, &cccval) == 0) {
+			ccc_cache_lookup(channel->ccc, handle, &cccval)) {
 		uint8_t config[2];
 
 		att_put_u16(cccval, config);
@@ -778,28 +1237,19 @@ static uint16_t read_blob(struct gatt_channel *channel, uint16_t handle,
 {
 	struct attribute *a;
 	uint8_t status;
-	GList *l;
 	uint16_t cccval;
-	uint8_t bdaddr_type;
-	guint h = handle;
 
-	l = g_list_find_custom(channel->server->database,
-					GUINT_TO_POINTER(h), handle_cmp);
-	if (!l)
+	a = find_attribute(channel->server, handle);
+	if (a == NULL)
 		return enc_error_resp(ATT_OP_READ_BLOB_REQ, handle,
 					ATT_ECODE_INVALID_HANDLE, pdu, len);
 
-	a = l->data;
-
 	if (a->len <= offset)
 		return enc_error_resp(ATT_OP_READ_BLOB_REQ, handle,
 					ATT_ECODE_INVALID_OFFSET, pdu, len);
 
-	bdaddr_type = device_get_addr_type(channel->device);
-
 	if (bt_uuid_cmp(&ccc_uuid, &a->uuid) == 0 &&
-		read_device_ccc(&channel->src, &channel->dst, bdaddr_type,
-							handle, &cccval) == 0) {
+			ccc_cache_lookup(channel->ccc, handle, &cccval)) {
 		uint8_t config[2];
 
 		att_put_u16(cccval, config);
@@ -825,17 +1275,12 @@ static uint16_t write_value(struct gatt_channel *channel, uint16_t handle,
 {
 	struct attribute *a;
 	uint8_t status;
-	GList *l;
-	guint h = handle;
 
-	l = g_list_find_custom(channel->server->database,
-					GUINT_TO_POINTER(h), handle_cmp);
-	if (!l)
+	a = find_attribute(channel->server, handle);
+	if (a == NULL)
 		return enc_error_resp(ATT_OP_WRITE_REQ, handle,
 				ATT_ECODE_INVALID_HANDLE, pdu, len);
 
-	a = l->data;
-
 	status = att_check_reqs(channel, ATT_OP_WRITE_REQ, a->write_reqs);
 	if (status)
 		return enc_error_resp(ATT_OP_WRITE_REQ, handle, status, pdu,
@@ -855,10 +1300,10 @@ static uint16_t write_value(struct gatt_channel *channel, uint16_t handle,
 		}
 	} else {
 		uint16_t cccval = att_get_u16(value);
-		uint8_t bdaddr_type = device_get_addr_type(channel->device);
 
-		write_device_ccc(&channel->src, &channel->dst, bdaddr_type,
-								handle, cccval);
+		ccc_cache_set(channel->server, channel->ccc, handle, cccval,
+					channel->device &&
+					device_is_bonded(channel->device));
 	}
 
 	return enc_write_resp(pdu, len);
@@ -885,6 +1330,8 @@ static uint16_t mtu_exchange(struct gatt_channel *channel, uint16_t mtu,
 		return enc_error_resp(ATT_OP_MTU_REQ, 0,
 					ATT_ECODE_UNLIKELY, pdu, len);
 
+	imtu = MIN(imtu, ATT_MAX_MTU);
+
 	channel->mtu = MIN(mtu, imtu);
 	g_attrib_set_mtu(channel->attrib, channel->mtu);
 
@@ -893,6 +1340,13 @@ static uint16_t mtu_exchange(struct gatt_channel *channel, uint16_t mtu,
 
 static void channel_remove(struct gatt_channel *channel)
 {
+	struct attrib_notify_stats *stats = &channel->server->stats;
+
+	DBG("Notify stats: queued %u coalesced %u dropped %u notifications %u "
+			"indications %u confirmations %u", stats->queued,
+			stats->coalesced, stats->dropped, stats->notifications,
+			stats->indications, stats->confirmations);
+
 	channel->server->clients = g_slist_remove(channel->server->clients,
 								channel);
 	channel_free(channel);
@@ -1042,6 +1496,7 @@ guint attrib_channel_attach(GAttrib *attrib)
 	GIOChannel *io;
 	GError *gerr = NULL;
 	char addr[18];
+	uint8_t bdaddr_type;
 	uint16_t cid;
 	guint mtu = 0;
 
@@ -1077,8 +1532,13 @@ guint attrib_channel_attach(GAttrib *attrib)
 	ba2str(&channel->dst, addr);
 
 	device = adapter_find_device(server->adapter, addr);
-	if (device == NULL || device_is_bonded(device) == FALSE)
-		delete_device_ccc(&channel->src, &channel->dst);
+	if (device != NULL)
+		bdaddr_type = device_get_addr_type(device);
+	else
+		bdaddr_type = BDADDR_LE_PUBLIC;
+
+	channel->ccc = ccc_cache_get(server, &channel->src, &channel->dst,
+				bdaddr_type, device && device_is_bonded(device));
 
 	if (cid != ATT_CID) {
 		channel->le = FALSE;
@@ -1088,6 +1548,7 @@ guint attrib_channel_attach(GAttrib *attrib)
 		channel->mtu = ATT_DEFAULT_LE_MTU;
 	}
 
+	channel->notify_queue = g_queue_new();
 	channel->attrib = g_attrib_ref(attrib);
 	channel->id = g_attrib_register(channel->attrib, GATTRIB_ALL_REQS,
 					channel_handler, channel, NULL);
@@ -1247,6 +1708,9 @@ int btd_adapter_gatt_server_start(struct btd_adapter *adapter)
 
 	server = g_new0(struct gatt_server, 1);
 	server->adapter = btd_adapter_ref(adapter);
+	server->database = g_ptr_array_new_with_free_func(attrib_free);
+	server->uuid_index = g_hash_table_new_full(uuid_hash, uuid_equal,
+							g_free, uuid_list_free);
 
 	adapter_get_address(server->adapter, &addr);
 
@@ -1326,18 +1790,18 @@ static uint16_t find_uuid16_avail(struct btd_adapter *adapter, uint16_t nitems)
 	struct gatt_server *server;
 	uint16_t handle;
 	GSList *l;
-	GList *dl;
+	guint i;
 
 	l = g_slist_find_custom(servers, adapter, adapter_cmp);
 	if (l == NULL)
 		return 0;
 
 	server = l->data;
-	if (server->database == NULL)
+	if (server->database->len == 0)
 		return 0x0001;
 
-	for (dl = server->database, handle = 0x0001; dl; dl = dl->next) {
-		struct attribute *a = dl->data;
+	for (i = 0, handle = 0x0001; i < server->database->len; i++) {
+		struct attribute *a = g_ptr_array_index(server->database, i);
 
 		if ((bt_uuid_cmp(&a->uuid, &prim_uuid) == 0 ||
 				bt_uuid_cmp(&a->uuid, &snd_uuid) == 0) &&
@@ -1367,19 +1831,20 @@ static uint16_t find_uuid128_avail(struct btd_adapter *adapter, uint16_t nitems)
 {
 	uint16_t handle = 0, end = 0xffff;
 	struct gatt_server *server;
-	GList *dl;
 	GSList *l;
+	guint i;
 
 	l = g_slist_find_custom(servers, adapter, adapter_cmp);
 	if (l == NULL)
 		return 0;
 
 	server = l->data;
-	if (server->database == NULL)
+	if (server->database->len == 0)
 		return 0xffff - nitems + 1;
 
-	for (dl = g_list_last(server->database); dl; dl = dl->prev) {
-		struct attribute *a = dl->data;
+	for (i = server->database->len; i > 0; i--) {
+		struct attribute *a = g_ptr_array_index(server->database,
+									i - 1);
 
 		if (handle == 0)
 			handle = a->handle;
@@ -1449,8 +1914,6 @@ int attrib_db_update(struct btd_adapter *adapter, uint16_t handle,
 	struct gatt_server *server;
 	struct attribute *a;
 	GSList *l;
-	GList *dl;
-	guint h = handle;
 
 	l = g_slist_find_custom(servers, adapter, adapter_cmp);
 	if (l == NULL)
@@ -1460,13 +1923,10 @@ int attrib_db_update(struct btd_adapter *adapter, uint16_t handle,
 
 	DBG("handle=0x%04x", handle);
 
-	dl = g_list_find_custom(server->database, GUINT_TO_POINTER(h),
-								handle_cmp);
-	if (dl == NULL)
+	a = find_attribute(server, handle);
+	if (a == NULL)
 		return -ENOENT;
 
-	a = dl->data;
-
 	a->data = g_try_realloc(a->data, len);
 	if (len && a->data == NULL)
 		return -ENOMEM;
@@ -1474,8 +1934,11 @@ int attrib_db_update(struct btd_adapter *adapter, uint16_t handle,
 	a->len = len;
 	memcpy(a->data, value, len);
 
-	if (uuid != NULL)
+	if (uuid != NULL && bt_uuid_cmp(&a->uuid, uuid) != 0) {
+		uuid_index_remove(server, a);
 		a->uuid = *uuid;
+		uuid_index_add(server, a);
+	}
 
 	if (attr)
 		*attr = a;
@@ -1483,13 +1946,48 @@ int attrib_db_update(struct btd_adapter *adapter, uint16_t handle,
 	return 0;
 }
 
+/* Updates also come from read callbacks and client writes, so profiles tell
+ * when a value really changed */
+int attrib_db_notify(struct btd_adapter *adapter, uint16_t handle)
+{
+	struct gatt_server *server;
+	struct attribute *a;
+	GSList *l;
+
+	l = g_slist_find_custom(servers, adapter, adapter_cmp);
+	if (l == NULL)
+		return -ENOENT;
+
+	server = l->data;
+
+	a = find_attribute(server, handle);
+	if (a == NULL)
+		return -ENOENT;
+
+	notify_clients(server, a);
+
+	return 0;
+}
+
+int attrib_get_notify_stats(struct btd_adapter *adapter,
+					struct attrib_notify_stats *stats)
+{
+	GSList *l;
+
+	l = g_slist_find_custom(servers, adapter, adapter_cmp);
+	if (l == NULL)
+		return -ENOENT;
+
+	*stats = ((struct gatt_server *) l->data)->stats;
+
+	return 0;
+}
+
 int attrib_db_del(struct btd_adapter *adapter, uint16_t handle)
 {
 	struct gatt_server *server;
 	struct attribute *a;
 	GSList *l;
-	GList *dl;
-	guint h = handle;
 
 	l = g_slist_find_custom(servers, adapter, adapter_cmp);
 	if (l == NULL)
@@ -1499,15 +1997,14 @@ int attrib_db_del(struct btd_adapter *adapter, uint16_t handle)
 
 	DBG("handle=0x%04x", handle);
 
-	dl = g_list_find_custom(server->database, GUINT_TO_POINTER(h),
-								handle_cmp);
-	if (dl == NULL)
+	a = find_attribute(server, handle);
+	if (a == NULL)
 		return -ENOENT;
 
-	a = dl->data;
-	server->database = g_list_remove(server->database, a);
-	g_free(a->data);
-	g_free(a);
+	uuid_index_remove(server, a);
+
+	/* The database owns the attribute and frees it on removal */
+	attrib_list_remove(server->database, a);
 
 	return 0;
 }
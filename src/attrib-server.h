@@ -22,6 +22,15 @@
  *
  */
 
+struct attrib_notify_stats {
+	unsigned int queued;		/* Values queued to a client */
+	unsigned int coalesced;		/* Queued values replaced by newer ones */
+	unsigned int dropped;		/* Values discarded before sending */
+	unsigned int notifications;
+	unsigned int indications;
+	unsigned int confirmations;
+};
+
 uint16_t attrib_db_find_avail(struct btd_adapter *adapter, bt_uuid_t *svc_uuid,
 							uint16_t nitems);
 struct attribute *attrib_db_add(struct btd_adapter *adapter, uint16_t handle,
@@ -31,6 +40,9 @@ int attrib_db_update(struct btd_adapter *adapter, uint16_t handle,
 					bt_uuid_t *uuid, const uint8_t *value,
 					int len, struct attribute **attr);
 int attrib_db_del(struct btd_adapter *adapter, uint16_t handle);
+int attrib_db_notify(struct btd_adapter *adapter, uint16_t handle);
+int attrib_get_notify_stats(struct btd_adapter *adapter,
+					struct attrib_notify_stats *stats);
 int attrib_gap_set(struct btd_adapter *adapter, uint16_t uuid,
 						const uint8_t *value, int len);
 uint32_t attrib_create_sdp(struct btd_adapter *adapter, uint16_t handle,
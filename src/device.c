@@ -59,6 +59,8 @@
 #include "agent.h"
 #include "sdp-xml.h"
 #include "storage.h"
+#include "gatt-cache.h"
+#include "gatt-discovery.h"
 #include "btio.h"
 #include "attrib-server.h"
 #include "attrib/client.h"
@@ -105,7 +107,6 @@ struct browse_req {
 	GSList *profiles_added;
 	GSList *profiles_removed;
 	sdp_list_t *records;
-	int search_uuid;
 	int reconnect_attempt;
 	guint listener_id;
 };
@@ -171,6 +172,11 @@ struct btd_device {
 
 	GIOChannel      *att_io;
 	guint		cleanup_id;
+	guint		sc_id;			/* Service Changed handler */
+	uint16_t	sc_handle;
+	struct gatt_cache *gatt_cache;		/* Loaded for validation */
+
+	struct gatt_discovery_stats *gatt_stats;	/* Last discovery */
 };
 
 static uint16_t uuid_list[] = {
@@ -202,6 +208,16 @@ static void browse_request_free(struct browse_req *req)
 
 static void att_cleanup(struct btd_device *device)
 {
+	if (device->sc_id) {
+		g_attrib_unregister(device->attrib, device->sc_id);
+		device->sc_id = 0;
+	}
+
+	if (device->gatt_cache) {
+		gatt_cache_free(device->gatt_cache);
+		device->gatt_cache = NULL;
+	}
+
 	if (device->attachid) {
 		attrib_channel_detach(device->attrib, device->attachid);
 		device->attachid = 0;
@@ -259,6 +275,7 @@ static void device_free(gpointer user_data)
 	g_slist_free_full(device->services, g_free);
 	g_slist_free_full(device->uuids, g_free);
 	g_slist_free_full(device->primaries, g_free);
+	g_free(device->gatt_stats);
 	g_slist_free_full(device->attios, g_free);
 	g_slist_free_full(device->attios_offline, g_free);
 
@@ -312,6 +329,30 @@ gboolean device_is_trusted(struct btd_device *device)
 	return device->trusted;
 }
 
+static void append_phase_time(DBusMessageIter *dict, const char *key,
+				const struct gatt_discovery_phase *phase)
+{
+	uint32_t usec;
+
+	if (phase->requests == 0)
+		return;
+
+	usec = phase->end - phase->start;
+	dict_append_entry(dict, key, DBUS_TYPE_UINT32, &usec);
+}
+
+static void append_gatt_stats(DBusMessageIter *dict,
+				const struct gatt_discovery_stats *stats)
+{
+	uint32_t usec = stats->total;
+
+	dict_append_entry(dict, "GattDiscoveryTime", DBUS_TYPE_UINT32, &usec);
+
+	append_phase_time(dict, "PrimaryDiscoveryTime", &stats->primary);
+	append_phase_time(dict, "CharacteristicDiscoveryTime", &stats->chars);
+	append_phase_time(dict, "DescriptorDiscoveryTime", &stats->descs);
+}
+
 static DBusMessage *get_properties(DBusConnection *conn,
 				DBusMessage *msg, void *user_data)
 {
@@ -428,6 +469,9 @@ static DBusMessage *get_properties(DBusConnection *conn,
 	dict_append_array(&dict, "Services", DBUS_TYPE_OBJECT_PATH, &str, i);
 	g_free(str);
 
+	if (device->gatt_stats)
+		append_gatt_stats(&dict, device->gatt_stats);
+
 	/* Adapter */
 	ptr = adapter_get_path(adapter);
 	dict_append_entry(&dict, "Adapter", DBUS_TYPE_OBJECT_PATH, &ptr);
@@ -1161,6 +1205,9 @@ static void device_remove_stored(struct btd_device *device)
 	/* key: address only */
 	delete_entry(&src, "profiles", key);
 	delete_entry(&src, "trusts", key);
+	delete_entry(&src, "avdtp", key);
+
+	gatt_cache_remove(&src, &device->bdaddr, device->bdaddr_type);
 
 	if (device_is_bonded(device)) {
 		delete_entry(&src, "linkkeys", key);
@@ -1687,37 +1734,43 @@ cleanup:
 	browse_request_free(req);
 }
 
-static void browse_cb(sdp_list_t *recs, int err, gpointer user_data)
+static void browse_cb(sdp_list_t *recs, int err, gpointer user_data);
+
+static int browse_search(struct browse_req *req)
 {
-	struct browse_req *req = user_data;
 	struct btd_device *device = req->device;
-	struct btd_adapter *adapter = device->adapter;
+	uuid_t uuids[G_N_ELEMENTS(uuid_list)];
+	sdp_list_t *search = NULL;
 	bdaddr_t src;
-	uuid_t uuid;
-
-	/* If we have a valid response and req->search_uuid == 2, then L2CAP
-	 * UUID & PNP searching was successful -- we are done */
-	if (err < 0 || (req->search_uuid == 2 && req->records)) {
-		if (err == -ECONNRESET && req->reconnect_attempt < 1) {
-			req->search_uuid--;
-			req->reconnect_attempt++;
-		} else
-			goto done;
+	int i, err;
+
+	/* The mandatory UUIDs are searched together over one connection */
+	for (i = 0; uuid_list[i]; i++) {
+		sdp_uuid16_create(&uuids[i], uuid_list[i]);
+		search = sdp_list_append(search, &uuids[i]);
 	}
 
-	update_services(req, recs);
+	adapter_get_address(device->adapter, &src);
 
-	adapter_get_address(adapter, &src);
+	err = bt_search_services(&src, &device->bdaddr, search, browse_cb,
+								req, NULL);
 
-	/* Search for mandatory uuids */
-	if (uuid_list[req->search_uuid]) {
-		sdp_uuid16_create(&uuid, uuid_list[req->search_uuid++]);
-		bt_search_service(&src, &device->bdaddr, &uuid,
-						browse_cb, user_data, NULL);
-		return;
+	sdp_list_free(search, NULL);
+
+	return err;
+}
+
+static void browse_cb(sdp_list_t *recs, int err, gpointer user_data)
+{
+	struct browse_req *req = user_data;
+
+	/* A cached SDP connection may have been dropped by the remote */
+	if (err == -ECONNRESET && req->reconnect_attempt < 1) {
+		req->reconnect_attempt++;
+		if (browse_search(req) == 0)
+			return;
 	}
 
-done:
 	search_cb(recs, err, user_data);
 }
 
@@ -1773,6 +1826,267 @@ static void store_services(struct btd_device *device)
 	g_free(str);
 }
 
+static struct gatt_cache *load_gatt_cache(struct btd_device *device)
+{
+	bdaddr_t sba;
+
+	adapter_get_address(device->adapter, &sba);
+
+	return gatt_cache_load(&sba, &device->bdaddr, device->bdaddr_type);
+}
+
+static void store_gatt_cache(struct btd_device *device,
+						struct gatt_cache *cache)
+{
+	bdaddr_t sba;
+
+	adapter_get_address(device->adapter, &sba);
+
+	gatt_cache_store(&sba, &device->bdaddr, device->bdaddr_type, cache);
+}
+
+/* Writes back what validation learned. attrib/client.c may have stored
+ * characteristics since the cache was loaded, so the file is read again
+ * and only the validation fields are replaced. */
+static void store_gatt_validation(struct btd_device *device)
+{
+	struct gatt_cache *cache, *valid = device->gatt_cache;
+
+	cache = load_gatt_cache(device);
+	if (cache == NULL)
+		return;
+
+	cache->sc_handle = valid->sc_handle;
+	cache->sc_ccc = valid->sc_ccc;
+	cache->hash_valid = valid->hash_valid;
+	memcpy(cache->hash, valid->hash, sizeof(cache->hash));
+
+	store_gatt_cache(device, cache);
+	gatt_cache_free(cache);
+}
+
+static void invalidate_gatt_cache(struct btd_device *device,
+							const char *reason)
+{
+	bdaddr_t sba;
+
+	DBG("%s: %s, dropping GATT cache", device->path, reason);
+
+	adapter_get_address(device->adapter, &sba);
+
+	gatt_cache_remove(&sba, &device->bdaddr, device->bdaddr_type);
+
+	if (device->gatt_cache) {
+		gatt_cache_free(device->gatt_cache);
+		device->gatt_cache = NULL;
+	}
+
+	/* Or attrib/client.c would fall back to the old text store */
+	delete_device_characteristics(&sba, &device->bdaddr,
+							device->bdaddr_type);
+
+	/* Service Changed lives in the GATT service, whose handles must not
+	 * change, so later indications on this link are still confirmed */
+	attrib_client_invalidate(device->services);
+}
+
+static void service_changed_ind(const uint8_t *pdu, uint16_t len,
+							gpointer user_data)
+{
+	struct btd_device *device = user_data;
+	uint8_t *opdu;
+	uint16_t olen;
+	int plen;
+
+	/* Handle followed by the affected handle range */
+	if (len < 7 || device->sc_handle == 0)
+		return;
+
+	if (att_get_u16(&pdu[1]) != device->sc_handle)
+		return;
+
+	opdu = g_attrib_get_buffer(device->attrib, &plen);
+	olen = enc_confirmation(opdu, plen);
+	g_attrib_send(device->attrib, 0, opdu[0], opdu, olen, NULL, NULL, NULL);
+
+	invalidate_gatt_cache(device, "Service Changed");
+}
+
+uint16_t device_get_service_changed(struct btd_device *device)
+{
+	return device->sc_handle;
+}
+
+static void service_changed_enabled(guint8 status, const guint8 *pdu,
+					guint16 plen, gpointer user_data)
+{
+	if (status != 0)
+		DBG("Enabling Service Changed indications failed: %s",
+							att_ecode2str(status));
+}
+
+static void enable_service_changed(struct btd_device *device, uint16_t ccc)
+{
+	uint8_t value[2];
+
+	att_put_u16(GATT_CLIENT_CHARAC_CFG_IND_BIT, value);
+
+	gatt_write_char(device->attrib, ccc, value, sizeof(value),
+					service_changed_enabled, device);
+}
+
+static struct gatt_primary *find_primary(struct btd_device *device,
+							const char *uuid)
+{
+	GSList *l;
+
+	for (l = device->primaries; l; l = l->next) {
+		struct gatt_primary *prim = l->data;
+
+		if (strcasecmp(prim->uuid, uuid) == 0)
+			return prim;
+	}
+
+	return NULL;
+}
+
+static void service_changed_ccc_cb(guint8 status, const guint8 *pdu,
+					guint16 plen, gpointer user_data)
+{
+	struct btd_device *device = user_data;
+	struct att_data_list *list;
+	uint16_t ccc = 0;
+	guint8 format;
+	int i;
+
+	if (status != 0 || device->attrib == NULL)
+		return;
+
+	list = dec_find_info_resp(pdu, plen, &format);
+	if (list == NULL)
+		return;
+
+	for (i = 0; format == 0x01 && i < list->num; i++) {
+		uint8_t *info = list->data[i];
+
+		if (att_get_u16(&info[2]) == GATT_CLIENT_CHARAC_CFG_UUID) {
+			ccc = att_get_u16(info);
+			break;
+		}
+	}
+
+	att_data_list_free(list);
+
+	if (ccc == 0)
+		return;
+
+	if (device->gatt_cache != NULL) {
+		device->gatt_cache->sc_handle = device->sc_handle;
+		device->gatt_cache->sc_ccc = ccc;
+		store_gatt_validation(device);
+	}
+
+	enable_service_changed(device, ccc);
+}
+
+static void service_changed_discovered(GSList *chars, guint8 status,
+							gpointer user_data)
+{
+	struct btd_device *device = user_data;
+	struct gatt_primary *prim;
+	struct gatt_char *chr;
+
+	if (status != 0 || chars == NULL || device->attrib == NULL)
+		return;
+
+	prim = find_primary(device, GATT_UUID);
+	if (prim == NULL)
+		return;
+
+	chr = chars->data;
+	device->sc_handle = chr->value_handle;
+
+	if (chr->value_handle < prim->range.end)
+		gatt_find_info(device->attrib, chr->value_handle + 1,
+						prim->range.end,
+						service_changed_ccc_cb, device);
+}
+
+static void database_hash_cb(guint8 status, const guint8 *pdu, guint16 plen,
+							gpointer user_data)
+{
+	struct btd_device *device = user_data;
+	struct att_data_list *list;
+	struct gatt_cache *cache;
+	const uint8_t *hash;
+
+	/* Database Hash is optional, then only Service Changed applies */
+	if (status != 0 || plen < 2 || pdu[1] == 0)
+		return;
+
+	list = dec_read_by_type_resp(pdu, plen);
+	if (list == NULL)
+		return;
+
+	if (list->len != 2 + 16)
+		goto done;
+
+	/* Dropped in the meantime */
+	cache = device->gatt_cache;
+	if (cache == NULL)
+		goto done;
+
+	hash = list->data[0] + 2;
+
+	if (!cache->hash_valid) {
+		memcpy(cache->hash, hash, sizeof(cache->hash));
+		cache->hash_valid = TRUE;
+		store_gatt_validation(device);
+	} else if (memcmp(cache->hash, hash, sizeof(cache->hash)) != 0)
+		invalidate_gatt_cache(device, "Database Hash changed");
+
+done:
+	att_data_list_free(list);
+}
+
+/* Called on every connection to a device with known services. The
+ * Database Hash read is a single request; peers without it notify
+ * changes through Service Changed, which is subscribed to here. */
+static void validate_gatt_cache(struct btd_device *device)
+{
+	struct gatt_cache *cache;
+	struct gatt_primary *prim;
+	bt_uuid_t uuid;
+
+	/* Registered even without a cache, so that Service Changed
+	 * indications are always confirmed here */
+	device->sc_id = g_attrib_register(device->attrib, ATT_OP_HANDLE_IND,
+					service_changed_ind, device, NULL);
+
+	/* Loaded once here, the callbacks below work on this copy */
+	cache = load_gatt_cache(device);
+	device->gatt_cache = cache;
+
+	prim = find_primary(device, GATT_UUID);
+
+	if (cache != NULL && cache->sc_ccc != 0) {
+		device->sc_handle = cache->sc_handle;
+		enable_service_changed(device, cache->sc_ccc);
+	} else if (prim != NULL) {
+		bt_uuid16_create(&uuid, GATT_CHARAC_SERVICE_CHANGED);
+		gatt_discover_char(device->attrib, prim->range.start,
+					prim->range.end, &uuid,
+					service_changed_discovered, device);
+	}
+
+	if (cache == NULL)
+		return;
+
+	bt_uuid16_create(&uuid, GATT_CHARAC_DATABASE_HASH);
+	gatt_read_char_by_uuid(device->attrib, 0x0001, 0xffff, &uuid,
+						database_hash_cb, device);
+}
+
 static void attio_connected(gpointer data, gpointer user_data)
 {
 	struct attio_data *attio = data;
@@ -1924,6 +2238,41 @@ done:
 	browse_request_free(req);
 }
 
+static void gatt_discovered_cb(struct gatt_cache *cache, guint8 status,
+				const struct gatt_discovery_stats *stats,
+				gpointer user_data)
+{
+	struct browse_req *req = user_data;
+	struct btd_device *device = req->device;
+	GSList *l, *services = NULL;
+	uint32_t usec;
+
+	g_free(device->gatt_stats);
+	device->gatt_stats = g_memdup(stats, sizeof(*stats));
+
+	usec = stats->total;
+	emit_property_changed(get_dbus_connection(), device->path,
+				DEVICE_INTERFACE, "GattDiscoveryTime",
+				DBUS_TYPE_UINT32, &usec);
+
+	if (status == 0) {
+		/* Stored before the services are registered so that
+		 * attrib/client.c finds their characteristics */
+		store_gatt_cache(device, cache);
+
+		for (l = cache->services; l; l = l->next) {
+			struct gatt_cache_service *svc = l->data;
+
+			services = g_slist_append(services,
+				g_memdup(&svc->prim, sizeof(svc->prim)));
+		}
+	}
+
+	primary_cb(services, status, req);
+
+	g_slist_free(services);
+}
+
 static void att_connect_cb(GIOChannel *io, GError *gerr, gpointer user_data)
 {
 	struct att_callbacks *attcb = user_data;
@@ -1951,6 +2300,9 @@ static void att_connect_cb(GIOChannel *io, GError *gerr, gpointer user_data)
 	device->cleanup_id = g_io_add_watch(io, G_IO_HUP,
 					attrib_disconnected_cb, device);
 
+	if (device->primaries)
+		validate_gatt_cache(device);
+
 	if (attcb->success)
 		attcb->success(user_data);
 done:
@@ -2057,8 +2409,9 @@ static void att_browse_cb(gpointer user_data)
 	struct att_callbacks *attcb = user_data;
 	struct btd_device *device = attcb->user_data;
 
-	gatt_discover_primary(device->attrib, NULL, primary_cb,
-							device->browse);
+	if (!gatt_discovery_start(device->attrib, gatt_discovered_cb,
+							device->browse))
+		primary_cb(NULL, ATT_ECODE_IO, device->browse);
 }
 
 int device_browse_primary(struct btd_device *device, DBusConnection *conn,
@@ -2088,8 +2441,13 @@ int device_browse_primary(struct btd_device *device, DBusConnection *conn,
 	device->browse = req;
 
 	if (device->attrib) {
-		gatt_discover_primary(device->attrib, NULL, primary_cb, req);
-		goto done;
+		if (gatt_discovery_start(device->attrib, gatt_discovered_cb,
+									req))
+			goto done;
+
+		device->browse = NULL;
+		browse_request_free(req);
+		return -EIO;
 	}
 
 	sec_level = secure ? BT_IO_SEC_HIGH : BT_IO_SEC_LOW;
@@ -2141,9 +2499,7 @@ int device_browse_sdp(struct btd_device *device, DBusConnection *conn,
 {
 	struct btd_adapter *adapter = device->adapter;
 	struct browse_req *req;
-	bt_callback_t cb;
 	bdaddr_t src;
-	uuid_t uuid;
 	int err;
 
 	if (device->browse)
@@ -2153,16 +2509,14 @@ int device_browse_sdp(struct btd_device *device, DBusConnection *conn,
 
 	req = g_new0(struct browse_req, 1);
 	req->device = btd_device_ref(device);
-	if (search) {
-		memcpy(&uuid, search, sizeof(uuid_t));
-		cb = search_cb;
-	} else {
-		sdp_uuid16_create(&uuid, uuid_list[req->search_uuid++]);
+	if (search)
+		err = bt_search_service(&src, &device->bdaddr, search,
+							search_cb, req, NULL);
+	else {
 		init_browse(req, reverse);
-		cb = browse_cb;
+		err = browse_search(req);
 	}
 
-	err = bt_search_service(&src, &device->bdaddr, &uuid, cb, req, NULL);
 	if (err < 0) {
 		browse_request_free(req);
 		return err;
@@ -0,0 +1,483 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2012  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/uuid.h>
+
+#include "log.h"
+#include "textfile.h"
+#include "att.h"
+#include "gattrib.h"
+#include "gatt.h"
+#include "gatt-cache.h"
+
+/* One file per peer, all integers little endian, UUIDs always 128-bit:
+ *
+ * header:	"GATC" version(1) flags(1) sc_handle(2) sc_ccc(2) hash(16)
+ *		num_services(2)
+ * service:	start(2) end(2) uuid(16) flags(1) num_chars(2)
+ * char:	handle(2) value_handle(2) end(2) properties(1) value_len(2)
+ *		uuid(16) num_descs(2)
+ * desc:	handle(2) uuid(16)
+ *
+ * value_len is missing from version 1 files, which are still read. Files
+ * with a different magic or an unknown version are discarded. */
+#define CACHE_MAGIC		"GATC"
+#define CACHE_VERSION		2
+
+#define CACHE_HASH_VALID	0x01
+
+#define SERVICE_CHARS_VALID	0x01
+#define SERVICE_DESCS_VALID	0x02
+
+struct cache_reader {
+	const uint8_t *ptr;
+	gsize left;
+};
+
+static int cache_filename(char *buf, size_t size, const bdaddr_t *src,
+				const bdaddr_t *dst, uint8_t bdaddr_type)
+{
+	char srcaddr[18], dstaddr[18], name[40];
+
+	ba2str(src, srcaddr);
+	ba2str(dst, dstaddr);
+
+	snprintf(name, sizeof(name), "gatt/%s#%hhu", dstaddr, bdaddr_type);
+
+	return create_name(buf, size, STORAGEDIR, srcaddr, name);
+}
+
+static void desc_free(void *data)
+{
+	g_free(data);
+}
+
+static void char_free(void *data)
+{
+	struct gatt_cache_char *chr = data;
+
+	g_slist_free_full(chr->descs, desc_free);
+	g_free(chr);
+}
+
+void gatt_cache_service_clear(struct gatt_cache_service *svc)
+{
+	g_slist_free_full(svc->chars, char_free);
+	svc->chars = NULL;
+	svc->chars_valid = FALSE;
+	svc->descs_valid = FALSE;
+}
+
+static void service_free(void *data)
+{
+	struct gatt_cache_service *svc = data;
+
+	gatt_cache_service_clear(svc);
+	g_free(svc);
+}
+
+struct gatt_cache *gatt_cache_new(void)
+{
+	return g_new0(struct gatt_cache, 1);
+}
+
+void gatt_cache_free(struct gatt_cache *cache)
+{
+	if (cache == NULL)
+		return;
+
+	g_slist_free_full(cache->services, service_free);
+	g_free(cache);
+}
+
+struct gatt_cache_service *gatt_cache_find_service(struct gatt_cache *cache,
+							uint16_t start)
+{
+	GSList *l;
+
+	for (l = cache->services; l; l = l->next) {
+		struct gatt_cache_service *svc = l->data;
+
+		if (svc->prim.range.start == start)
+			return svc;
+	}
+
+	return NULL;
+}
+
+static gint service_cmp(gconstpointer a, gconstpointer b)
+{
+	const struct gatt_cache_service *svc1 = a;
+	const struct gatt_cache_service *svc2 = b;
+
+	return svc1->prim.range.start - svc2->prim.range.start;
+}
+
+struct gatt_cache_service *gatt_cache_add_service(struct gatt_cache *cache,
+					const struct gatt_primary *prim)
+{
+	struct gatt_cache_service *svc;
+
+	svc = gatt_cache_find_service(cache, prim->range.start);
+	if (svc != NULL) {
+		if (svc->prim.range.end != prim->range.end ||
+				strcasecmp(svc->prim.uuid, prim->uuid) != 0)
+			gatt_cache_service_clear(svc);
+
+		memcpy(&svc->prim, prim, sizeof(*prim));
+
+		return svc;
+	}
+
+	svc = g_new0(struct gatt_cache_service, 1);
+	memcpy(&svc->prim, prim, sizeof(*prim));
+
+	cache->services = g_slist_insert_sorted(cache->services, svc,
+								service_cmp);
+
+	return svc;
+}
+
+static void put_u8(GByteArray *buf, uint8_t value)
+{
+	g_byte_array_append(buf, &value, sizeof(value));
+}
+
+static void put_u16(GByteArray *buf, uint16_t value)
+{
+	uint8_t data[2];
+
+	att_put_u16(value, data);
+	g_byte_array_append(buf, data, sizeof(data));
+}
+
+static void put_uuid(GByteArray *buf, const bt_uuid_t *uuid)
+{
+	bt_uuid_t u128;
+	uint8_t data[16];
+
+	bt_uuid_to_uuid128(uuid, &u128);
+	att_put_uuid128(u128, data);
+	g_byte_array_append(buf, data, sizeof(data));
+}
+
+static void put_uuid_str(GByteArray *buf, const char *str)
+{
+	bt_uuid_t uuid;
+
+	if (bt_string_to_uuid(&uuid, str) < 0)
+		memset(&uuid, 0, sizeof(uuid));
+
+	put_uuid(buf, &uuid);
+}
+
+static const uint8_t *get_data(struct cache_reader *r, gsize len)
+{
+	const uint8_t *ptr = r->ptr;
+
+	if (r->left < len)
+		return NULL;
+
+	r->ptr += len;
+	r->left -= len;
+
+	return ptr;
+}
+
+static gboolean get_u8(struct cache_reader *r, uint8_t *value)
+{
+	const uint8_t *ptr = get_data(r, sizeof(*value));
+
+	if (ptr == NULL)
+		return FALSE;
+
+	*value = ptr[0];
+
+	return TRUE;
+}
+
+static gboolean get_u16(struct cache_reader *r, uint16_t *value)
+{
+	const uint8_t *ptr = get_data(r, sizeof(*value));
+
+	if (ptr == NULL)
+		return FALSE;
+
+	*value = att_get_u16(ptr);
+
+	return TRUE;
+}
+
+static gboolean get_uuid(struct cache_reader *r, bt_uuid_t *uuid)
+{
+	const uint8_t *ptr = get_data(r, 16);
+
+	if (ptr == NULL)
+		return FALSE;
+
+	*uuid = att_get_uuid128(ptr);
+
+	return TRUE;
+}
+
+static gboolean get_uuid_str(struct cache_reader *r, char *str, size_t n)
+{
+	bt_uuid_t uuid;
+
+	if (!get_uuid(r, &uuid))
+		return FALSE;
+
+	return bt_uuid_to_string(&uuid, str, n) == 0;
+}
+
+static gboolean parse_char(struct cache_reader *r, uint8_t version,
+					struct gatt_cache_service *svc)
+{
+	struct gatt_cache_char *chr;
+	uint16_t num;
+
+	chr = g_new0(struct gatt_cache_char, 1);
+	svc->chars = g_slist_append(svc->chars, chr);
+
+	if (!get_u16(r, &chr->handle) || !get_u16(r, &chr->value_handle) ||
+			!get_u16(r, &chr->end) ||
+			!get_u8(r, &chr->properties))
+		return FALSE;
+
+	if (version > 1 && !get_u16(r, &chr->value_len))
+		return FALSE;
+
+	if (!get_uuid_str(r, chr->uuid, sizeof(chr->uuid)) ||
+			!get_u16(r, &num))
+		return FALSE;
+
+	while (num-- > 0) {
+		struct gatt_cache_desc *desc;
+
+		desc = g_new0(struct gatt_cache_desc, 1);
+		chr->descs = g_slist_append(chr->descs, desc);
+
+		if (!get_u16(r, &desc->handle) || !get_uuid(r, &desc->uuid))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean parse_service(struct cache_reader *r, uint8_t version,
+						struct gatt_cache *cache)
+{
+	struct gatt_cache_service *svc;
+	uint16_t num;
+	uint8_t flags;
+
+	svc = g_new0(struct gatt_cache_service, 1);
+	cache->services = g_slist_append(cache->services, svc);
+
+	if (!get_u16(r, &svc->prim.range.start) ||
+			!get_u16(r, &svc->prim.range.end) ||
+			!get_uuid_str(r, svc->prim.uuid,
+						sizeof(svc->prim.uuid)) ||
+			!get_u8(r, &flags) || !get_u16(r, &num))
+		return FALSE;
+
+	svc->chars_valid = (flags & SERVICE_CHARS_VALID) ? TRUE : FALSE;
+	svc->descs_valid = (flags & SERVICE_DESCS_VALID) ? TRUE : FALSE;
+
+	while (num-- > 0)
+		if (!parse_char(r, version, svc))
+			return FALSE;
+
+	return TRUE;
+}
+
+static struct gatt_cache *parse_cache(const uint8_t *data, gsize len)
+{
+	struct cache_reader r = { data, len };
+	struct gatt_cache *cache;
+	const uint8_t *ptr;
+	uint16_t num;
+	uint8_t version, flags;
+
+	ptr = get_data(&r, strlen(CACHE_MAGIC));
+	if (ptr == NULL || memcmp(ptr, CACHE_MAGIC, strlen(CACHE_MAGIC)) != 0)
+		return NULL;
+
+	if (!get_u8(&r, &version) || version < 1 || version > CACHE_VERSION)
+		return NULL;
+
+	cache = gatt_cache_new();
+
+	if (!get_u8(&r, &flags) || !get_u16(&r, &cache->sc_handle) ||
+					!get_u16(&r, &cache->sc_ccc))
+		goto fail;
+
+	ptr = get_data(&r, sizeof(cache->hash));
+	if (ptr == NULL)
+		goto fail;
+
+	memcpy(cache->hash, ptr, sizeof(cache->hash));
+	cache->hash_valid = (flags & CACHE_HASH_VALID) ? TRUE : FALSE;
+
+	if (!get_u16(&r, &num))
+		goto fail;
+
+	while (num-- > 0)
+		if (!parse_service(&r, version, cache))
+			goto fail;
+
+	if (r.left == 0)
+		return cache;
+
+fail:
+	gatt_cache_free(cache);
+	return NULL;
+}
+
+struct gatt_cache *gatt_cache_load(const bdaddr_t *src, const bdaddr_t *dst,
+							uint8_t bdaddr_type)
+{
+	struct gatt_cache *cache;
+	char filename[PATH_MAX + 1];
+	gchar *data;
+	gsize len;
+
+	cache_filename(filename, PATH_MAX, src, dst, bdaddr_type);
+
+	if (!g_file_get_contents(filename, &data, &len, NULL))
+		return NULL;
+
+	cache = parse_cache((const uint8_t *) data, len);
+	if (cache == NULL) {
+		DBG("Discarding invalid GATT cache %s", filename);
+		unlink(filename);
+	}
+
+	g_free(data);
+
+	return cache;
+}
+
+static void serialize_char(GByteArray *buf, const struct gatt_cache_char *chr)
+{
+	GSList *l;
+
+	put_u16(buf, chr->handle);
+	put_u16(buf, chr->value_handle);
+	put_u16(buf, chr->end);
+	put_u8(buf, chr->properties);
+	put_u16(buf, chr->value_len);
+	put_uuid_str(buf, chr->uuid);
+	put_u16(buf, g_slist_length(chr->descs));
+
+	for (l = chr->descs; l; l = l->next) {
+		const struct gatt_cache_desc *desc = l->data;
+
+		put_u16(buf, desc->handle);
+		put_uuid(buf, &desc->uuid);
+	}
+}
+
+static void serialize_service(GByteArray *buf,
+				const struct gatt_cache_service *svc)
+{
+	uint8_t flags = 0;
+	GSList *l;
+
+	if (svc->chars_valid)
+		flags |= SERVICE_CHARS_VALID;
+
+	if (svc->descs_valid)
+		flags |= SERVICE_DESCS_VALID;
+
+	put_u16(buf, svc->prim.range.start);
+	put_u16(buf, svc->prim.range.end);
+	put_uuid_str(buf, svc->prim.uuid);
+	put_u8(buf, flags);
+	put_u16(buf, g_slist_length(svc->chars));
+
+	for (l = svc->chars; l; l = l->next)
+		serialize_char(buf, l->data);
+}
+
+int gatt_cache_store(const bdaddr_t *src, const bdaddr_t *dst,
+			uint8_t bdaddr_type, const struct gatt_cache *cache)
+{
+	char filename[PATH_MAX + 1];
+	GByteArray *buf;
+	GError *gerr = NULL;
+	GSList *l;
+	int err = 0;
+
+	cache_filename(filename, PATH_MAX, src, dst, bdaddr_type);
+	create_file(filename, S_IRUSR | S_IWUSR);
+
+	buf = g_byte_array_new();
+
+	g_byte_array_append(buf, (const guint8 *) CACHE_MAGIC,
+							strlen(CACHE_MAGIC));
+	put_u8(buf, CACHE_VERSION);
+	put_u8(buf, cache->hash_valid ? CACHE_HASH_VALID : 0);
+	put_u16(buf, cache->sc_handle);
+	put_u16(buf, cache->sc_ccc);
+	g_byte_array_append(buf, cache->hash, sizeof(cache->hash));
+	put_u16(buf, g_slist_length(cache->services));
+
+	for (l = cache->services; l; l = l->next)
+		serialize_service(buf, l->data);
+
+	/* Replaced atomically, readers never see a partial cache */
+	if (!g_file_set_contents(filename, (const gchar *) buf->data,
+							buf->len, &gerr)) {
+		error("Unable to store GATT cache: %s", gerr->message);
+		g_error_free(gerr);
+		err = -EIO;
+	}
+
+	g_byte_array_free(buf, TRUE);
+
+	return err;
+}
+
+void gatt_cache_remove(const bdaddr_t *src, const bdaddr_t *dst,
+							uint8_t bdaddr_type)
+{
+	char filename[PATH_MAX + 1];
+
+	cache_filename(filename, PATH_MAX, src, dst, bdaddr_type);
+
+	unlink(filename);
+}
@@ -0,0 +1,68 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2012  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+struct gatt_cache_desc {
+	uint16_t handle;
+	bt_uuid_t uuid;
+};
+
+struct gatt_cache_char {
+	char uuid[MAX_LEN_UUID_STR + 1];
+	uint16_t handle;
+	uint16_t value_handle;
+	uint16_t end;
+	uint8_t properties;
+	uint16_t value_len;		/* Length of the last value read */
+	GSList *descs;
+};
+
+struct gatt_cache_service {
+	struct gatt_primary prim;
+	gboolean chars_valid;		/* Characteristics were discovered */
+	gboolean descs_valid;		/* Descriptors were discovered */
+	GSList *chars;
+};
+
+struct gatt_cache {
+	uint16_t sc_handle;		/* Service Changed value handle */
+	uint16_t sc_ccc;		/* and its configuration descriptor */
+	gboolean hash_valid;
+	uint8_t hash[16];		/* Last Database Hash read */
+	GSList *services;
+};
+
+struct gatt_cache *gatt_cache_new(void);
+void gatt_cache_free(struct gatt_cache *cache);
+
+struct gatt_cache *gatt_cache_load(const bdaddr_t *src, const bdaddr_t *dst,
+							uint8_t bdaddr_type);
+int gatt_cache_store(const bdaddr_t *src, const bdaddr_t *dst,
+			uint8_t bdaddr_type, const struct gatt_cache *cache);
+void gatt_cache_remove(const bdaddr_t *src, const bdaddr_t *dst,
+							uint8_t bdaddr_type);
+
+struct gatt_cache_service *gatt_cache_find_service(struct gatt_cache *cache,
+							uint16_t start);
+struct gatt_cache_service *gatt_cache_add_service(struct gatt_cache *cache,
+					const struct gatt_primary *prim);
+void gatt_cache_service_clear(struct gatt_cache_service *svc);
@@ -0,0 +1,561 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2012  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/uuid.h>
+
+#include "log.h"
+#include "att.h"
+#include "gattrib.h"
+#include "gatt.h"
+#include "gatt-cache.h"
+#include "gatt-discovery.h"
+
+/* Discovery of services, characteristics and descriptors with overlapping
+ * phases. Characteristic discovery of a service is queued as soon as its
+ * range is known and descriptor discovery as soon as its characteristics
+ * are, so GAttrib always has the next request ready while the single ATT
+ * request is outstanding. */
+
+struct gatt_discovery {
+	GAttrib *attrib;
+	struct gatt_cache *cache;
+	GSList *services;		/* struct discovery_service */
+	gint refs;
+	unsigned int pending;
+	guint8 status;
+	gint64 started;
+	struct gatt_discovery_stats stats;
+	gatt_discovery_cb cb;
+	gpointer user_data;
+};
+
+struct discovery_service {
+	struct gatt_cache_service *svc;
+	unsigned int pending;		/* Descriptor walks in progress */
+	gboolean failed;
+};
+
+struct discovery_op {
+	struct gatt_discovery *disc;
+	struct discovery_service *ds;
+	struct gatt_cache_char *chr;
+	uint16_t start;
+	uint16_t end;
+};
+
+static struct gatt_discovery *discovery_ref(struct gatt_discovery *disc)
+{
+	disc->refs++;
+
+	return disc;
+}
+
+static void discovery_unref(struct gatt_discovery *disc)
+{
+	if (--disc->refs > 0)
+		return;
+
+	g_slist_free_full(disc->services, g_free);
+	gatt_cache_free(disc->cache);
+	g_attrib_unref(disc->attrib);
+	g_free(disc);
+}
+
+static void op_destroy(gpointer user_data)
+{
+	struct discovery_op *op = user_data;
+
+	discovery_unref(op->disc);
+	g_free(op);
+}
+
+static gint64 discovery_time(struct gatt_discovery *disc)
+{
+	return g_get_monotonic_time() - disc->started;
+}
+
+static gboolean discovery_send(struct gatt_discovery *disc,
+				struct gatt_discovery_phase *phase,
+				const uint8_t *pdu, uint16_t plen,
+				GAttribResultFunc func,
+				struct discovery_op *op)
+{
+	if (plen == 0)
+		goto fail;
+
+	op->disc = discovery_ref(disc);
+
+	if (g_attrib_send(disc->attrib, 0, pdu[0], pdu, plen, func, op,
+						op_destroy) == 0) {
+		discovery_unref(disc);
+		goto fail;
+	}
+
+	if (phase->requests++ == 0)
+		phase->start = discovery_time(disc);
+
+	disc->pending++;
+
+	return TRUE;
+
+fail:
+	g_free(op);
+	return FALSE;
+}
+
+static void discovery_response(struct gatt_discovery *disc,
+					struct gatt_discovery_phase *phase)
+{
+	phase->end = discovery_time(disc);
+	disc->pending--;
+}
+
+static struct gatt_cache_char *find_char(struct gatt_cache_service *svc,
+							const char *uuid)
+{
+	GSList *l;
+
+	for (l = svc->chars; l; l = l->next) {
+		struct gatt_cache_char *chr = l->data;
+
+		if (strcasecmp(chr->uuid, uuid) == 0)
+			return chr;
+	}
+
+	return NULL;
+}
+
+static void find_service_changed(struct gatt_cache *cache)
+{
+	struct gatt_cache_service *svc = NULL;
+	struct gatt_cache_char *chr;
+	bt_uuid_t uuid, ccc;
+	char str[MAX_LEN_UUID_STR + 1];
+	GSList *l;
+
+	for (l = cache->services; l; l = l->next) {
+		struct gatt_cache_service *s = l->data;
+
+		if (strcasecmp(s->prim.uuid, GATT_UUID) == 0) {
+			svc = s;
+			break;
+		}
+	}
+
+	if (svc == NULL)
+		return;
+
+	bt_uuid16_create(&uuid, GATT_CHARAC_SERVICE_CHANGED);
+	bt_uuid_to_uuid128(&uuid, &uuid);
+	bt_uuid_to_string(&uuid, str, sizeof(str));
+
+	chr = find_char(svc, str);
+	if (chr == NULL)
+		return;
+
+	cache->sc_handle = chr->value_handle;
+
+	bt_uuid16_create(&ccc, GATT_CLIENT_CHARAC_CFG_UUID);
+
+	for (l = chr->descs; l; l = l->next) {
+		struct gatt_cache_desc *desc = l->data;
+
+		if (bt_uuid_cmp(&desc->uuid, &ccc) == 0) {
+			cache->sc_ccc = desc->handle;
+			break;
+		}
+	}
+}
+
+static void discovery_check_done(struct gatt_discovery *disc)
+{
+	if (disc->pending > 0 || disc->cb == NULL)
+		return;
+
+	disc->stats.total = discovery_time(disc);
+
+	DBG("GATT discovery took %u ms: primary %u, characteristics %u, "
+			"descriptors %u requests",
+			(unsigned int) (disc->stats.total / 1000),
+			disc->stats.primary.requests,
+			disc->stats.chars.requests,
+			disc->stats.descs.requests);
+
+	if (disc->status == 0)
+		find_service_changed(disc->cache);
+
+	disc->cb(disc->cache, disc->status, &disc->stats, disc->user_data);
+	disc->cb = NULL;
+}
+
+static void descs_cb(guint8 status, const guint8 *pdu, guint16 plen,
+							gpointer user_data);
+
+static gboolean send_descs(struct gatt_discovery *disc,
+				struct discovery_service *ds,
+				struct gatt_cache_char *chr,
+				uint16_t start, uint16_t end)
+{
+	struct discovery_op *op;
+	uint8_t *buf;
+	int buflen;
+
+	op = g_new0(struct discovery_op, 1);
+	op->ds = ds;
+	op->chr = chr;
+	op->start = start;
+	op->end = end;
+
+	buf = g_attrib_get_buffer(disc->attrib, &buflen);
+
+	return discovery_send(disc, &disc->stats.descs, buf,
+				enc_find_info_req(start, end, buf, buflen),
+				descs_cb, op);
+}
+
+static void descs_done(struct discovery_service *ds, gboolean complete)
+{
+	if (!complete)
+		ds->failed = TRUE;
+
+	if (--ds->pending > 0)
+		return;
+
+	ds->svc->descs_valid = !ds->failed;
+}
+
+static void descs_cb(guint8 status, const guint8 *pdu, guint16 plen,
+							gpointer user_data)
+{
+	struct discovery_op *op = user_data;
+	struct gatt_discovery *disc = op->disc;
+	struct gatt_cache_char *chr = op->chr;
+	struct att_data_list *list;
+	gboolean complete = FALSE;
+	uint16_t last = 0;
+	guint8 format;
+	int i;
+
+	discovery_response(disc, &disc->stats.descs);
+
+	if (status != 0) {
+		complete = (status == ATT_ECODE_ATTR_NOT_FOUND);
+		goto done;
+	}
+
+	list = dec_find_info_resp(pdu, plen, &format);
+	if (list == NULL)
+		goto done;
+
+	for (i = 0; i < list->num; i++) {
+		uint8_t *info = list->data[i];
+		struct gatt_cache_desc *desc;
+
+		last = att_get_u16(info);
+		if (last < op->start || last > op->end)
+			continue;
+
+		desc = g_new0(struct gatt_cache_desc, 1);
+		desc->handle = last;
+
+		if (format == 0x01)
+			desc->uuid = att_get_uuid16(&info[2]);
+		else
+			desc->uuid = att_get_uuid128(&info[2]);
+
+		chr->descs = g_slist_append(chr->descs, desc);
+	}
+
+	att_data_list_free(list);
+
+	if (last >= op->start && last < op->end) {
+		if (send_descs(disc, op->ds, chr, last + 1, op->end))
+			goto out;
+	} else
+		complete = TRUE;
+
+done:
+	descs_done(op->ds, complete);
+
+out:
+	discovery_check_done(disc);
+}
+
+/* Descriptors sit between a characteristic value and the next declaration,
+ * characteristics without such a gap need no request at all */
+static void discover_descs(struct gatt_discovery *disc,
+						struct discovery_service *ds)
+{
+	struct gatt_cache_service *svc = ds->svc;
+	GSList *l;
+
+	ds->pending = 1;
+
+	for (l = svc->chars; l; l = l->next) {
+		struct gatt_cache_char *chr = l->data;
+		uint16_t end;
+
+		end = l->next ? chr->end - 1 : chr->end;
+		if (chr->value_handle >= end)
+			continue;
+
+		ds->pending++;
+
+		if (!send_descs(disc, ds, chr, chr->value_handle + 1, end))
+			descs_done(ds, FALSE);
+	}
+
+	descs_done(ds, TRUE);
+}
+
+static void chars_cb(guint8 status, const guint8 *pdu, guint16 plen,
+							gpointer user_data);
+
+static gboolean send_chars(struct gatt_discovery *disc,
+				struct discovery_service *ds, uint16_t start)
+{
+	struct discovery_op *op;
+	bt_uuid_t uuid;
+	uint8_t *buf;
+	int buflen;
+
+	op = g_new0(struct discovery_op, 1);
+	op->ds = ds;
+	op->start = start;
+	op->end = ds->svc->prim.range.end;
+
+	bt_uuid16_create(&uuid, GATT_CHARAC_UUID);
+	buf = g_attrib_get_buffer(disc->attrib, &buflen);
+
+	return discovery_send(disc, &disc->stats.chars, buf,
+			enc_read_by_type_req(start, op->end, &uuid, buf,
+								buflen),
+			chars_cb, op);
+}
+
+static void chars_cb(guint8 status, const guint8 *pdu, guint16 plen,
+							gpointer user_data)
+{
+	struct discovery_op *op = user_data;
+	struct gatt_discovery *disc = op->disc;
+	struct discovery_service *ds = op->ds;
+	struct gatt_cache_service *svc = ds->svc;
+	struct att_data_list *list;
+	uint16_t last = 0;
+	GSList *l;
+	int i;
+
+	discovery_response(disc, &disc->stats.chars);
+
+	if (status == ATT_ECODE_ATTR_NOT_FOUND)
+		goto complete;
+
+	if (status != 0 || plen < 2 || pdu[1] == 0)
+		goto fail;
+
+	list = dec_read_by_type_resp(pdu, plen);
+	if (list == NULL)
+		goto fail;
+
+	if (list->len != 7 && list->len != 21) {
+		att_data_list_free(list);
+		goto fail;
+	}
+
+	for (i = 0; i < list->num; i++) {
+		uint8_t *value = list->data[i];
+		struct gatt_cache_char *chr;
+		bt_uuid_t uuid;
+
+		last = att_get_u16(value);
+
+		if (list->len == 7) {
+			bt_uuid_t uuid16 = att_get_uuid16(&value[5]);
+			bt_uuid_to_uuid128(&uuid16, &uuid);
+		} else
+			uuid = att_get_uuid128(&value[5]);
+
+		/* Same convention as attrib/client.c, a characteristic ends
+		 * at the next declaration */
+		l = g_slist_last(svc->chars);
+		if (l != NULL) {
+			struct gatt_cache_char *prev = l->data;
+			prev->end = last;
+		}
+
+		chr = g_new0(struct gatt_cache_char, 1);
+		chr->handle = last;
+		chr->properties = value[2];
+		chr->value_handle = att_get_u16(&value[3]);
+		chr->end = svc->prim.range.end;
+		bt_uuid_to_string(&uuid, chr->uuid, sizeof(chr->uuid));
+
+		svc->chars = g_slist_append(svc->chars, chr);
+	}
+
+	att_data_list_free(list);
+
+	if (last >= op->start && last < op->end) {
+		if (send_chars(disc, ds, last + 1))
+			goto done;
+
+		goto fail;
+	}
+
+complete:
+	svc->chars_valid = TRUE;
+	discover_descs(disc, ds);
+	goto done;
+
+fail:
+	/* Left for attrib/client.c to discover on demand */
+	gatt_cache_service_clear(svc);
+
+done:
+	discovery_check_done(disc);
+}
+
+static void primary_cb(guint8 status, const guint8 *pdu, guint16 plen,
+							gpointer user_data);
+
+static gboolean send_primary(struct gatt_discovery *disc, uint16_t start)
+{
+	struct discovery_op *op;
+	bt_uuid_t uuid;
+	uint8_t *buf;
+	int buflen;
+
+	op = g_new0(struct discovery_op, 1);
+	op->start = start;
+	op->end = 0xffff;
+
+	bt_uuid16_create(&uuid, GATT_PRIM_SVC_UUID);
+	buf = g_attrib_get_buffer(disc->attrib, &buflen);
+
+	return discovery_send(disc, &disc->stats.primary, buf,
+			enc_read_by_grp_req(start, 0xffff, &uuid, buf, buflen),
+			primary_cb, op);
+}
+
+static void primary_cb(guint8 status, const guint8 *pdu, guint16 plen,
+							gpointer user_data)
+{
+	struct discovery_op *op = user_data;
+	struct gatt_discovery *disc = op->disc;
+	struct att_data_list *list;
+	GSList *found = NULL, *l;
+	uint16_t end = 0;
+	int i;
+
+	discovery_response(disc, &disc->stats.primary);
+
+	if (status != 0) {
+		if (status != ATT_ECODE_ATTR_NOT_FOUND)
+			disc->status = status;
+		goto done;
+	}
+
+	list = dec_read_by_grp_resp(pdu, plen);
+	if (list == NULL) {
+		disc->status = ATT_ECODE_IO;
+		goto done;
+	}
+
+	for (i = 0; i < list->num; i++) {
+		const uint8_t *data = list->data[i];
+		struct discovery_service *ds;
+		struct gatt_primary prim;
+		bt_uuid_t uuid;
+
+		if (list->len == 6) {
+			bt_uuid_t uuid16 = att_get_uuid16(&data[4]);
+			bt_uuid_to_uuid128(&uuid16, &uuid);
+		} else if (list->len == 20) {
+			uuid = att_get_uuid128(&data[4]);
+		} else {
+			/* Skipping invalid data */
+			continue;
+		}
+
+		memset(&prim, 0, sizeof(prim));
+		prim.range.start = att_get_u16(&data[0]);
+		prim.range.end = att_get_u16(&data[2]);
+		bt_uuid_to_string(&uuid, prim.uuid, sizeof(prim.uuid));
+
+		end = prim.range.end;
+
+		ds = g_new0(struct discovery_service, 1);
+		ds->svc = gatt_cache_add_service(disc->cache, &prim);
+		disc->services = g_slist_append(disc->services, ds);
+
+		found = g_slist_append(found, ds);
+	}
+
+	att_data_list_free(list);
+
+	/* Keep primary discovery ahead, characteristic discovery of the
+	 * services found so far is queued right behind it */
+	if (end >= op->start && end < 0xffff && !send_primary(disc, end + 1))
+		disc->status = ATT_ECODE_IO;
+
+	for (l = found; l; l = l->next) {
+		struct discovery_service *ds = l->data;
+
+		if (!send_chars(disc, ds, ds->svc->prim.range.start))
+			gatt_cache_service_clear(ds->svc);
+	}
+
+	g_slist_free(found);
+
+done:
+	discovery_check_done(disc);
+}
+
+gboolean gatt_discovery_start(GAttrib *attrib, gatt_discovery_cb func,
+							gpointer user_data)
+{
+	struct gatt_discovery *disc;
+	gboolean ret;
+
+	disc = g_new0(struct gatt_discovery, 1);
+	disc->attrib = g_attrib_ref(attrib);
+	disc->cache = gatt_cache_new();
+	disc->cb = func;
+	disc->user_data = user_data;
+	disc->started = g_get_monotonic_time();
+
+	discovery_ref(disc);
+	ret = send_primary(disc, 0x0001);
+	discovery_unref(disc);
+
+	return ret;
+}
@@ -0,0 +1,43 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2012  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+struct gatt_discovery_phase {
+	gint64 start;		/* First request, usec after discovery start */
+	gint64 end;		/* Last response, usec after discovery start */
+	unsigned int requests;
+};
+
+struct gatt_discovery_stats {
+	struct gatt_discovery_phase primary;
+	struct gatt_discovery_phase chars;
+	struct gatt_discovery_phase descs;
+	gint64 total;
+};
+
+/* cache is owned by the discovery and only valid during the callback */
+typedef void (*gatt_discovery_cb) (struct gatt_cache *cache, guint8 status,
+				const struct gatt_discovery_stats *stats,
+				gpointer user_data);
+
+gboolean gatt_discovery_start(GAttrib *attrib, gatt_discovery_cb func,
+							gpointer user_data);
@@ -32,6 +32,7 @@ struct main_opts {
 	uint16_t	autoto;
 	uint32_t	discovto;
 	uint32_t	pairto;
+	guint		max_searches;
 	uint16_t	link_mode;
 	uint16_t	link_policy;
 	gboolean	remember_powered;
@@ -39,6 +40,8 @@ struct main_opts {
 	gboolean	name_resolv;
 	gboolean	debug_keys;
 	gboolean	gatt_enabled;
+	gboolean	log_storage;
+	gboolean	lazy_devices;
 
 	uint8_t		mode;
 
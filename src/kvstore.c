@@ -0,0 +1,725 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2012  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include "log.h"
+#include "textfile.h"
+#include "kvstore.h"
+
+/* Every textfile is backed by a log next to it, "<textfile>.log", holding
+ * all its keys in memory once opened. All integers are little endian:
+ *
+ * header:	"BTKV" version(1)
+ * record:	type(1) key_len(2) value_len(4) key value
+ *
+ * Records are appended in batches, each one closed by a commit record
+ * whose value is the CRC-32 of the batch records. Only complete batches
+ * with a matching checksum are applied when loading, anything after the
+ * last valid commit is cut off. Logs are rewritten once most of their
+ * records are stale. */
+#define KV_MAGIC		"BTKV"
+#define KV_VERSION		1
+#define KV_HEADER_SIZE		5
+#define KV_RECORD_SIZE		7
+
+#define KV_PUT			0x01
+#define KV_DEL			0x02
+#define KV_COMMIT		0x03
+
+#define KV_COMPACT_MIN		(16 * 1024)
+
+struct kv_file {
+	char *pathname;
+	char *logname;
+	int fd;
+	GHashTable *table;
+	off_t size;		/* Bytes in the log */
+	gsize live;		/* Bytes of a freshly compacted log */
+	GByteArray *batch;
+};
+
+static GHashTable *files = NULL;
+static GSList *dirty = NULL;
+static guint flush_id = 0;
+
+static uint32_t crc32(uint32_t crc, const uint8_t *data, gsize len)
+{
+	int i;
+
+	crc = ~crc;
+
+	while (len--) {
+		crc ^= *data++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+
+	return ~crc;
+}
+
+static gsize record_size(const char *key, const char *value)
+{
+	return KV_RECORD_SIZE + strlen(key) + (value ? strlen(value) : 0);
+}
+
+static void put_record(GByteArray *buf, uint8_t type, const char *key,
+							const char *value)
+{
+	uint16_t key_len = key ? strlen(key) : 0;
+	uint32_t value_len = value ? strlen(value) : 0;
+	uint8_t hdr[KV_RECORD_SIZE];
+
+	hdr[0] = type;
+	hdr[1] = key_len;
+	hdr[2] = key_len >> 8;
+	hdr[3] = value_len;
+	hdr[4] = value_len >> 8;
+	hdr[5] = value_len >> 16;
+	hdr[6] = value_len >> 24;
+
+	g_byte_array_append(buf, hdr, sizeof(hdr));
+	g_byte_array_append(buf, (const guint8 *) key, key_len);
+	g_byte_array_append(buf, (const guint8 *) value, value_len);
+}
+
+static void put_commit(GByteArray *buf, guint start)
+{
+	uint32_t crc = crc32(0, buf->data + start, buf->len - start);
+	uint8_t commit[KV_RECORD_SIZE + 4] = { KV_COMMIT, 0, 0, 4, 0, 0, 0,
+						crc, crc >> 8, crc >> 16,
+						crc >> 24 };
+
+	g_byte_array_append(buf, commit, sizeof(commit));
+}
+
+static gboolean get_record(const uint8_t *data, gsize len, uint8_t *type,
+				const uint8_t **key, uint16_t *key_len,
+				const uint8_t **value, uint32_t *value_len)
+{
+	if (len < KV_RECORD_SIZE)
+		return FALSE;
+
+	*type = data[0];
+	*key_len = data[1] | data[2] << 8;
+	*value_len = data[3] | data[4] << 8 | data[5] << 16 |
+						(uint32_t) data[6] << 24;
+
+	if (len - KV_RECORD_SIZE < (gsize) *key_len + *value_len)
+		return FALSE;
+
+	*key = data + KV_RECORD_SIZE;
+	*value = *key + *key_len;
+
+	return TRUE;
+}
+
+static void table_put(struct kv_file *file, char *key, char *value)
+{
+	const char *old = g_hash_table_lookup(file->table, key);
+
+	if (old)
+		file->live -= record_size(key, old);
+
+	file->live += record_size(key, value);
+
+	g_hash_table_replace(file->table, key, value);
+}
+
+static void table_del(struct kv_file *file, const char *key)
+{
+	const char *old = g_hash_table_lookup(file->table, key);
+
+	if (old == NULL)
+		return;
+
+	file->live -= record_size(key, old);
+
+	g_hash_table_remove(file->table, key);
+}
+
+static void apply_batch(struct kv_file *file, const uint8_t *data, gsize len)
+{
+	while (len > 0) {
+		const uint8_t *key, *value;
+		uint16_t key_len;
+		uint32_t value_len;
+		uint8_t type;
+		char *k;
+
+		get_record(data, len, &type, &key, &key_len, &value,
+								&value_len);
+
+		k = g_strndup((const char *) key, key_len);
+
+		if (type == KV_PUT)
+			table_put(file, k, g_strndup((const char *) value,
+								value_len));
+		else {
+			table_del(file, k);
+			g_free(k);
+		}
+
+		data += KV_RECORD_SIZE + key_len + value_len;
+		len -= KV_RECORD_SIZE + key_len + value_len;
+	}
+}
+
+/* Returns the length of the valid part of the log */
+static gsize parse_log(struct kv_file *file, const uint8_t *data, gsize len)
+{
+	gsize off, batch;
+
+	if (len < KV_HEADER_SIZE || memcmp(data, KV_MAGIC, 4) ||
+						data[4] != KV_VERSION)
+		return 0;
+
+	off = batch = KV_HEADER_SIZE;
+
+	while (off < len) {
+		const uint8_t *key, *value;
+		uint16_t key_len;
+		uint32_t value_len, crc;
+		uint8_t type;
+
+		if (!get_record(data + off, len - off, &type, &key, &key_len,
+							&value, &value_len))
+			break;
+
+		if (type == KV_COMMIT) {
+			if (key_len != 0 || value_len != 4)
+				break;
+
+			crc = value[0] | value[1] << 8 | value[2] << 16 |
+						(uint32_t) value[3] << 24;
+			if (crc != crc32(0, data + batch, off - batch))
+				break;
+
+			apply_batch(file, data + batch, off - batch);
+
+			off += KV_RECORD_SIZE + 4;
+			batch = off;
+			continue;
+		}
+
+		if (type != KV_PUT && type != KV_DEL)
+			break;
+
+		off += KV_RECORD_SIZE + key_len + value_len;
+	}
+
+	return batch;
+}
+
+/* Loads "key value" lines of a textfile */
+static void import_textfile(struct kv_file *file)
+{
+	gchar *data, **lines;
+	gsize len;
+	int i;
+
+	if (!g_file_get_contents(file->pathname, &data, &len, NULL))
+		return;
+
+	if (memchr(data, '\0', len)) {
+		DBG("Not importing binary file %s", file->pathname);
+		g_free(data);
+		return;
+	}
+
+	lines = g_strsplit_set(data, "\r\n", -1);
+
+	for (i = 0; lines[i]; i++) {
+		char *sep = strchr(lines[i], ' ');
+
+		if (sep == NULL)
+			continue;
+
+		table_put(file, g_strndup(lines[i], sep - lines[i]),
+							g_strdup(sep + 1));
+	}
+
+	g_strfreev(lines);
+	g_free(data);
+}
+
+static int write_all(int fd, const uint8_t *data, gsize len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, data, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		data += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* Makes a rename() in the directory of pathname durable */
+static int sync_dir(const char *pathname)
+{
+	char *dirname;
+	int fd, err = 0;
+
+	dirname = g_path_get_dirname(pathname);
+
+	fd = open(dirname, O_RDONLY | O_DIRECTORY);
+	g_free(dirname);
+
+	if (fd < 0)
+		return -errno;
+
+	if (fsync(fd) < 0)
+		err = -errno;
+
+	close(fd);
+
+	return err;
+}
+
+/* Replaces the log with a single batch holding every live key */
+static int write_snapshot(struct kv_file *file)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	GByteArray *buf;
+	guint8 version = KV_VERSION;
+	char *tmpname;
+	int fd, err, ret;
+
+	buf = g_byte_array_sized_new(KV_HEADER_SIZE + file->live +
+							KV_RECORD_SIZE + 4);
+	g_byte_array_append(buf, (const guint8 *) KV_MAGIC, 4);
+	g_byte_array_append(buf, &version, 1);
+
+	g_hash_table_iter_init(&iter, file->table);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+		put_record(buf, KV_PUT, key, value);
+
+	put_commit(buf, KV_HEADER_SIZE);
+
+	tmpname = g_strconcat(file->logname, ".tmp", NULL);
+
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		err = -errno;
+		goto done;
+	}
+
+	err = write_all(fd, buf->data, buf->len);
+	if (err == 0 && fdatasync(fd) < 0)
+		err = -errno;
+
+	close(fd);
+
+	if (err == 0 && rename(tmpname, file->logname) < 0)
+		err = -errno;
+
+	if (err < 0) {
+		unlink(tmpname);
+		goto done;
+	}
+
+	/* The old log is gone, a failure here only risks the snapshot not
+	 * surviving a power loss */
+	ret = sync_dir(file->logname);
+	if (ret < 0)
+		error("Can't sync directory of %s: %s (%d)", file->logname,
+							strerror(-ret), -ret);
+
+	if (file->fd >= 0)
+		close(file->fd);
+
+	file->fd = open(file->logname, O_WRONLY | O_APPEND);
+	if (file->fd < 0)
+		err = -errno;
+
+	file->size = buf->len;
+
+done:
+	g_free(tmpname);
+	g_byte_array_free(buf, TRUE);
+
+	return err;
+}
+
+static void kv_file_free(gpointer data)
+{
+	struct kv_file *file = data;
+
+	if (file->fd >= 0)
+		close(file->fd);
+
+	if (file->batch)
+		g_byte_array_free(file->batch, TRUE);
+
+	g_hash_table_destroy(file->table);
+	g_free(file->logname);
+	g_free(file->pathname);
+	g_free(file);
+}
+
+static struct kv_file *kv_file_open(const char *pathname, gboolean create)
+{
+	struct kv_file *file;
+	gchar *data;
+	gsize len, valid;
+	int err;
+
+	file = g_hash_table_lookup(files, pathname);
+	if (file)
+		return file;
+
+	file = g_new0(struct kv_file, 1);
+	file->pathname = g_strdup(pathname);
+	file->logname = g_strconcat(pathname, ".log", NULL);
+	file->table = g_hash_table_new_full(g_str_hash, g_str_equal,
+							g_free, g_free);
+	file->fd = -1;
+
+	if (g_file_get_contents(file->logname, &data, &len, NULL)) {
+		valid = parse_log(file, (const uint8_t *) data, len);
+		g_free(data);
+
+		if (valid > 0) {
+			if (valid < len) {
+				DBG("Dropping %zu bytes of incomplete batches "
+					"from %s", len - valid, file->logname);
+				if (truncate(file->logname, valid) < 0)
+					goto fail;
+			}
+
+			file->fd = open(file->logname, O_WRONLY | O_APPEND);
+			if (file->fd < 0)
+				goto fail;
+
+			file->size = valid;
+			goto done;
+		}
+	}
+
+	/* No usable log, start over from the textfile if there is one */
+	if (!create && !g_file_test(pathname, G_FILE_TEST_EXISTS))
+		goto fail;
+
+	import_textfile(file);
+
+	create_dirs(file->logname, S_IRUSR | S_IWUSR | S_IXUSR |
+					S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+
+	err = write_snapshot(file);
+	if (err < 0) {
+		error("Unable to create %s: %s (%d)", file->logname,
+							strerror(-err), -err);
+		goto fail;
+	}
+
+done:
+	g_hash_table_insert(files, file->pathname, file);
+
+	return file;
+
+fail:
+	kv_file_free(file);
+	return NULL;
+}
+
+static void kv_file_flush(struct kv_file *file)
+{
+	off_t size = file->size;
+	int err;
+
+	if (file->batch == NULL)
+		return;
+
+	put_commit(file->batch, 0);
+
+	err = write_all(file->fd, file->batch->data, file->batch->len);
+	if (err == 0 && fdatasync(file->fd) < 0)
+		err = -errno;
+
+	g_byte_array_free(file->batch, TRUE);
+	file->batch = NULL;
+
+	if (err < 0) {
+		error("Unable to write %s: %s (%d)", file->logname,
+							strerror(-err), -err);
+		/* Rewrite the whole log so that memory and disk agree again */
+		if (ftruncate(file->fd, size) < 0 || write_snapshot(file) < 0)
+			error("%s is out of date", file->logname);
+		return;
+	}
+
+	file->size = lseek(file->fd, 0, SEEK_END);
+
+	if (file->size > KV_COMPACT_MIN &&
+			(gsize) file->size > 2 * (file->live + KV_HEADER_SIZE)) {
+		DBG("Compacting %s", file->logname);
+		write_snapshot(file);
+	}
+}
+
+void kvstore_sync(void)
+{
+	GSList *l;
+
+	if (flush_id > 0) {
+		g_source_remove(flush_id);
+		flush_id = 0;
+	}
+
+	for (l = dirty; l; l = l->next)
+		kv_file_flush(l->data);
+
+	g_slist_free(dirty);
+	dirty = NULL;
+}
+
+static gboolean flush_cb(gpointer user_data)
+{
+	flush_id = 0;
+
+	kvstore_sync();
+
+	return FALSE;
+}
+
+/* Writes issued while handling one event end up in the same batch */
+static void append_record(struct kv_file *file, uint8_t type, const char *key,
+							const char *value)
+{
+	if (file->batch == NULL) {
+		file->batch = g_byte_array_new();
+		dirty = g_slist_prepend(dirty, file);
+	}
+
+	put_record(file->batch, type, key, value);
+
+	if (flush_id == 0)
+		flush_id = g_idle_add(flush_cb, NULL);
+}
+
+static char *find_key(struct kv_file *file, const char *key, int icase)
+{
+	GHashTableIter iter;
+	gpointer k;
+
+	if (g_hash_table_lookup_extended(file->table, key, &k, NULL))
+		return k;
+
+	if (!icase)
+		return NULL;
+
+	g_hash_table_iter_init(&iter, file->table);
+	while (g_hash_table_iter_next(&iter, &k, NULL))
+		if (strcasecmp(k, key) == 0)
+			return k;
+
+	return NULL;
+}
+
+static int kv_put(const char *pathname, const char *key, const char *value,
+								int icase)
+{
+	struct kv_file *file;
+	char *old;
+
+	file = kv_file_open(pathname, value != NULL);
+	if (file == NULL)
+		return value ? -EIO : 0;
+
+	old = find_key(file, key, icase);
+	if (old) {
+		if (value && !strcmp(old, key) &&
+				!strcmp(g_hash_table_lookup(file->table, old),
+								value))
+			return 0;
+
+		append_record(file, KV_DEL, old, NULL);
+		table_del(file, old);
+	}
+
+	if (value) {
+		append_record(file, KV_PUT, key, value);
+		table_put(file, g_strdup(key), g_strdup(value));
+	}
+
+	return 0;
+}
+
+static char *kv_get(const char *pathname, const char *key, int icase)
+{
+	struct kv_file *file;
+	char *k;
+
+	file = kv_file_open(pathname, FALSE);
+	if (file == NULL)
+		return NULL;
+
+	k = find_key(file, key, icase);
+	if (k == NULL)
+		return NULL;
+
+	return strdup(g_hash_table_lookup(file->table, k));
+}
+
+static int kv_foreach(const char *pathname, textfile_cb func, void *data)
+{
+	struct kv_file *file;
+	GHashTableIter iter;
+	gpointer key, value;
+	GSList *pairs = NULL, *l;
+
+	file = kv_file_open(pathname, FALSE);
+	if (file == NULL)
+		return -ENOENT;
+
+	/* Callbacks are free to modify the same file */
+	g_hash_table_iter_init(&iter, file->table);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		pairs = g_slist_prepend(pairs, g_strdup(value));
+		pairs = g_slist_prepend(pairs, g_strdup(key));
+	}
+
+	for (l = pairs; l; l = l->next->next)
+		func(l->data, l->next->data, data);
+
+	g_slist_free_full(pairs, g_free);
+
+	return 0;
+}
+
+static const struct textfile_backend kvstore_backend = {
+	.name		= "log",
+	.put		= kv_put,
+	.get		= kv_get,
+	.foreach	= kv_foreach,
+};
+
+static void kvstore_setup(void)
+{
+	if (files == NULL)
+		files = g_hash_table_new_full(g_str_hash, g_str_equal,
+							NULL, kv_file_free);
+}
+
+int kvstore_init(void)
+{
+	kvstore_setup();
+
+	textfile_set_backend(&kvstore_backend);
+
+	DBG("Using %s storage backend", kvstore_backend.name);
+
+	return 0;
+}
+
+void kvstore_exit(void)
+{
+	kvstore_sync();
+
+	textfile_set_backend(NULL);
+
+	if (files) {
+		g_hash_table_destroy(files);
+		files = NULL;
+	}
+}
+
+/* Creates the log of a textfile, returns the number of keys it holds */
+int kvstore_migrate(const char *pathname)
+{
+	struct kv_file *file;
+	int count;
+
+	kvstore_setup();
+
+	file = kv_file_open(pathname, FALSE);
+	if (file == NULL)
+		return -ENOENT;
+
+	count = g_hash_table_size(file->table);
+
+	g_hash_table_remove(files, pathname);
+
+	return count;
+}
+
+/* Writes the keys of a log back to its textfile and removes the log */
+int kvstore_export(const char *pathname)
+{
+	struct kv_file *file;
+	GHashTableIter iter;
+	gpointer key, value;
+	GString *str;
+	GError *gerr = NULL;
+	int count, err = 0;
+
+	kvstore_setup();
+
+	file = kv_file_open(pathname, FALSE);
+	if (file == NULL)
+		return -ENOENT;
+
+	kvstore_sync();
+
+	str = g_string_new(NULL);
+
+	g_hash_table_iter_init(&iter, file->table);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+		g_string_append_printf(str, "%s %s\n", (char *) key,
+							(char *) value);
+
+	count = g_hash_table_size(file->table);
+
+	if (!g_file_set_contents(pathname, str->str, str->len, &gerr)) {
+		error("Unable to write %s: %s", pathname, gerr->message);
+		g_error_free(gerr);
+		err = -EIO;
+	} else if (unlink(file->logname) < 0)
+		err = -errno;
+
+	g_string_free(str, TRUE);
+
+	g_hash_table_remove(files, pathname);
+
+	return err < 0 ? err : count;
+}
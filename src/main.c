@@ -55,6 +55,8 @@
 #include "agent.h"
 #include "manager.h"
 #include "mgmt.h"
+#include "storage.h"
+#include "kvstore.h"
 
 #define BLUEZ_NAME "org.bluez"
 
@@ -62,6 +64,7 @@
 
 #define DEFAULT_DISCOVERABLE_TIMEOUT 180 /* 3 minutes */
 #define DEFAULT_AUTO_CONNECT_TIMEOUT  60 /* 60 seconds */
+#define DEFAULT_MAX_SERVICE_SEARCHES  8
 
 struct main_opts main_opts;
 
@@ -166,6 +169,16 @@ static void parse_config(GKeyFile *config)
 		main_opts.autoto = val;
 	}
 
+	val = g_key_file_get_integer(config, "General", "MaxServiceSearches",
+									&err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else if (val >= 0) {
+		DBG("max_searches=%d", val);
+		main_opts.max_searches = val;
+	}
+
 	str = g_key_file_get_string(config, "General", "Name", &err);
 	if (err) {
 		DBG("%s", err->message);
@@ -242,6 +255,26 @@ static void parse_config(GKeyFile *config)
 	else
 		main_opts.gatt_enabled = boolean;
 
+	boolean = g_key_file_get_boolean(config, "General",
+						"LazyDeviceLoading", &err);
+	if (err)
+		g_clear_error(&err);
+	else
+		main_opts.lazy_devices = boolean;
+
+	str = g_key_file_get_string(config, "General", "StorageBackend", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		DBG("storage=%s", str);
+		if (!strcmp(str, "log"))
+			main_opts.log_storage = TRUE;
+		else if (strcmp(str, "textfile"))
+			error("Unknown storage backend %s", str);
+		g_free(str);
+	}
+
 	main_opts.link_mode = HCI_LM_ACCEPT;
 
 	main_opts.link_policy = HCI_LP_RSWITCH | HCI_LP_SNIFF |
@@ -256,6 +289,7 @@ static void init_defaults(void)
 	main_opts.name	= g_strdup("BlueZ");
 	main_opts.discovto	= DEFAULT_DISCOVERABLE_TIMEOUT;
 	main_opts.autoto = DEFAULT_AUTO_CONNECT_TIMEOUT;
+	main_opts.max_searches = DEFAULT_MAX_SERVICE_SEARCHES;
 	main_opts.remember_powered = TRUE;
 	main_opts.reverse_sdp = TRUE;
 	main_opts.name_resolv = TRUE;
@@ -510,6 +544,9 @@ int main(int argc, char *argv[])
 
 	parse_config(config);
 
+	if (main_opts.log_storage)
+		kvstore_init();
+
 	agent_init();
 
 	if (option_udev == FALSE) {
@@ -563,6 +600,11 @@ int main(int argc, char *argv[])
 
 	mgmt_cleanup();
 
+	storage_flush();
+
+	if (main_opts.log_storage)
+		kvstore_exit();
+
 	info("Exit");
 
 	__btd_log_cleanup();
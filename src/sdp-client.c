@@ -34,6 +34,7 @@
 #include <glib.h>
 
 #include "btio.h"
+#include "hcid.h"
 #include "sdp-client.h"
 
 /* Number of seconds to keep a sdp_session_t in the cache */
@@ -122,22 +123,99 @@ struct search_context {
 	bt_callback_t		cb;
 	bt_destroy_t		destroy;
 	gpointer		user_data;
-	uuid_t			uuid;
+	GSList			*uuids;
+	sdp_list_t		*recs;
 	guint			io_id;
+	guint			next_id;
 };
 
+/* Searches with an SDP session, and searches waiting for a free slot or for
+ * the search already running against the same peer to release its session */
 static GSList *context_list = NULL;
+static GSList *pending_list = NULL;
 
-static void search_context_cleanup(struct search_context *ctxt)
-{
-	context_list = g_slist_remove(context_list, ctxt);
+static void schedule_searches(void);
 
+static void search_context_free(struct search_context *ctxt)
+{
 	if (ctxt->destroy)
 		ctxt->destroy(ctxt->user_data);
 
+	if (ctxt->recs)
+		sdp_list_free(ctxt->recs, (sdp_free_func_t) sdp_record_free);
+
+	g_slist_free_full(ctxt->uuids, g_free);
 	g_free(ctxt);
 }
 
+static void search_context_cleanup(struct search_context *ctxt)
+{
+	context_list = g_slist_remove(context_list, ctxt);
+
+	search_context_free(ctxt);
+
+	schedule_searches();
+}
+
+static int rec_cmp(const void *a, const void *b)
+{
+	const sdp_record_t *r1 = a;
+	const sdp_record_t *r2 = b;
+
+	return r1->handle - r2->handle;
+}
+
+static int send_search(struct search_context *ctxt)
+{
+	sdp_list_t *search, *attrids;
+	uint32_t range = 0x0000ffff;
+	int err;
+
+	search = sdp_list_append(NULL, ctxt->uuids->data);
+	attrids = sdp_list_append(NULL, &range);
+
+	err = sdp_service_search_attr_async(ctxt->session, search,
+						SDP_ATTR_REQ_RANGE, attrids);
+
+	sdp_list_free(attrids, NULL);
+	sdp_list_free(search, NULL);
+
+	return err < 0 ? -EIO : 0;
+}
+
+static gboolean search_process_cb(GIOChannel *chan, GIOCondition cond,
+							gpointer user_data);
+
+static gboolean search_next(gpointer user_data)
+{
+	struct search_context *ctxt = user_data;
+	GIOChannel *chan;
+	int err;
+
+	ctxt->next_id = 0;
+
+	err = send_search(ctxt);
+	if (err < 0) {
+		sdp_close(ctxt->session);
+		ctxt->session = NULL;
+
+		if (ctxt->cb)
+			ctxt->cb(NULL, err, ctxt->user_data);
+
+		search_context_cleanup(ctxt);
+
+		return FALSE;
+	}
+
+	chan = g_io_channel_unix_new(sdp_get_socket(ctxt->session));
+	ctxt->io_id = g_io_add_watch(chan,
+				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				search_process_cb, ctxt);
+	g_io_channel_unref(chan);
+
+	return FALSE;
+}
+
 static void search_completed_cb(uint8_t type, uint16_t status,
 			uint8_t *rsp, size_t size, void *user_data)
 {
@@ -154,7 +232,7 @@ static void search_completed_cb(uint8_t type, uint16_t status,
 
 	scanned = sdp_extract_seqtype(rsp, bytesleft, &dataType, &seqlen);
 	if (!scanned || !seqlen)
-		goto done;
+		goto next;
 
 	rsp += scanned;
 	bytesleft -= scanned;
@@ -163,7 +241,7 @@ static void search_completed_cb(uint8_t type, uint16_t status,
 		int recsize;
 
 		recsize = 0;
-		rec = sdp_extract_pdu(rsp, bytesleft, &recsize);
+		rec = sdp_extract_pdu_arena(rsp, bytesleft, &recsize);
 		if (!rec)
 			break;
 
@@ -176,11 +254,43 @@ static void search_completed_cb(uint8_t type, uint16_t status,
 		rsp += recsize;
 		bytesleft -= recsize;
 
-		recs = sdp_list_append(recs, rec);
+		/* Records matching several UUIDs of the set are reported
+		 * only once */
+		if (sdp_list_find(ctxt->recs, rec, rec_cmp)) {
+			sdp_record_free(rec);
+			continue;
+		}
+
+		ctxt->recs = sdp_list_append(ctxt->recs, rec);
 	} while (scanned < (ssize_t) size && bytesleft > 0);
 
+next:
+	g_free(ctxt->uuids->data);
+	ctxt->uuids = g_slist_delete_link(ctxt->uuids, ctxt->uuids);
+
+	/* Remaining UUIDs are searched over the same connection. This runs
+	 * from sdp_process(), which still uses the session and makes
+	 * search_process_cb() drop the io watch, so the next search is sent
+	 * once it has returned. */
+	if (ctxt->uuids) {
+		ctxt->io_id = 0;
+		ctxt->next_id = g_idle_add(search_next, ctxt);
+		return;
+	}
+
+	recs = ctxt->recs;
+	ctxt->recs = NULL;
+
 done:
+	/* The session outlives this context in the cache, so it must not
+	 * keep dispatching to it */
+	if (ctxt->io_id) {
+		g_source_remove(ctxt->io_id);
+		ctxt->io_id = 0;
+	}
+
 	cache_sdp_session(&ctxt->src, &ctxt->dst, ctxt->session);
+	ctxt->session = NULL;
 
 	if (ctxt->cb)
 		ctxt->cb(recs, err, ctxt->user_data);
@@ -225,8 +335,6 @@ static gboolean connect_watch(GIOChannel *chan, GIOCondition cond,
 							gpointer user_data)
 {
 	struct search_context *ctxt = user_data;
-	sdp_list_t *search, *attrids;
-	uint32_t range = 0x0000ffff;
 	socklen_t len;
 	int sk, err, sk_err = 0;
 
@@ -247,18 +355,9 @@ static gboolean connect_watch(GIOChannel *chan, GIOCondition cond,
 		goto failed;
 	}
 
-	search = sdp_list_append(NULL, &ctxt->uuid);
-	attrids = sdp_list_append(NULL, &range);
-	if (sdp_service_search_attr_async(ctxt->session,
-				search, SDP_ATTR_REQ_RANGE, attrids) < 0) {
-		sdp_list_free(attrids, NULL);
-		sdp_list_free(search, NULL);
-		err = -EIO;
+	err = send_search(ctxt);
+	if (err < 0)
 		goto failed;
-	}
-
-	sdp_list_free(attrids, NULL);
-	sdp_list_free(search, NULL);
 
 	/* Set callback responsible for update the internal SDP transaction */
 	ctxt->io_id = g_io_add_watch(chan,
@@ -278,64 +377,163 @@ failed:
 	return FALSE;
 }
 
-static int create_search_context(struct search_context **ctxt,
-					const bdaddr_t *src,
-					const bdaddr_t *dst,
-					uuid_t *uuid)
+static int start_search(struct search_context *ctxt)
 {
 	sdp_session_t *s;
 	GIOChannel *chan;
 
-	if (!ctxt)
-		return -EINVAL;
-
-	s = get_sdp_session(src, dst);
+	s = get_sdp_session(&ctxt->src, &ctxt->dst);
 	if (!s)
 		return -errno;
 
-	*ctxt = g_try_malloc0(sizeof(struct search_context));
-	if (!*ctxt) {
-		sdp_close(s);
-		return -ENOMEM;
-	}
-
-	bacpy(&(*ctxt)->src, src);
-	bacpy(&(*ctxt)->dst, dst);
-	(*ctxt)->session = s;
-	(*ctxt)->uuid = *uuid;
+	ctxt->session = s;
 
 	chan = g_io_channel_unix_new(sdp_get_socket(s));
-	(*ctxt)->io_id = g_io_add_watch(chan,
+	ctxt->io_id = g_io_add_watch(chan,
 				G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
-				connect_watch, *ctxt);
+				connect_watch, ctxt);
 	g_io_channel_unref(chan);
 
+	context_list = g_slist_append(context_list, ctxt);
+
 	return 0;
 }
 
-int bt_search_service(const bdaddr_t *src, const bdaddr_t *dst,
-			uuid_t *uuid, bt_callback_t cb, void *user_data,
+static gboolean peer_busy(const bdaddr_t *src, const bdaddr_t *dst)
+{
+	GSList *l;
+
+	for (l = context_list; l != NULL; l = l->next) {
+		struct search_context *ctxt = l->data;
+
+		if (!bacmp(&ctxt->src, src) && !bacmp(&ctxt->dst, dst))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static gboolean session_cached(const bdaddr_t *src, const bdaddr_t *dst)
+{
+	GSList *l;
+
+	for (l = cached_sdp_sessions; l != NULL; l = l->next) {
+		struct cached_sdp_session *c = l->data;
+
+		if (!bacmp(&c->src, src) && !bacmp(&c->dst, dst))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static gboolean slot_available(void)
+{
+	if (main_opts.max_searches == 0)
+		return TRUE;
+
+	return g_slist_length(context_list) < main_opts.max_searches;
+}
+
+static struct search_context *next_pending(void)
+{
+	struct search_context *first = NULL;
+	GSList *l;
+
+	/* Peers whose connection is still cached go first, so that queued
+	 * searches reuse it before it expires */
+	for (l = pending_list; l != NULL; l = l->next) {
+		struct search_context *ctxt = l->data;
+
+		if (peer_busy(&ctxt->src, &ctxt->dst))
+			continue;
+
+		if (session_cached(&ctxt->src, &ctxt->dst))
+			return ctxt;
+
+		if (first == NULL)
+			first = ctxt;
+	}
+
+	return first;
+}
+
+static void schedule_searches(void)
+{
+	struct search_context *ctxt;
+	int err;
+
+	while (slot_available() && (ctxt = next_pending()) != NULL) {
+		pending_list = g_slist_remove(pending_list, ctxt);
+
+		err = start_search(ctxt);
+		if (err == 0)
+			continue;
+
+		if (ctxt->cb)
+			ctxt->cb(NULL, err, ctxt->user_data);
+
+		search_context_free(ctxt);
+	}
+}
+
+int bt_search_services(const bdaddr_t *src, const bdaddr_t *dst,
+			sdp_list_t *uuids, bt_callback_t cb, void *user_data,
 			bt_destroy_t destroy)
 {
-	struct search_context *ctxt = NULL;
+	struct search_context *ctxt;
+	sdp_list_t *l;
 	int err;
 
-	if (!cb)
+	if (!cb || !uuids)
 		return -EINVAL;
 
-	err = create_search_context(&ctxt, src, dst, uuid);
-	if (err < 0)
-		return err;
+	ctxt = g_try_malloc0(sizeof(struct search_context));
+	if (!ctxt)
+		return -ENOMEM;
+
+	bacpy(&ctxt->src, src);
+	bacpy(&ctxt->dst, dst);
+
+	for (l = uuids; l != NULL; l = l->next)
+		ctxt->uuids = g_slist_append(ctxt->uuids,
+					g_memdup(l->data, sizeof(uuid_t)));
 
 	ctxt->cb	= cb;
 	ctxt->destroy	= destroy;
 	ctxt->user_data	= user_data;
 
-	context_list = g_slist_append(context_list, ctxt);
+	if (peer_busy(src, dst) || !slot_available()) {
+		pending_list = g_slist_append(pending_list, ctxt);
+		return 0;
+	}
+
+	err = start_search(ctxt);
+	if (err < 0) {
+		ctxt->destroy = NULL;
+		search_context_free(ctxt);
+		return err;
+	}
 
 	return 0;
 }
 
+int bt_search_service(const bdaddr_t *src, const bdaddr_t *dst,
+			uuid_t *uuid, bt_callback_t cb, void *user_data,
+			bt_destroy_t destroy)
+{
+	sdp_list_t *uuids;
+	int err;
+
+	uuids = sdp_list_append(NULL, uuid);
+
+	err = bt_search_services(src, dst, uuids, cb, user_data, destroy);
+
+	sdp_list_free(uuids, NULL);
+
+	return err;
+}
+
 static gint find_by_bdaddr(gconstpointer data, gconstpointer user_data)
 {
 	const struct search_context *ctxt = data, *search = user_data;
@@ -359,8 +557,18 @@ int bt_cancel_discovery(const bdaddr_t *src, const bdaddr_t *dst)
 
 	/* Ongoing SDP Discovery */
 	l = g_slist_find_custom(context_list, &match, find_by_bdaddr);
-	if (l == NULL)
-		return -ENOENT;
+	if (l == NULL) {
+		/* Queued SDP Discovery */
+		l = g_slist_find_custom(pending_list, &match, find_by_bdaddr);
+		if (l == NULL)
+			return -ENOENT;
+
+		ctxt = l->data;
+		pending_list = g_slist_remove(pending_list, ctxt);
+		search_context_free(ctxt);
+
+		return 0;
+	}
 
 	ctxt = l->data;
 
@@ -370,6 +578,9 @@ int bt_cancel_discovery(const bdaddr_t *src, const bdaddr_t *dst)
 	if (ctxt->io_id)
 		g_source_remove(ctxt->io_id);
 
+	if (ctxt->next_id)
+		g_source_remove(ctxt->next_id);
+
 	if (ctxt->session)
 		sdp_close(ctxt->session);
 
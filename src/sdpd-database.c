@@ -31,7 +31,10 @@
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <glib.h>
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/l2cap.h>
@@ -46,6 +49,21 @@
 static sdp_list_t *service_db;
 static sdp_list_t *access_db;
 
+/* Handle to sdp_access_t, for the access checks done on every match */
+static GHashTable *access_index = NULL;
+
+/*
+ * Inverted index from the 128-bit form of every UUID found in a record
+ * pattern to the records holding it, sorted by handle. Patterns are filled
+ * in after the record has been added, so the index is rebuilt on the next
+ * search whenever the repository changes.
+ */
+static GHashTable *uuid_index = NULL;
+static gboolean uuid_index_valid = FALSE;
+
+/* Handle to the serialized form of the record, see pdu_cache_get() */
+static GHashTable *pdu_cache = NULL;
+
 typedef struct {
 	uint32_t handle;
 	bdaddr_t device;
@@ -92,10 +110,209 @@ static void access_free(void *p)
  */
 void sdp_svcdb_reset(void)
 {
+	if (uuid_index) {
+		g_hash_table_destroy(uuid_index);
+		uuid_index = NULL;
+	}
+	uuid_index_valid = FALSE;
+
+	if (pdu_cache) {
+		g_hash_table_destroy(pdu_cache);
+		pdu_cache = NULL;
+	}
+
+	if (access_index) {
+		g_hash_table_destroy(access_index);
+		access_index = NULL;
+	}
+
 	sdp_list_free(service_db, (sdp_free_func_t) sdp_record_free);
 	sdp_list_free(access_db, access_free);
 }
 
+void sdp_svcdb_changed(void)
+{
+	uuid_index_valid = FALSE;
+
+	if (pdu_cache)
+		g_hash_table_remove_all(pdu_cache);
+}
+
+static guint uuid128_hash(gconstpointer key)
+{
+	const uint8_t *data = key;
+	guint hash = 0;
+	size_t i;
+
+	for (i = 0; i < sizeof(uint128_t); i++)
+		hash = hash * 31 + data[i];
+
+	return hash;
+}
+
+static gboolean uuid128_equal(gconstpointer a, gconstpointer b)
+{
+	return memcmp(a, b, sizeof(uint128_t)) == 0;
+}
+
+static void posting_free(gpointer data)
+{
+	g_ptr_array_free(data, TRUE);
+}
+
+static GPtrArray *uuid_index_lookup(const uuid_t *uuid)
+{
+	uuid_t *uuid128;
+	GPtrArray *posting;
+
+	if (uuid->type == SDP_UUID128)
+		return g_hash_table_lookup(uuid_index, &uuid->value.uuid128);
+
+	uuid128 = sdp_uuid_to_uuid128(uuid);
+	if (uuid128 == NULL)
+		return NULL;
+
+	posting = g_hash_table_lookup(uuid_index, &uuid128->value.uuid128);
+	bt_free(uuid128);
+
+	return posting;
+}
+
+static void uuid_index_rebuild(void)
+{
+	sdp_list_t *l, *p;
+
+	if (uuid_index)
+		g_hash_table_remove_all(uuid_index);
+	else
+		uuid_index = g_hash_table_new_full(uuid128_hash, uuid128_equal,
+							g_free, posting_free);
+
+	/* service_db is sorted by handle, and so are the postings */
+	for (l = service_db; l; l = l->next) {
+		sdp_record_t *rec = l->data;
+
+		for (p = rec->pattern; p; p = p->next) {
+			uuid_t *uuid = p->data;
+			GPtrArray *posting;
+
+			if (uuid == NULL || uuid->type != SDP_UUID128)
+				continue;
+
+			posting = uuid_index_lookup(uuid);
+			if (posting == NULL) {
+				posting = g_ptr_array_new();
+				g_hash_table_insert(uuid_index,
+					g_memdup(&uuid->value.uuid128,
+							sizeof(uint128_t)),
+					posting);
+			}
+
+			g_ptr_array_add(posting, rec);
+		}
+	}
+
+	uuid_index_valid = TRUE;
+}
+
+static gboolean posting_contains(GPtrArray *posting, uint32_t handle)
+{
+	int low = 0, high = posting->len - 1;
+
+	while (low <= high) {
+		int mid = (low + high) / 2;
+		sdp_record_t *rec = g_ptr_array_index(posting, mid);
+
+		if (rec->handle == handle)
+			return TRUE;
+
+		if (rec->handle < handle)
+			low = mid + 1;
+		else
+			high = mid - 1;
+	}
+
+	return FALSE;
+}
+
+static sdp_list_t *list_prepend(sdp_list_t *list, void *data)
+{
+	sdp_list_t *n = malloc(sizeof(sdp_list_t));
+
+	if (!n)
+		return list;
+
+	n->data = data;
+	n->next = list;
+
+	return n;
+}
+
+/*
+ * Records whose pattern holds every UUID of the search pattern, in handle
+ * order. The shortest posting list is walked and the others are probed,
+ * the returned list is freed with sdp_list_free(list, NULL).
+ */
+sdp_list_t *sdp_svcdb_search(sdp_list_t *search)
+{
+	GPtrArray **postings, *shortest;
+	sdp_list_t *l, *result = NULL;
+	int count, i, j;
+
+	/* An empty search pattern matches every record */
+	if (search == NULL) {
+		sdp_list_t **tail = &result;
+
+		for (l = service_db; l; l = l->next) {
+			*tail = list_prepend(NULL, l->data);
+			if (*tail == NULL)
+				break;
+			tail = &(*tail)->next;
+		}
+
+		return result;
+	}
+
+	if (!uuid_index_valid)
+		uuid_index_rebuild();
+
+	count = sdp_list_len(search);
+	postings = g_new0(GPtrArray *, count);
+	shortest = NULL;
+
+	for (l = search, i = 0; l; l = l->next, i++) {
+		if (l->data == NULL)
+			goto done;
+
+		postings[i] = uuid_index_lookup(l->data);
+		if (postings[i] == NULL)
+			goto done;
+
+		if (shortest == NULL || postings[i]->len < shortest->len)
+			shortest = postings[i];
+	}
+
+	for (j = shortest->len - 1; j >= 0; j--) {
+		sdp_record_t *rec = g_ptr_array_index(shortest, j);
+
+		for (i = 0; i < count; i++) {
+			if (postings[i] == shortest)
+				continue;
+
+			if (!posting_contains(postings[i], rec->handle))
+				break;
+		}
+
+		if (i == count)
+			result = list_prepend(result, rec);
+	}
+
+done:
+	g_free(postings);
+
+	return result;
+}
+
 typedef struct _indexed {
 	int sock;
 	sdp_record_t *record;
@@ -165,6 +382,229 @@ void sdp_svcdb_set_collectable(sdp_record_t *record, int sock)
 	socket_index = sdp_list_insert_sorted(socket_index, item, compare_indices);
 }
 
+/*
+ * Serialized form of a record, as generated by sdp_gen_record_pdu, with the
+ * offset and size of each attribute within it. Entries are built on first
+ * use and dropped whenever the repository changes.
+ */
+struct attr_slice {
+	uint16_t attr;
+	uint32_t offset;
+	uint32_t size;
+};
+
+struct pdu_cache {
+	sdp_record_t *rec;
+	sdp_buf_t pdu;
+	int count;
+	struct attr_slice slice[0];
+};
+
+static void pdu_cache_free(gpointer data)
+{
+	struct pdu_cache *cache = data;
+
+	free(cache->pdu.data);
+	g_free(cache);
+}
+
+/* Length of the data element at p including its header, 0 if invalid */
+static uint32_t element_size(const uint8_t *p, uint32_t bufsize)
+{
+	uint32_t size;
+
+	if (bufsize < sizeof(uint8_t))
+		return 0;
+
+	if (*p == SDP_DATA_NIL)
+		return sizeof(uint8_t);
+
+	switch (*p & 0x07) {
+	case 0:
+	case 1:
+	case 2:
+	case 3:
+	case 4:
+		size = sizeof(uint8_t) + (1 << (*p & 0x07));
+		break;
+	case 5:
+		if (bufsize < sizeof(uint8_t) * 2)
+			return 0;
+		size = sizeof(uint8_t) * 2 + p[1];
+		break;
+	case 6:
+		if (bufsize < sizeof(uint8_t) + sizeof(uint16_t))
+			return 0;
+		size = sizeof(uint8_t) + sizeof(uint16_t) +
+				ntohs(bt_get_unaligned((uint16_t *) (p + 1)));
+		break;
+	default:
+		if (bufsize < sizeof(uint8_t) + sizeof(uint32_t))
+			return 0;
+		size = sizeof(uint8_t) + sizeof(uint32_t) +
+				ntohl(bt_get_unaligned((uint32_t *) (p + 1)));
+		break;
+	}
+
+	return size <= bufsize ? size : 0;
+}
+
+static struct pdu_cache *pdu_cache_build(sdp_record_t *rec)
+{
+	struct pdu_cache *cache;
+	uint32_t offset;
+	uint8_t dtd;
+	int count, seqlen;
+
+	count = sdp_list_len(rec->attrlist);
+
+	cache = g_malloc0(sizeof(*cache) + count * sizeof(struct attr_slice));
+	cache->rec = rec;
+
+	if (sdp_gen_record_pdu(rec, &cache->pdu) < 0)
+		goto failed;
+
+	if (count == 0)
+		return cache;
+
+	offset = sdp_extract_seqtype(cache->pdu.data, cache->pdu.data_size,
+							&dtd, &seqlen);
+	if (offset == 0)
+		goto failed;
+
+	/* Each attribute is its ID as an UINT16 followed by the value */
+	while (offset < cache->pdu.data_size) {
+		const uint8_t *p = cache->pdu.data + offset;
+		uint32_t left = cache->pdu.data_size - offset;
+		struct attr_slice *slice;
+		uint32_t size;
+
+		if (cache->count == count || left < 3 || *p != SDP_UINT16)
+			goto failed;
+
+		size = element_size(p + 3, left - 3);
+		if (size == 0)
+			goto failed;
+
+		slice = &cache->slice[cache->count++];
+		slice->attr = ntohs(bt_get_unaligned((uint16_t *) (p + 1)));
+		slice->offset = offset;
+		slice->size = size + 3;
+
+		offset += slice->size;
+	}
+
+	if (cache->count != count)
+		goto failed;
+
+	return cache;
+
+failed:
+	error("Unable to cache PDU of record 0x%05x", rec->handle);
+	pdu_cache_free(cache);
+	return NULL;
+}
+
+static struct pdu_cache *pdu_cache_get(sdp_record_t *rec)
+{
+	struct pdu_cache *cache;
+
+	if (pdu_cache == NULL)
+		pdu_cache = g_hash_table_new_full(g_direct_hash,
+					g_direct_equal, NULL, pdu_cache_free);
+
+	cache = g_hash_table_lookup(pdu_cache, GUINT_TO_POINTER(rec->handle));
+	if (cache && cache->rec == rec)
+		return cache;
+
+	cache = pdu_cache_build(rec);
+	if (cache == NULL)
+		return NULL;
+
+	g_hash_table_replace(pdu_cache, GUINT_TO_POINTER(rec->handle), cache);
+
+	return cache;
+}
+
+void sdp_record_invalidate_pdu(uint32_t handle)
+{
+	if (pdu_cache)
+		g_hash_table_remove(pdu_cache, GUINT_TO_POINTER(handle));
+}
+
+const uint8_t *sdp_record_get_pdu(sdp_record_t *rec, uint32_t *size)
+{
+	struct pdu_cache *cache = pdu_cache_get(rec);
+
+	if (!cache)
+		return NULL;
+
+	*size = cache->pdu.data_size;
+
+	return cache->pdu.data;
+}
+
+/* Index of the first slice with an ID not below attr, slices follow the
+ * attribute list which is sorted by ID */
+static int pdu_cache_find(struct pdu_cache *cache, uint32_t attr)
+{
+	int low = 0, high = cache->count;
+
+	while (low < high) {
+		int mid = (low + high) / 2;
+
+		if (cache->slice[mid].attr < attr)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+const uint8_t *sdp_record_get_attr_pdu(sdp_record_t *rec, uint16_t attr,
+							uint32_t *size)
+{
+	struct pdu_cache *cache = pdu_cache_get(rec);
+	struct attr_slice *slice;
+	int i;
+
+	if (!cache)
+		return NULL;
+
+	i = pdu_cache_find(cache, attr);
+	if (i == cache->count || cache->slice[i].attr != attr)
+		return NULL;
+
+	slice = &cache->slice[i];
+	*size = slice->size;
+
+	return cache->pdu.data + slice->offset;
+}
+
+const uint8_t *sdp_record_get_attr_range_pdu(sdp_record_t *rec, uint16_t low,
+						uint16_t high, uint32_t *size)
+{
+	struct pdu_cache *cache = pdu_cache_get(rec);
+	struct attr_slice *first, *last;
+	int start, end;
+
+	if (!cache || low > high)
+		return NULL;
+
+	start = pdu_cache_find(cache, low);
+	end = pdu_cache_find(cache, (uint32_t) high + 1);
+	if (start == end)
+		return NULL;
+
+	/* Attributes within the range are adjacent in the PDU */
+	first = &cache->slice[start];
+	last = &cache->slice[end - 1];
+	*size = last->offset + last->size - first->offset;
+
+	return cache->pdu.data + first->offset;
+}
+
 /*
  * Add a service record to the repository
  */
@@ -177,6 +617,8 @@ void sdp_record_add(const bdaddr_t *device, sdp_record_t *rec)
 	SDPDBG("with handle : 0x%x", rec->handle);
 
 	service_db = sdp_list_insert_sorted(service_db, rec, record_sort);
+	uuid_index_valid = FALSE;
+	sdp_record_invalidate_pdu(rec->handle);
 
 	dev = malloc(sizeof(*dev));
 	if (!dev)
@@ -187,6 +629,11 @@ void sdp_record_add(const bdaddr_t *device, sdp_record_t *rec)
 
 	access_db = sdp_list_insert_sorted(access_db, dev, access_sort);
 
+	if (access_index == NULL)
+		access_index = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	g_hash_table_insert(access_index, GUINT_TO_POINTER(dev->handle), dev);
+
 	if (bacmp(device, BDADDR_ANY) == 0) {
 		manager_foreach_adapter(adapter_service_insert, rec);
 		return;
@@ -212,16 +659,11 @@ static sdp_list_t *record_locate(uint32_t handle)
 	return NULL;
 }
 
-static sdp_list_t *access_locate(uint32_t handle)
+static sdp_access_t *access_locate(uint32_t handle)
 {
-	if (access_db) {
-		sdp_list_t *p;
-		sdp_access_t a;
-
-		a.handle = handle;
-		p = sdp_list_find(access_db, &a, access_sort);
-		return p;
-	}
+	if (access_index)
+		return g_hash_table_lookup(access_index,
+						GUINT_TO_POINTER(handle));
 
 	SDPDBG("Could not find access data for : 0x%x", handle);
 	return NULL;
@@ -260,11 +702,12 @@ int sdp_record_remove(uint32_t handle)
 	if (r)
 		service_db = sdp_list_remove(service_db, r);
 
-	p = access_locate(handle);
-	if (p == NULL || p->data == NULL)
-		return 0;
+	uuid_index_valid = FALSE;
+	sdp_record_invalidate_pdu(handle);
 
-	a = p->data;
+	a = access_locate(handle);
+	if (a == NULL)
+		return 0;
 
 	if (bacmp(&a->device, BDADDR_ANY) != 0) {
 		struct btd_adapter *adapter = manager_find_adapter(&a->device);
@@ -273,6 +716,7 @@ int sdp_record_remove(uint32_t handle)
 	} else
 		manager_foreach_adapter(adapter_service_remove, r);
 
+	g_hash_table_remove(access_index, GUINT_TO_POINTER(handle));
 	access_db = sdp_list_remove(access_db, a);
 	access_free(a);
 
@@ -294,13 +738,8 @@ sdp_list_t *sdp_get_access_list(void)
 
 int sdp_check_access(uint32_t handle, bdaddr_t *device)
 {
-	sdp_list_t *p = access_locate(handle);
-	sdp_access_t *a;
-
-	if (!p)
-		return 1;
+	sdp_access_t *a = access_locate(handle);
 
-	a = p->data;
 	if (!a)
 		return 1;
 
@@ -46,7 +46,7 @@
 #include "log.h"
 
 typedef struct {
-	uint32_t timestamp;
+	uint32_t token;
 	union {
 		uint16_t maxBytesSent;
 		uint16_t lastIndexSent;
@@ -57,41 +57,186 @@ typedef struct {
 
 #define MIN(x, y) ((x) < (y)) ? (x): (y)
 
-typedef struct _sdp_cstate_list sdp_cstate_list_t;
-
-struct _sdp_cstate_list {
-	sdp_cstate_list_t *next;
-	uint32_t timestamp;
+/*
+ * Responses too large for a single PDU are kept until the client has
+ * fetched every fragment. Entries are keyed by the socket and a token
+ * carried in the continuation state, so one client can never resume the
+ * response of another. Memory is capped by dropping the least recently
+ * used entries, and entries are dropped once unused for a while, once
+ * the last fragment has been sent or when their socket goes away.
+ */
+#define CSTATE_HASH_SIZE	64
+#define CSTATE_MAX_MEMORY	(256 * 1024)
+#define CSTATE_TIMEOUT		30
+
+struct cstate_entry {
+	struct cstate_entry *hash_next;
+	struct cstate_entry *lru_prev;
+	struct cstate_entry *lru_next;
+	int sock;
+	uint32_t token;
+	uint32_t last_used;
 	sdp_buf_t buf;
 };
 
-static sdp_cstate_list_t *cstates;
+static struct cstate_entry *cstate_hash[CSTATE_HASH_SIZE];
+static struct cstate_entry *cstate_lru_head;	/* Most recently used */
+static struct cstate_entry *cstate_lru_tail;
+static uint32_t cstate_memory = 0;
+static uint32_t cstate_next_token = 0;
 
-/* FIXME: should probably remove it when it's found */
-static sdp_buf_t *sdp_get_cached_rsp(sdp_cont_state_t *cstate)
+static unsigned int cstate_bucket(int sock, uint32_t token)
 {
-	sdp_cstate_list_t *p;
+	return (token ^ ((uint32_t) sock * 2654435761u)) % CSTATE_HASH_SIZE;
+}
 
-	for (p = cstates; p; p = p->next)
-		if (p->timestamp == cstate->timestamp)
-			return &p->buf;
-	return 0;
+static void cstate_lru_unlink(struct cstate_entry *entry)
+{
+	if (entry->lru_prev)
+		entry->lru_prev->lru_next = entry->lru_next;
+	else
+		cstate_lru_head = entry->lru_next;
+
+	if (entry->lru_next)
+		entry->lru_next->lru_prev = entry->lru_prev;
+	else
+		cstate_lru_tail = entry->lru_prev;
+
+	entry->lru_prev = NULL;
+	entry->lru_next = NULL;
+}
+
+static void cstate_lru_push(struct cstate_entry *entry)
+{
+	entry->lru_next = cstate_lru_head;
+	if (cstate_lru_head)
+		cstate_lru_head->lru_prev = entry;
+	else
+		cstate_lru_tail = entry;
+
+	cstate_lru_head = entry;
+}
+
+static void cstate_remove(struct cstate_entry *entry)
+{
+	struct cstate_entry **p;
+
+	p = &cstate_hash[cstate_bucket(entry->sock, entry->token)];
+	for (; *p; p = &(*p)->hash_next) {
+		if (*p == entry) {
+			*p = entry->hash_next;
+			break;
+		}
+	}
+
+	cstate_lru_unlink(entry);
+	cstate_memory -= entry->buf.data_size;
+
+	free(entry->buf.data);
+	free(entry);
+}
+
+static void cstate_expire(void)
+{
+	uint32_t now = sdp_get_time();
+
+	while (cstate_lru_tail &&
+			now - cstate_lru_tail->last_used > CSTATE_TIMEOUT)
+		cstate_remove(cstate_lru_tail);
+}
+
+static struct cstate_entry *cstate_find(int sock, uint32_t token)
+{
+	struct cstate_entry *entry;
+
+	entry = cstate_hash[cstate_bucket(sock, token)];
+	for (; entry; entry = entry->hash_next)
+		if (entry->sock == sock && entry->token == token)
+			return entry;
+
+	return NULL;
+}
+
+static sdp_buf_t *sdp_get_cached_rsp(int sock, sdp_cont_state_t *cstate)
+{
+	struct cstate_entry *entry;
+
+	cstate_expire();
+
+	entry = cstate_find(sock, cstate->token);
+	if (!entry)
+		return NULL;
+
+	entry->last_used = sdp_get_time();
+	cstate_lru_unlink(entry);
+	cstate_lru_push(entry);
+
+	return &entry->buf;
+}
+
+/* The last fragment of the response has been sent */
+static void sdp_cstate_done(int sock, sdp_cont_state_t *cstate)
+{
+	struct cstate_entry *entry = cstate_find(sock, cstate->token);
+
+	if (entry)
+		cstate_remove(entry);
+}
+
+/* Returns the token to resume the response with, zero on failure */
+static uint32_t sdp_cstate_alloc_buf(int sock, sdp_buf_t *buf)
+{
+	struct cstate_entry *entry;
+	unsigned int bucket;
+
+	cstate_expire();
+
+	while (cstate_lru_tail &&
+			cstate_memory + buf->data_size > CSTATE_MAX_MEMORY)
+		cstate_remove(cstate_lru_tail);
+
+	entry = malloc(sizeof(struct cstate_entry));
+	if (!entry)
+		return 0;
+
+	memset(entry, 0, sizeof(struct cstate_entry));
+
+	entry->buf.data = malloc(buf->data_size);
+	if (!entry->buf.data) {
+		free(entry);
+		return 0;
+	}
+
+	memcpy(entry->buf.data, buf->data, buf->data_size);
+	entry->buf.data_size = buf->data_size;
+	entry->buf.buf_size = buf->data_size;
+	entry->sock = sock;
+	entry->last_used = sdp_get_time();
+
+	do {
+		entry->token = ++cstate_next_token;
+	} while (entry->token == 0 || cstate_find(sock, entry->token));
+
+	bucket = cstate_bucket(sock, entry->token);
+	entry->hash_next = cstate_hash[bucket];
+	cstate_hash[bucket] = entry;
+
+	cstate_lru_push(entry);
+	cstate_memory += entry->buf.data_size;
+
+	return entry->token;
 }
 
-static uint32_t sdp_cstate_alloc_buf(sdp_buf_t *buf)
+void sdp_cstate_cleanup(int sock)
 {
-	sdp_cstate_list_t *cstate = malloc(sizeof(sdp_cstate_list_t));
-	uint8_t *data = malloc(buf->data_size);
-
-	memcpy(data, buf->data, buf->data_size);
-	memset((char *)cstate, 0, sizeof(sdp_cstate_list_t));
-	cstate->buf.data = data;
-	cstate->buf.data_size = buf->data_size;
-	cstate->buf.buf_size = buf->data_size;
-	cstate->timestamp = sdp_get_time();
-	cstate->next = cstates;
-	cstates = cstate;
-	return cstate->timestamp;
+	struct cstate_entry *entry, *next;
+
+	for (entry = cstate_lru_head; entry; entry = next) {
+		next = entry->lru_next;
+
+		if (entry->sock == sock)
+			cstate_remove(entry);
+	}
 }
 
 /* Additional values for checking datatype (not in spec) */
@@ -255,7 +400,7 @@ static int sdp_set_cstate_pdu(sdp_buf_t *buf, sdp_cont_state_t *cstate)
 	int length = 0;
 
 	if (cstate) {
-		SDPDBG("Non null sdp_cstate_t id : 0x%x", cstate->timestamp);
+		SDPDBG("Non null sdp_cstate_t id : 0x%x", cstate->token);
 		*pdata = sizeof(sdp_cont_state_t);
 		pdata += sizeof(uint8_t);
 		length += sizeof(uint8_t);
@@ -299,51 +444,12 @@ static int sdp_cstate_get(uint8_t *buffer, size_t len,
 
 	memcpy(*cstate, buffer, sizeof(sdp_cont_state_t));
 
-	SDPDBG("Cstate TS : 0x%x", (*cstate)->timestamp);
+	SDPDBG("Cstate token : 0x%x", (*cstate)->token);
 	SDPDBG("Bytes sent : %d", (*cstate)->cStateValue.maxBytesSent);
 
 	return 0;
 }
 
-/*
- * The matching process is defined as "each and every UUID
- * specified in the "search pattern" must be present in the
- * "target pattern". Here "search pattern" is the set of UUIDs
- * specified by the service discovery client and "target pattern"
- * is the set of UUIDs present in a service record.
- *
- * Return 1 if each and every UUID in the search
- * pattern exists in the target pattern, 0 if the
- * match succeeds and -1 on error.
- */
-static int sdp_match_uuid(sdp_list_t *search, sdp_list_t *pattern)
-{
-	/*
-	 * The target is a sorted list, so we need not look
-	 * at all elements to confirm existence of an element
-	 * from the search pattern
-	 */
-	int patlen = sdp_list_len(pattern);
-
-	if (patlen < sdp_list_len(search))
-		return -1;
-	for (; search; search = search->next) {
-		uuid_t *uuid128;
-		void *data = search->data;
-		sdp_list_t *list;
-		if (data == NULL)
-			return -1;
-
-		/* create 128-bit form of the search UUID */
-		uuid128 = sdp_uuid_to_uuid128((uuid_t *)data);
-		list = sdp_list_find(pattern, uuid128, sdp_uuid128_cmp);
-		bt_free(uuid128);
-		if (!list)
-			return 0;
-	}
-	return 1;
-}
-
 /*
  * Service search request PDU. This method extracts the search pattern
  * (a sequence of UUIDs) and calls the matching function
@@ -421,17 +527,18 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 	buf->data_size += sizeof(uint16_t);
 
 	if (cstate == NULL) {
-		/* for every record in the DB, do a pattern search */
-		sdp_list_t *list = sdp_get_record_list();
+		/* records holding every UUID of the search pattern */
+		sdp_list_t *matches = sdp_svcdb_search(pattern);
+		sdp_list_t *list;
 
 		handleSize = 0;
-		for (; list && rsp_count < expected; list = list->next) {
+		for (list = matches; list && rsp_count < expected;
+							list = list->next) {
 			sdp_record_t *rec = list->data;
 
 			SDPDBG("Checking svcRec : 0x%x", rec->handle);
 
-			if (sdp_match_uuid(pattern, rec->pattern) > 0 &&
-					sdp_check_access(rec->handle, &req->device)) {
+			if (sdp_check_access(rec->handle, &req->device)) {
 				rsp_count++;
 				bt_put_unaligned(htonl(rec->handle), (uint32_t *)pdata);
 				pdata += sizeof(uint32_t);
@@ -439,6 +546,8 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 			}
 		}
 
+		sdp_list_free(matches, NULL);
+
 		SDPDBG("Match count: %d", rsp_count);
 
 		buf->data_size += handleSize;
@@ -447,7 +556,11 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 
 		if (rsp_count > actual) {
 			/* cache the rsp and generate a continuation state */
-			cStateId = sdp_cstate_alloc_buf(buf);
+			cStateId = sdp_cstate_alloc_buf(req->sock, buf);
+			if (cStateId == 0) {
+				status = SDP_INSUFFICIENT_RESOURCES;
+				goto done;
+			}
 			/*
 			 * subtract handleSize since we now send only
 			 * a subset of handles
@@ -468,7 +581,8 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 			 * Get the previous sdp_cont_state_t and obtain
 			 * the cached rsp
 			 */
-			sdp_buf_t *pCache = sdp_get_cached_rsp(cstate);
+			sdp_buf_t *pCache = sdp_get_cached_rsp(req->sock,
+									cstate);
 			if (pCache) {
 				pCacheBuffer = pCache->data;
 				/* get the rsp_count from the cached buffer */
@@ -514,6 +628,8 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 		if (i == rsp_count) {
 			/* set "null" continuationState */
 			sdp_set_cstate_pdu(buf, NULL);
+			if (cstate)
+				sdp_cstate_done(req->sock, cstate);
 		} else {
 			/*
 			 * there's more: set lastIndexSent to
@@ -527,7 +643,7 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 				memcpy(&newState, cstate, sizeof(sdp_cont_state_t));
 			else {
 				memset(&newState, 0, sizeof(sdp_cont_state_t));
-				newState.timestamp = cStateId;
+				newState.token = cStateId;
 			}
 			newState.cStateValue.lastIndexSent = i;
 			sdp_set_cstate_pdu(buf, &newState);
@@ -551,7 +667,8 @@ done:
  */
 static int extract_attrs(sdp_record_t *rec, sdp_list_t *seq, sdp_buf_t *buf)
 {
-	sdp_buf_t pdu;
+	const uint8_t *pdu, *data;
+	uint32_t pdu_size, size;
 
 	if (!rec)
 		return SDP_INVALID_RECORD_HANDLE;
@@ -563,7 +680,10 @@ static int extract_attrs(sdp_record_t *rec, sdp_list_t *seq, sdp_buf_t *buf)
 
 	SDPDBG("Entries in attr seq : %d", sdp_list_len(seq));
 
-	sdp_gen_record_pdu(rec, &pdu);
+	/* Serialized once per record and reused until the record changes */
+	pdu = sdp_record_get_pdu(rec, &pdu_size);
+	if (pdu == NULL)
+		return SDP_INSUFFICIENT_RESOURCES;
 
 	for (; seq; seq = seq->next) {
 		struct attrid *aid = seq->data;
@@ -572,45 +692,37 @@ static int extract_attrs(sdp_record_t *rec, sdp_list_t *seq, sdp_buf_t *buf)
 
 		if (aid->dtd == SDP_UINT16) {
 			uint16_t attr = bt_get_unaligned((uint16_t *)&aid->uint16);
-			sdp_data_t *a = sdp_data_get(rec, attr);
-			if (a)
-				sdp_append_to_pdu(buf, a);
+			data = sdp_record_get_attr_pdu(rec, attr, &size);
+			if (data)
+				sdp_append_to_buf(buf, (uint8_t *) data, size);
 		} else if (aid->dtd == SDP_UINT32) {
 			uint32_t range = bt_get_unaligned((uint32_t *)&aid->uint32);
-			uint16_t attr;
 			uint16_t low = (0xffff0000 & range) >> 16;
 			uint16_t high = 0x0000ffff & range;
-			sdp_data_t *data;
 
 			SDPDBG("attr range : 0x%x", range);
 			SDPDBG("Low id : 0x%x", low);
 			SDPDBG("High id : 0x%x", high);
 
-			if (low == 0x0000 && high == 0xffff && pdu.data_size <= buf->buf_size) {
+			if (low == 0x0000 && high == 0xffff && pdu_size <= buf->buf_size) {
 				/* copy it */
-				memcpy(buf->data, pdu.data, pdu.data_size);
-				buf->data_size = pdu.data_size;
+				memcpy(buf->data, pdu, pdu_size);
+				buf->data_size = pdu_size;
 				break;
 			}
-			/* (else) sub-range of attributes */
-			for (attr = low; attr < high; attr++) {
-				data = sdp_data_get(rec, attr);
-				if (data)
-					sdp_append_to_pdu(buf, data);
-			}
-			data = sdp_data_get(rec, high);
+			/* (else) sub-range of attributes, only the ones
+			 * present are visited */
+			data = sdp_record_get_attr_range_pdu(rec, low, high,
+									&size);
 			if (data)
-				sdp_append_to_pdu(buf, data);
+				sdp_append_to_buf(buf, (uint8_t *) data, size);
 		} else {
 			error("Unexpected data type : 0x%x", aid->dtd);
 			error("Expect uint16_t or uint32_t");
-			free(pdu.data);
 			return SDP_INVALID_SYNTAX;
 		}
 	}
 
-	free(pdu.data);
-
 	return 0;
 }
 
@@ -709,11 +821,12 @@ static int service_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 	buf->buf_size -= sizeof(uint16_t);
 
 	if (cstate) {
-		sdp_buf_t *pCache = sdp_get_cached_rsp(cstate);
+		sdp_buf_t *pCache = sdp_get_cached_rsp(req->sock, cstate);
 
 		SDPDBG("Obtained cached rsp : %p", pCache);
 
-		if (pCache) {
+		if (pCache && cstate->cStateValue.maxBytesSent <
+							pCache->data_size) {
 			short sent = MIN(max_rsp_size, pCache->data_size - cstate->cStateValue.maxBytesSent);
 			pResponse = pCache->data;
 			memcpy(buf->data, pResponse + cstate->cStateValue.maxBytesSent, sent);
@@ -722,9 +835,10 @@ static int service_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 
 			SDPDBG("Response size : %d sending now : %d bytes sent so far : %d",
 				pCache->data_size, sent, cstate->cStateValue.maxBytesSent);
-			if (cstate->cStateValue.maxBytesSent == pCache->data_size)
+			if (cstate->cStateValue.maxBytesSent == pCache->data_size) {
 				cstate_size = sdp_set_cstate_pdu(buf, NULL);
-			else
+				sdp_cstate_done(req->sock, cstate);
+			} else
 				cstate_size = sdp_set_cstate_pdu(buf, cstate);
 		} else {
 			status = SDP_INVALID_CSTATE;
@@ -737,7 +851,9 @@ static int service_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 			sdp_cont_state_t newState;
 
 			memset((char *)&newState, 0, sizeof(sdp_cont_state_t));
-			newState.timestamp = sdp_cstate_alloc_buf(buf);
+			newState.token = sdp_cstate_alloc_buf(req->sock, buf);
+			if (newState.token == 0)
+				status = SDP_INSUFFICIENT_RESOURCES;
 			/*
 			 * Reset the buffer size to the maximum expected and
 			 * set the sdp_cont_state_t
@@ -779,7 +895,7 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 	uint8_t *pdata, *pResponse = NULL;
 	unsigned int max;
 	int scanned, rsp_count = 0;
-	sdp_list_t *pattern = NULL, *seq = NULL, *svcList;
+	sdp_list_t *pattern = NULL, *seq = NULL, *svcList = NULL;
 	sdp_cont_state_t *cstate = NULL;
 	short cstate_size = 0;
 	uint8_t dtd = 0;
@@ -845,8 +961,6 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 		goto done;
 	}
 
-	svcList = sdp_get_record_list();
-
 	tmpbuf.data = malloc(USHRT_MAX);
 	tmpbuf.data_size = 0;
 	tmpbuf.buf_size = USHRT_MAX;
@@ -865,10 +979,11 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 	if (cstate == NULL) {
 		/* no continuation state -> create new response */
 		sdp_list_t *p;
+
+		svcList = sdp_svcdb_search(pattern);
 		for (p = svcList; p; p = p->next) {
 			sdp_record_t *rec = p->data;
-			if (sdp_match_uuid(pattern, rec->pattern) > 0 &&
-					sdp_check_access(rec->handle, &req->device)) {
+			if (sdp_check_access(rec->handle, &req->device)) {
 				rsp_count++;
 				status = extract_attrs(rec, seq, &tmpbuf);
 
@@ -894,7 +1009,9 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 			sdp_cont_state_t newState;
 
 			memset((char *)&newState, 0, sizeof(sdp_cont_state_t));
-			newState.timestamp = sdp_cstate_alloc_buf(buf);
+			newState.token = sdp_cstate_alloc_buf(req->sock, buf);
+			if (newState.token == 0)
+				status = SDP_INSUFFICIENT_RESOURCES;
 			/*
 			 * Reset the buffer size to the maximum expected and
 			 * set the sdp_cont_state_t
@@ -906,16 +1023,18 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 			cstate_size = sdp_set_cstate_pdu(buf, NULL);
 	} else {
 		/* continuation State exists -> get from cache */
-		sdp_buf_t *pCache = sdp_get_cached_rsp(cstate);
-		if (pCache) {
+		sdp_buf_t *pCache = sdp_get_cached_rsp(req->sock, cstate);
+		if (pCache && cstate->cStateValue.maxBytesSent <
+							pCache->data_size) {
 			uint16_t sent = MIN(max, pCache->data_size - cstate->cStateValue.maxBytesSent);
 			pResponse = pCache->data;
 			memcpy(buf->data, pResponse + cstate->cStateValue.maxBytesSent, sent);
 			buf->data_size += sent;
 			cstate->cStateValue.maxBytesSent += sent;
-			if (cstate->cStateValue.maxBytesSent == pCache->data_size)
+			if (cstate->cStateValue.maxBytesSent == pCache->data_size) {
 				cstate_size = sdp_set_cstate_pdu(buf, NULL);
-			else
+				sdp_cstate_done(req->sock, cstate);
+			} else
 				cstate_size = sdp_set_cstate_pdu(buf, cstate);
 		} else {
 			status = SDP_INVALID_CSTATE;
@@ -943,6 +1062,8 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 done:
 	free(cstate);
 	free(tmpbuf.data);
+	if (svcList)
+		sdp_list_free(svcList, NULL);
 	if (pattern)
 		sdp_list_free(pattern, free);
 	if (seq)
@@ -92,6 +92,8 @@ static void update_db_timestamp(void)
 	uint32_t dbts = sdp_get_time();
 	sdp_data_t *d = sdp_data_alloc(SDP_UINT32, &dbts);
 	sdp_attr_replace(server, SDP_ATTR_SVCDB_STATE, d);
+
+	sdp_svcdb_changed();
 }
 
 void register_public_browse_group(void)
@@ -346,6 +348,7 @@ static sdp_record_t *extract_pdu_server(bdaddr_t *device, uint8_t *p,
 			sdp_record_add(device, rec);
 		}
 	} else {
+		sdp_record_invalidate_pdu(rec->handle);
 		sdp_list_free(rec->attrlist, (sdp_free_func_t) sdp_data_free);
 		rec->attrlist = NULL;
 	}
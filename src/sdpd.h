@@ -46,6 +46,7 @@ typedef struct request {
 } sdp_req_t;
 
 void handle_request(int sk, uint8_t *data, int len);
+void sdp_cstate_cleanup(int sock);
 
 int service_register_req(sdp_req_t *req, sdp_buf_t *rsp);
 int service_update_req(sdp_req_t *req, sdp_buf_t *rsp);
@@ -60,12 +61,27 @@ void sdp_svcdb_reset(void);
 void sdp_svcdb_collect_all(int sock);
 void sdp_svcdb_set_collectable(sdp_record_t *rec, int sock);
 void sdp_svcdb_collect(sdp_record_t *rec);
+void sdp_svcdb_changed(void);
+sdp_list_t *sdp_svcdb_search(sdp_list_t *search);
 sdp_record_t *sdp_record_find(uint32_t handle);
 void sdp_record_add(const bdaddr_t *device, sdp_record_t *rec);
 int sdp_record_remove(uint32_t handle);
 sdp_list_t *sdp_get_record_list(void);
 sdp_list_t *sdp_get_access_list(void);
 int sdp_check_access(uint32_t handle, bdaddr_t *device);
+
+/*
+ * Cached PDU form of a record of the repository, as generated by
+ * sdp_gen_record_pdu, and of the attributes within it. The returned data
+ * stays valid until the repository changes.
+ */
+const uint8_t *sdp_record_get_pdu(sdp_record_t *rec, uint32_t *size);
+const uint8_t *sdp_record_get_attr_pdu(sdp_record_t *rec, uint16_t attr,
+							uint32_t *size);
+/* Attributes with IDs from low to high inclusive, NULL if there are none */
+const uint8_t *sdp_record_get_attr_range_pdu(sdp_record_t *rec, uint16_t low,
+						uint16_t high, uint32_t *size);
+void sdp_record_invalidate_pdu(uint32_t handle);
 uint32_t sdp_next_handle(void);
 
 uint32_t sdp_get_time(void);
@@ -62,6 +62,131 @@ static inline int create_filename(char *buf, size_t size,
 	return create_name(buf, size, STORAGEDIR, addr, name);
 }
 
+/* Values refreshed on every inquiry result or advertising report are
+ * merged in memory and written with one pass per file */
+#define JOURNAL_TIMEOUT		10
+#define JOURNAL_MAX_ENTRIES	256
+
+static GHashTable *journal = NULL;
+static unsigned int journal_entries = 0;
+static guint journal_id = 0;
+
+static void flush_file(gpointer key, gpointer value, gpointer user_data)
+{
+	const char *filename = key;
+	GHashTable *entries = value;
+	GHashTableIter iter;
+	gpointer k, v;
+	char **keys;
+	const char **values;
+	int count = 0;
+
+	keys = g_new(char *, g_hash_table_size(entries));
+	values = g_new(const char *, g_hash_table_size(entries));
+
+	g_hash_table_iter_init(&iter, entries);
+	while (g_hash_table_iter_next(&iter, &k, &v)) {
+		keys[count] = k;
+		values[count++] = v;
+	}
+
+	create_file(filename, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+	textfile_putv(filename, keys, values, count);
+
+	g_free(values);
+	g_free(keys);
+}
+
+void storage_flush(void)
+{
+	GHashTable *pending = journal;
+
+	if (journal_id > 0) {
+		g_source_remove(journal_id);
+		journal_id = 0;
+	}
+
+	if (pending == NULL)
+		return;
+
+	journal = NULL;
+	journal_entries = 0;
+
+	g_hash_table_foreach(pending, flush_file, NULL);
+	g_hash_table_destroy(pending);
+}
+
+static gboolean journal_timeout(gpointer user_data)
+{
+	journal_id = 0;
+
+	storage_flush();
+
+	return FALSE;
+}
+
+static int journal_put(const char *filename, const char *key,
+							const char *value)
+{
+	GHashTable *entries;
+
+	if (journal == NULL)
+		journal = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+					(GDestroyNotify) g_hash_table_destroy);
+
+	entries = g_hash_table_lookup(journal, filename);
+	if (entries == NULL) {
+		entries = g_hash_table_new_full(g_str_hash, g_str_equal,
+							g_free, g_free);
+		g_hash_table_insert(journal, g_strdup(filename), entries);
+	}
+
+	if (g_hash_table_lookup(entries, key) == NULL)
+		journal_entries++;
+
+	g_hash_table_replace(entries, g_strdup(key), g_strdup(value));
+
+	if (journal_entries >= JOURNAL_MAX_ENTRIES)
+		storage_flush();
+	else if (journal_id == 0)
+		journal_id = g_timeout_add_seconds(JOURNAL_TIMEOUT,
+							journal_timeout, NULL);
+
+	return 0;
+}
+
+static char *journal_get(const char *filename, const char *key)
+{
+	GHashTable *entries;
+	const char *value;
+
+	if (journal == NULL)
+		return textfile_get(filename, key);
+
+	entries = g_hash_table_lookup(journal, filename);
+	if (entries == NULL)
+		return textfile_get(filename, key);
+
+	value = g_hash_table_lookup(entries, key);
+	if (value == NULL)
+		return textfile_get(filename, key);
+
+	return strdup(value);
+}
+
+static void journal_del(const char *filename, const char *key)
+{
+	GHashTable *entries;
+
+	if (journal == NULL)
+		return;
+
+	entries = g_hash_table_lookup(journal, filename);
+	if (entries && g_hash_table_remove(entries, key))
+		journal_entries--;
+}
+
 int read_device_alias(const char *src, const char *dst, char *alias, size_t size)
 {
 	char filename[PATH_MAX + 1], *tmp;
@@ -292,7 +417,7 @@ int read_remote_appearance(bdaddr_t *local, bdaddr_t *peer, uint8_t bdaddr_type,
 	ba2str(peer, key);
 	sprintf(&key[17], "#%hhu", bdaddr_type);
 
-	str = textfile_get(filename, key);
+	str = journal_get(filename, key);
 	if (!str)
 		return -ENOENT;
 
@@ -313,14 +438,12 @@ int write_remote_appearance(bdaddr_t *local, bdaddr_t *peer,
 
 	create_filename(filename, PATH_MAX, local, "appearances");
 
-	create_file(filename, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-
 	ba2str(peer, key);
 	sprintf(&key[17], "#%hhu", bdaddr_type);
 
 	sprintf(str, "0x%4.4x", appearance);
 
-	return textfile_put(filename, key, str);
+	return journal_put(filename, key, str);
 }
 
 int write_remote_class(bdaddr_t *local, bdaddr_t *peer, uint32_t class)
@@ -329,12 +452,10 @@ int write_remote_class(bdaddr_t *local, bdaddr_t *peer, uint32_t class)
 
 	create_filename(filename, PATH_MAX, local, "classes");
 
-	create_file(filename, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-
 	ba2str(peer, addr);
 	sprintf(str, "0x%6.6x", class);
 
-	return textfile_put(filename, addr, str);
+	return journal_put(filename, addr, str);
 }
 
 int read_remote_class(bdaddr_t *local, bdaddr_t *peer, uint32_t *class)
@@ -345,7 +466,7 @@ int read_remote_class(bdaddr_t *local, bdaddr_t *peer, uint32_t *class)
 
 	ba2str(peer, addr);
 
-	str = textfile_get(filename, addr);
+	str = journal_get(filename, addr);
 	if (!str)
 		return -ENOENT;
 
@@ -374,12 +495,10 @@ int write_device_name(bdaddr_t *local, bdaddr_t *peer, uint8_t peer_type,
 
 	create_filename(filename, PATH_MAX, local, "names");
 
-	create_file(filename, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-
 	ba2str(peer, key);
 	sprintf(&key[17], "#%hhu", peer_type);
 
-	return textfile_put(filename, key, str);
+	return journal_put(filename, key, str);
 }
 
 int read_device_name(const char *src, const char *dst, uint8_t dst_type,
@@ -392,14 +511,14 @@ int read_device_name(const char *src, const char *dst, uint8_t dst_type,
 
 	snprintf(key, sizeof(key), "%17s#%hhu", dst, dst_type);
 
-	str = textfile_get(filename, key);
+	str = journal_get(filename, key);
 	if (str != NULL)
 		goto done;
 
 	/* Try old format (address only) */
 	key[17] = '\0';
 
-	str = textfile_get(filename, key);
+	str = journal_get(filename, key);
 	if (str == NULL)
 		return -ENOENT;
 
@@ -426,10 +545,8 @@ int write_remote_eir(bdaddr_t *local, bdaddr_t *peer, uint8_t *data,
 
 	create_filename(filename, PATH_MAX, local, "eir");
 
-	create_file(filename, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-
 	ba2str(peer, addr);
-	return textfile_put(filename, addr, str);
+	return journal_put(filename, addr, str);
 }
 
 int read_remote_eir(bdaddr_t *local, bdaddr_t *peer, uint8_t *data)
@@ -441,7 +558,7 @@ int read_remote_eir(bdaddr_t *local, bdaddr_t *peer, uint8_t *data)
 
 	ba2str(peer, addr);
 
-	str = textfile_get(filename, addr);
+	str = journal_get(filename, addr);
 	if (!str)
 		return -ENOENT;
 
@@ -565,10 +682,8 @@ int write_lastseen_info(bdaddr_t *local, bdaddr_t *peer, struct tm *tm)
 
 	create_filename(filename, PATH_MAX, local, "lastseen");
 
-	create_file(filename, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-
 	ba2str(peer, addr);
-	return textfile_put(filename, addr, str);
+	return journal_put(filename, addr, str);
 }
 
 int write_lastused_info(bdaddr_t *local, bdaddr_t *peer, struct tm *tm)
@@ -806,9 +921,20 @@ int delete_entry(bdaddr_t *src, const char *storage, const char *key)
 
 	create_filename(filename, PATH_MAX, src, storage);
 
+	journal_del(filename, key);
+
 	return textfile_del(filename, key);
 }
 
+char *read_entry(bdaddr_t *src, const char *storage, const char *key)
+{
+	char filename[PATH_MAX + 1];
+
+	create_filename(filename, PATH_MAX, src, storage);
+
+	return journal_get(filename, key);
+}
+
 int store_record(const gchar *src, const gchar *dst, sdp_record_t *rec)
 {
 	char filename[PATH_MAX + 1], key[28];
@@ -856,7 +982,7 @@ sdp_record_t *record_from_string(const gchar *str)
 		pdata[i] = (uint8_t) strtol(tmp, NULL, 16);
 	}
 
-	rec = sdp_extract_pdu(pdata, size, &len);
+	rec = sdp_extract_pdu_arena(pdata, size, &len);
 	g_free(pdata);
 
 	return rec;
@@ -1224,8 +1350,8 @@ done:
 	g_slist_free_full(match.keys, g_free);
 }
 
-int delete_device_service(const bdaddr_t *sba, const bdaddr_t *dba,
-						uint8_t bdaddr_type)
+void delete_device_characteristics(const bdaddr_t *sba, const bdaddr_t *dba,
+							uint8_t bdaddr_type)
 {
 	char filename[PATH_MAX + 1], key[20];
 
@@ -1241,6 +1367,19 @@ int delete_device_service(const bdaddr_t *sba, const bdaddr_t *dba,
 	/* Deleting all attributes values of a given key */
 	create_filename(filename, PATH_MAX, sba, "attributes");
 	delete_by_pattern(filename, key);
+}
+
+int delete_device_service(const bdaddr_t *sba, const bdaddr_t *dba,
+						uint8_t bdaddr_type)
+{
+	char filename[PATH_MAX + 1], key[20];
+
+	memset(key, 0, sizeof(key));
+
+	ba2str(dba, key);
+	sprintf(&key[17], "#%hhu", bdaddr_type);
+
+	delete_device_characteristics(sba, dba, bdaddr_type);
 
 	/* Deleting all CCC values of a given key */
 	create_filename(filename, PATH_MAX, sba, "ccc");
@@ -1264,22 +1403,6 @@ char *read_device_services(const bdaddr_t *sba, const bdaddr_t *dba,
 	return textfile_caseget(filename, key);
 }
 
-int write_device_characteristics(const bdaddr_t *sba, const bdaddr_t *dba,
-					uint8_t bdaddr_type, uint16_t handle,
-							      const char *chars)
-{
-	char filename[PATH_MAX + 1], addr[18], key[25];
-
-	create_filename(filename, PATH_MAX, sba, "characteristics");
-
-	create_file(filename, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-
-	ba2str(dba, addr);
-	snprintf(key, sizeof(key), "%17s#%hhu#%04X", addr, bdaddr_type, handle);
-
-	return textfile_put(filename, key, chars);
-}
-
 char *read_device_characteristics(const bdaddr_t *sba, const bdaddr_t *dba,
 					uint8_t bdaddr_type, uint16_t handle)
 {
@@ -1318,48 +1441,62 @@ int read_device_attributes(const bdaddr_t *sba, textfile_cb func, void *data)
 	return textfile_foreach(filename, func, data);
 }
 
-int read_device_ccc(bdaddr_t *local, bdaddr_t *peer, uint8_t bdaddr_type,
-					uint16_t handle, uint16_t *value)
+int write_device_ccc(bdaddr_t *local, bdaddr_t *peer, uint8_t bdaddr_type,
+					uint16_t handle, uint16_t value)
 {
-	char filename[PATH_MAX + 1], addr[18], key[25];
-	char *str;
-	unsigned int config;
-	int err = 0;
+	char filename[PATH_MAX + 1], addr[18], key[25], config[5];
 
 	create_filename(filename, PATH_MAX, local, "ccc");
 
+	create_file(filename, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
 	ba2str(peer, addr);
 	snprintf(key, sizeof(key), "%17s#%hhu#%04X", addr, bdaddr_type, handle);
 
-	str = textfile_caseget(filename, key);
-	if (str == NULL)
-		return -ENOENT;
+	snprintf(config, sizeof(config), "%04X", value);
 
-	if (sscanf(str, "%04X", &config) != 1)
-		err = -ENOENT;
-	else
-		*value = config;
+	return textfile_put(filename, key, config);
+}
 
-	free(str);
+struct ccc_match {
+	char prefix[21];
+	device_ccc_cb func;
+	void *user_data;
+};
 
-	return err;
+static void filter_ccc(char *key, char *value, void *data)
+{
+	struct ccc_match *match = data;
+	unsigned int handle, config;
+	size_t len = strlen(match->prefix);
+
+	if (strncasecmp(key, match->prefix, len) != 0)
+		return;
+
+	if (sscanf(key + len, "%04X", &handle) != 1)
+		return;
+
+	if (sscanf(value, "%04X", &config) != 1)
+		return;
+
+	match->func(handle, config, match->user_data);
 }
 
-int write_device_ccc(bdaddr_t *local, bdaddr_t *peer, uint8_t bdaddr_type,
-					uint16_t handle, uint16_t value)
+int read_device_ccc_all(bdaddr_t *local, bdaddr_t *peer, uint8_t bdaddr_type,
+				device_ccc_cb func, void *user_data)
 {
-	char filename[PATH_MAX + 1], addr[18], key[25], config[5];
+	char filename[PATH_MAX + 1], addr[18];
+	struct ccc_match match;
 
 	create_filename(filename, PATH_MAX, local, "ccc");
 
-	create_file(filename, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-
 	ba2str(peer, addr);
-	snprintf(key, sizeof(key), "%17s#%hhu#%04X", addr, bdaddr_type, handle);
-
-	snprintf(config, sizeof(config), "%04X", value);
+	snprintf(match.prefix, sizeof(match.prefix), "%17s#%hhu#", addr,
+								bdaddr_type);
+	match.func = func;
+	match.user_data = user_data;
 
-	return textfile_put(filename, key, config);
+	return textfile_foreach(filename, filter_ccc, &match);
 }
 
 void delete_device_ccc(bdaddr_t *local, bdaddr_t *peer)
@@ -1408,3 +1545,42 @@ gboolean has_longtermkeys(bdaddr_t *local, bdaddr_t *peer, uint8_t bdaddr_type)
 
 	return FALSE;
 }
+
+int write_remote_seps(const bdaddr_t *local, const bdaddr_t *peer,
+							const char *seps)
+{
+	char filename[PATH_MAX + 1], addr[18];
+
+	if (!seps)
+		return -EINVAL;
+
+	create_filename(filename, PATH_MAX, local, "avdtp");
+
+	create_file(filename, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+	ba2str(peer, addr);
+
+	return textfile_put(filename, addr, seps);
+}
+
+char *read_remote_seps(const bdaddr_t *local, const bdaddr_t *peer)
+{
+	char filename[PATH_MAX + 1], addr[18];
+
+	create_filename(filename, PATH_MAX, local, "avdtp");
+
+	ba2str(peer, addr);
+
+	return textfile_get(filename, addr);
+}
+
+int delete_remote_seps(const bdaddr_t *local, const bdaddr_t *peer)
+{
+	char filename[PATH_MAX + 1], addr[18];
+
+	create_filename(filename, PATH_MAX, local, "avdtp");
+
+	ba2str(peer, addr);
+
+	return textfile_del(filename, addr);
+}
@@ -61,6 +61,8 @@ gboolean read_trust(const bdaddr_t *local, const char *addr, const char *service
 int write_trust(const char *src, const char *addr, const char *service, gboolean trust);
 int write_device_profiles(bdaddr_t *src, bdaddr_t *dst, const char *profiles);
 int delete_entry(bdaddr_t *src, const char *storage, const char *key);
+char *read_entry(bdaddr_t *src, const char *storage, const char *key);
+void storage_flush(void);
 int store_record(const gchar *src, const gchar *dst, sdp_record_t *rec);
 sdp_record_t *record_from_string(const gchar *str);
 sdp_record_t *fetch_record(const gchar *src, const gchar *dst, const uint32_t handle);
@@ -81,24 +83,29 @@ int write_blocked(const bdaddr_t *local, const bdaddr_t *remote,
 							gboolean blocked);
 int write_device_services(const bdaddr_t *sba, const bdaddr_t *dba,
 				uint8_t bdaddr_type, const char *services);
+void delete_device_characteristics(const bdaddr_t *sba, const bdaddr_t *dba,
+							uint8_t bdaddr_type);
 int delete_device_service(const bdaddr_t *sba, const bdaddr_t *dba,
 						uint8_t bdaddr_type);
 char *read_device_services(const bdaddr_t *sba, const bdaddr_t *dba,
 							uint8_t bdaddr_type);
-int write_device_characteristics(const bdaddr_t *sba, const bdaddr_t *dba,
-					uint8_t bdaddr_type, uint16_t handle,
-							     const char *chars);
 char *read_device_characteristics(const bdaddr_t *sba, const bdaddr_t *dba,
 					uint8_t bdaddr_type, uint16_t handle);
 int write_device_attribute(const bdaddr_t *sba, const bdaddr_t *dba,
 				uint8_t bdaddr_type, uint16_t handle,
 							const char *chars);
 int read_device_attributes(const bdaddr_t *sba, textfile_cb func, void *data);
-int read_device_ccc(bdaddr_t *local, bdaddr_t *peer, uint8_t bdaddr_type,
-					uint16_t handle, uint16_t *value);
 int write_device_ccc(bdaddr_t *local, bdaddr_t *peer, uint8_t bdaddr_type,
 					uint16_t handle, uint16_t value);
 void delete_device_ccc(bdaddr_t *local, bdaddr_t *peer);
+typedef void (*device_ccc_cb) (uint16_t handle, uint16_t value,
+							void *user_data);
+int read_device_ccc_all(bdaddr_t *local, bdaddr_t *peer, uint8_t bdaddr_type,
+				device_ccc_cb func, void *user_data);
 int write_longtermkeys(bdaddr_t *local, bdaddr_t *peer, uint8_t bdaddr_type,
 							const char *key);
 gboolean has_longtermkeys(bdaddr_t *local, bdaddr_t *peer, uint8_t bdaddr_type);
+int write_remote_seps(const bdaddr_t *local, const bdaddr_t *peer,
+							const char *seps);
+char *read_remote_seps(const bdaddr_t *local, const bdaddr_t *peer);
+int delete_remote_seps(const bdaddr_t *local, const bdaddr_t *peer);
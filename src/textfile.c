@@ -40,6 +40,13 @@
 
 #include "textfile.h"
 
+static const struct textfile_backend *backend = NULL;
+
+void textfile_set_backend(const struct textfile_backend *b)
+{
+	backend = b;
+}
+
 int create_dirs(const char *filename, const mode_t mode)
 {
 	struct stat st;
@@ -368,31 +375,208 @@ close:
 
 int textfile_put(const char *pathname, const char *key, const char *value)
 {
+	if (backend)
+		return backend->put(pathname, key, value, 0);
+
 	return write_key(pathname, key, value, 0);
 }
 
 int textfile_caseput(const char *pathname, const char *key, const char *value)
 {
+	if (backend)
+		return backend->put(pathname, key, value, 1);
+
 	return write_key(pathname, key, value, 1);
 }
 
 int textfile_del(const char *pathname, const char *key)
 {
+	if (backend)
+		return backend->put(pathname, key, NULL, 0);
+
 	return write_key(pathname, key, NULL, 0);
 }
 
 int textfile_casedel(const char *pathname, const char *key)
 {
+	if (backend)
+		return backend->put(pathname, key, NULL, 1);
+
 	return write_key(pathname, key, NULL, 1);
 }
 
+struct key_value {
+	char *key;
+	const char *value;
+	int done;
+};
+
+static int key_value_cmp(const void *a, const void *b)
+{
+	const struct key_value *kv1 = a, *kv2 = b;
+
+	return strcmp(kv1->key, kv2->key);
+}
+
+static char *append_key_value(char *ptr, const char *key, const char *value)
+{
+	return ptr + sprintf(ptr, "%s %s\n", key, value);
+}
+
+static int write_keys(const char *pathname, char **keys, const char **values,
+								int count)
+{
+	struct key_value *kvs, *kv, match;
+	struct stat st;
+	char *map = NULL, *out = NULL, *ptr, *off, *end, *sep;
+	size_t size, len;
+	int fd, i, err = 0;
+
+	fd = open(pathname, O_RDWR);
+	if (fd < 0)
+		return -errno;
+
+	if (flock(fd, LOCK_EX) < 0) {
+		err = -errno;
+		goto close;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		err = -errno;
+		goto unlock;
+	}
+
+	size = st.st_size;
+
+	kvs = calloc(count, sizeof(*kvs));
+	if (!kvs) {
+		err = -ENOMEM;
+		goto unlock;
+	}
+
+	len = size;
+	for (i = 0; i < count; i++) {
+		kvs[i].key = keys[i];
+		kvs[i].value = values[i];
+		len += strlen(keys[i]) + strlen(values[i]) + 2;
+	}
+
+	qsort(kvs, count, sizeof(*kvs), key_value_cmp);
+
+	/* Each key is written once, a repeated one has no defined value */
+	for (i = 1; i < count; i++) {
+		if (key_value_cmp(&kvs[i - 1], &kvs[i]) == 0) {
+			err = -EINVAL;
+			goto free;
+		}
+	}
+
+	/* Private copy, key separators are overwritten while matching */
+	map = malloc(size + 1);
+	out = malloc(len + 1);
+	if (!map || !out) {
+		err = -ENOMEM;
+		goto free;
+	}
+
+	if (size > 0 && pread(fd, map, size, 0) != (ssize_t) size) {
+		err = -EIO;
+		goto free;
+	}
+
+	map[size] = '\0';
+
+	/* Rewrite every line once, replacing the values of matching keys */
+	ptr = out;
+	for (off = map; off < map + size; off = end) {
+		end = strnpbrk(off, map + size - off, "\r\n");
+		end = end ? end + strspn(end, "\r\n") : map + size;
+
+		sep = strnpbrk(off, end - off, " ");
+		if (sep) {
+			*sep = '\0';
+			match.key = off;
+			kv = bsearch(&match, kvs, count, sizeof(*kvs),
+							key_value_cmp);
+			*sep = ' ';
+
+			if (kv) {
+				if (!kv->done)
+					ptr = append_key_value(ptr, kv->key,
+								kv->value);
+				kv->done = 1;
+				continue;
+			}
+		}
+
+		memcpy(ptr, off, end - off);
+		ptr += end - off;
+	}
+
+	for (i = 0; i < count; i++)
+		if (!kvs[i].done)
+			ptr = append_key_value(ptr, kvs[i].key, kvs[i].value);
+
+	len = ptr - out;
+	if (len == size && !memcmp(out, map, size))
+		goto free;
+
+	if (pwrite(fd, out, len, 0) != (ssize_t) len ||
+						ftruncate(fd, len) < 0) {
+		err = -EIO;
+		goto free;
+	}
+
+	fdatasync(fd);
+
+free:
+	free(out);
+	free(map);
+	free(kvs);
+
+unlock:
+	flock(fd, LOCK_UN);
+
+close:
+	close(fd);
+	errno = -err;
+
+	return err;
+}
+
+int textfile_putv(const char *pathname, char **keys, const char **values,
+								int count)
+{
+	int i, err = 0;
+
+	if (count <= 0)
+		return 0;
+
+	if (!backend)
+		return write_keys(pathname, keys, values, count);
+
+	for (i = 0; i < count; i++) {
+		int ret = backend->put(pathname, keys[i], values[i], 0);
+		if (ret < 0)
+			err = ret;
+	}
+
+	return err;
+}
+
 char *textfile_get(const char *pathname, const char *key)
 {
+	if (backend)
+		return backend->get(pathname, key, 0);
+
 	return read_key(pathname, key, 0);
 }
 
 char *textfile_caseget(const char *pathname, const char *key)
 {
+	if (backend)
+		return backend->get(pathname, key, 1);
+
 	return read_key(pathname, key, 1);
 }
 
@@ -403,6 +587,9 @@ int textfile_foreach(const char *pathname, textfile_cb func, void *data)
 	off_t size; size_t len;
 	int fd, err = 0;
 
+	if (backend)
+		return backend->foreach(pathname, func, data);
+
 	fd = open(pathname, O_RDONLY);
 	if (fd < 0)
 		return -errno;
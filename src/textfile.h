@@ -33,6 +33,8 @@ int textfile_put(const char *pathname, const char *key, const char *value);
 int textfile_caseput(const char *pathname, const char *key, const char *value);
 int textfile_del(const char *pathname, const char *key);
 int textfile_casedel(const char *pathname, const char *key);
+int textfile_putv(const char *pathname, char **keys, const char **values,
+								int count);
 char *textfile_get(const char *pathname, const char *key);
 char *textfile_caseget(const char *pathname, const char *key);
 
@@ -40,4 +42,16 @@ typedef void (*textfile_cb) (char *key, char *value, void *data);
 
 int textfile_foreach(const char *pathname, textfile_cb func, void *data);
 
+/* Alternative storage for the textfile API. Pathnames keep naming the
+ * textfile, a NULL value passed to put deletes the key. */
+struct textfile_backend {
+	const char *name;
+	int (*put) (const char *pathname, const char *key, const char *value,
+								int icase);
+	char *(*get) (const char *pathname, const char *key, int icase);
+	int (*foreach) (const char *pathname, textfile_cb func, void *data);
+};
+
+void textfile_set_backend(const struct textfile_backend *backend);
+
 #endif /* __TEXTFILE_H */
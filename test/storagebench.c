@@ -0,0 +1,502 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2012  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include <bluetooth/bluetooth.h>
+
+#include "textfile.h"
+#include "kvstore.h"
+
+#define ADAPTER_ADDRESS		"00:00:5E:00:53:00"
+#define LASTSEEN_BATCH		256
+
+struct io_counters {
+	unsigned long long rchar;
+	unsigned long long wchar;
+	unsigned long long syscr;
+	unsigned long long syscw;
+};
+
+struct bench {
+	const char *name;
+	double *samples;
+	unsigned int count;
+	struct io_counters io;
+	struct timespec start;
+};
+
+static const char *directory = "/tmp/storagebench";
+static unsigned int peers = 1000;
+static unsigned int keys = 4;
+static unsigned int iterations = 1000;
+static gboolean log_backend = FALSE;
+
+static char linkkeys[PATH_MAX + 1];
+static char ccc[PATH_MAX + 1];
+static char lastseen[PATH_MAX + 1];
+static char names[PATH_MAX + 1];
+
+static void read_io_counters(struct io_counters *io)
+{
+	char line[64];
+	FILE *f;
+
+	memset(io, 0, sizeof(*io));
+
+	f = fopen("/proc/self/io", "r");
+	if (f == NULL)
+		return;
+
+	while (fgets(line, sizeof(line), f)) {
+		sscanf(line, "rchar: %llu", &io->rchar);
+		sscanf(line, "wchar: %llu", &io->wchar);
+		sscanf(line, "syscr: %llu", &io->syscr);
+		sscanf(line, "syscw: %llu", &io->syscw);
+	}
+
+	fclose(f);
+}
+
+static void peer_address(unsigned int index, char *addr)
+{
+	bdaddr_t bdaddr;
+
+	bdaddr.b[0] = index;
+	bdaddr.b[1] = index >> 8;
+	bdaddr.b[2] = index >> 16;
+	bdaddr.b[3] = 0x53;
+	bdaddr.b[4] = 0x00;
+	bdaddr.b[5] = 0x5e;
+
+	ba2str(&bdaddr, addr);
+}
+
+static void ccc_key(unsigned int index, unsigned int handle, char *key)
+{
+	char addr[18];
+
+	peer_address(index, addr);
+	sprintf(key, "%17s#%hhu#%04X", addr, 0, 0x0010 + handle * 3);
+}
+
+static int populate(void)
+{
+	FILE *f_keys, *f_ccc, *f_seen, *f_names;
+	char addr[18], key[25];
+	unsigned int i, j;
+	int err;
+
+	create_file(linkkeys, S_IRUSR | S_IWUSR);
+
+	f_keys = fopen(linkkeys, "w");
+	f_ccc = fopen(ccc, "w");
+	f_seen = fopen(lastseen, "w");
+	f_names = fopen(names, "w");
+
+	if (!f_keys || !f_ccc || !f_seen || !f_names) {
+		err = -errno;
+		perror("Can't create storage files");
+		goto close;
+	}
+
+	for (i = 0; i < peers; i++) {
+		peer_address(i, addr);
+
+		fprintf(f_keys, "%s %08X%08X%08X%08X 0 4\n", addr,
+						rand(), rand(), rand(), rand());
+		fprintf(f_seen, "%s 2012-08-01 12:00:00 UTC\n", addr);
+		fprintf(f_names, "%s#0 Synthetic device %u\n", addr, i);
+
+		for (j = 0; j < keys; j++) {
+			ccc_key(i, j, key);
+			fprintf(f_ccc, "%s 0001\n", key);
+		}
+	}
+
+	err = 0;
+
+close:
+	if (f_keys)
+		fclose(f_keys);
+	if (f_ccc)
+		fclose(f_ccc);
+	if (f_seen)
+		fclose(f_seen);
+	if (f_names)
+		fclose(f_names);
+
+	return err;
+}
+
+static void remove_log(const char *filename)
+{
+	char logname[PATH_MAX + 5];
+
+	snprintf(logname, sizeof(logname), "%s.log", filename);
+	unlink(logname);
+}
+
+static void bench_init(struct bench *b, const char *name, unsigned int max)
+{
+	b->name = name;
+	b->samples = g_new(double, max);
+	b->count = 0;
+	read_io_counters(&b->io);
+}
+
+static void sample_start(struct bench *b)
+{
+	clock_gettime(CLOCK_MONOTONIC, &b->start);
+}
+
+static void sample_end(struct bench *b)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	b->samples[b->count++] = (now.tv_sec - b->start.tv_sec) * 1e6 +
+				(now.tv_nsec - b->start.tv_nsec) / 1e3;
+}
+
+static int double_cmp(const void *a, const void *b)
+{
+	double d1 = *(const double *) a, d2 = *(const double *) b;
+
+	return d1 < d2 ? -1 : d1 > d2;
+}
+
+static double percentile(struct bench *b, unsigned int p)
+{
+	return b->samples[(b->count - 1) * p / 100];
+}
+
+static void bench_report(struct bench *b)
+{
+	struct io_counters io;
+	double total = 0;
+	unsigned int i;
+
+	read_io_counters(&io);
+
+	if (b->count == 0)
+		goto done;
+
+	qsort(b->samples, b->count, sizeof(double), double_cmp);
+
+	for (i = 0; i < b->count; i++)
+		total += b->samples[i];
+
+	printf("%-18s %7u %10.1f %10.1f %10.1f %10.1f %10.1f %8.1f %8.1f "
+		"%10.0f %10.0f\n", b->name, b->count, total / b->count,
+		percentile(b, 50), percentile(b, 90), percentile(b, 99),
+		b->samples[b->count - 1],
+		(double) (io.syscr - b->io.syscr) / b->count,
+		(double) (io.syscw - b->io.syscw) / b->count,
+		(double) (io.rchar - b->io.rchar) / b->count,
+		(double) (io.wchar - b->io.wchar) / b->count);
+
+done:
+	g_free(b->samples);
+}
+
+static void sync_backend(void)
+{
+	/* bluetoothd flushes the log once per main loop iteration */
+	if (log_backend)
+		kvstore_sync();
+}
+
+static void count_entry(char *key, char *value, void *data)
+{
+	unsigned int *count = data;
+
+	(*count)++;
+}
+
+static void bench_foreach(const char *name, const char *filename)
+{
+	unsigned int i, count, rounds = MIN(iterations, 10);
+	struct bench b;
+
+	bench_init(&b, name, rounds);
+
+	for (i = 0; i < rounds; i++) {
+		count = 0;
+		sample_start(&b);
+		textfile_foreach(filename, count_entry, &count);
+		sample_end(&b);
+	}
+
+	bench_report(&b);
+}
+
+static void bench_linkkey(void)
+{
+	char addr[18], *str;
+	unsigned int i;
+	struct bench b;
+
+	bench_init(&b, "linkkey lookup", iterations);
+
+	for (i = 0; i < iterations; i++) {
+		peer_address(rand() % peers, addr);
+
+		sample_start(&b);
+		str = textfile_get(linkkeys, addr);
+		sample_end(&b);
+
+		free(str);
+	}
+
+	bench_report(&b);
+}
+
+static void bench_ccc(void)
+{
+	char key[25], *str;
+	unsigned int i;
+	struct bench b;
+
+	if (keys == 0)
+		return;
+
+	bench_init(&b, "ccc read", iterations);
+
+	for (i = 0; i < iterations; i++) {
+		ccc_key(rand() % peers, rand() % keys, key);
+
+		sample_start(&b);
+		str = textfile_caseget(ccc, key);
+		sample_end(&b);
+
+		free(str);
+	}
+
+	bench_report(&b);
+}
+
+static void timestamp(char *str, size_t size, unsigned int i)
+{
+	time_t t = time(NULL) + i;
+
+	strftime(str, size, "%Y-%m-%d %H:%M:%S %Z", gmtime(&t));
+}
+
+static void bench_lastseen(void)
+{
+	char addr[18], str[24];
+	unsigned int i;
+	struct bench b;
+
+	bench_init(&b, "lastseen update", iterations);
+
+	for (i = 0; i < iterations; i++) {
+		peer_address(rand() % peers, addr);
+		timestamp(str, sizeof(str), i);
+
+		sample_start(&b);
+		textfile_put(lastseen, addr, str);
+		sync_backend();
+		sample_end(&b);
+	}
+
+	bench_report(&b);
+}
+
+/* Same updates as written by the storage journal, up to LASTSEEN_BATCH
+ * distinct peers per pass */
+static void bench_lastseen_batch(void)
+{
+	char *addrs[LASTSEEN_BATCH], str[24];
+	const char *values[LASTSEEN_BATCH];
+	unsigned int i, j, k, tmp, rounds, batch, *index;
+	struct bench b;
+
+	rounds = MAX(iterations / LASTSEEN_BATCH, 1);
+	batch = MIN(peers, LASTSEEN_BATCH);
+
+	bench_init(&b, "lastseen batch", rounds);
+
+	index = g_new(unsigned int, peers);
+	for (j = 0; j < peers; j++)
+		index[j] = j;
+
+	for (j = 0; j < batch; j++) {
+		addrs[j] = g_malloc(18);
+		values[j] = str;
+	}
+
+	for (i = 0; i < rounds; i++) {
+		timestamp(str, sizeof(str), i);
+
+		/* Partial Fisher-Yates shuffle, the first batch are distinct */
+		for (j = 0; j < batch; j++) {
+			k = j + rand() % (peers - j);
+			tmp = index[j];
+			index[j] = index[k];
+			index[k] = tmp;
+
+			peer_address(index[j], addrs[j]);
+		}
+
+		sample_start(&b);
+		textfile_putv(lastseen, addrs, values, batch);
+		sync_backend();
+		sample_end(&b);
+	}
+
+	for (j = 0; j < batch; j++)
+		g_free(addrs[j]);
+
+	g_free(index);
+
+	bench_report(&b);
+}
+
+static void usage(void)
+{
+	printf("storagebench - Bluetooth storage benchmark\n");
+	printf("Usage:\n");
+	printf("\tstoragebench [options]\n");
+	printf("Options:\n"
+		"\t-d, --directory <dir>   Storage directory (default %s)\n"
+		"\t-p, --peers <count>     Number of peers (default %u)\n"
+		"\t-k, --keys <count>      CCC entries per peer (default %u)\n"
+		"\t-n, --iterations <num>  Operations per test (default %u)\n"
+		"\t-b, --backend <name>    textfile or log (default textfile)\n"
+		"\t-s, --seed <seed>       Random seed\n"
+		"\t-h, --help              Show help options\n",
+		directory, peers, keys, iterations);
+}
+
+static struct option main_options[] = {
+	{ "directory",	1, 0, 'd' },
+	{ "peers",	1, 0, 'p' },
+	{ "keys",	1, 0, 'k' },
+	{ "iterations",	1, 0, 'n' },
+	{ "backend",	1, 0, 'b' },
+	{ "seed",	1, 0, 's' },
+	{ "help",	0, 0, 'h' },
+	{ 0, 0, 0, 0 }
+};
+
+int main(int argc, char *argv[])
+{
+	unsigned int seed = 1;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "d:p:k:n:b:s:h", main_options,
+							NULL)) != -1) {
+		switch (opt) {
+		case 'd':
+			directory = optarg;
+			break;
+		case 'p':
+			peers = atoi(optarg);
+			break;
+		case 'k':
+			keys = atoi(optarg);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'b':
+			if (!strcmp(optarg, "log"))
+				log_backend = TRUE;
+			else if (strcmp(optarg, "textfile")) {
+				usage();
+				exit(1);
+			}
+			break;
+		case 's':
+			seed = atoi(optarg);
+			break;
+		case 'h':
+			usage();
+			exit(0);
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	if (peers == 0 || peers > 0xffffff || iterations == 0) {
+		usage();
+		exit(1);
+	}
+
+	srand(seed);
+
+	create_name(linkkeys, PATH_MAX, directory, ADAPTER_ADDRESS,
+								"linkkeys");
+	create_name(ccc, PATH_MAX, directory, ADAPTER_ADDRESS, "ccc");
+	create_name(lastseen, PATH_MAX, directory, ADAPTER_ADDRESS,
+								"lastseen");
+	create_name(names, PATH_MAX, directory, ADAPTER_ADDRESS, "names");
+
+	if (populate() < 0)
+		exit(1);
+
+	/* The logs are created from the textfiles just written */
+	if (log_backend) {
+		remove_log(linkkeys);
+		remove_log(ccc);
+		remove_log(lastseen);
+		remove_log(names);
+		kvstore_init();
+	}
+
+	printf("%u peers, %u CCC entries per peer, %s backend\n\n", peers,
+				keys, log_backend ? "log" : "textfile");
+	printf("%-18s %7s %10s %10s %10s %10s %10s %8s %8s %10s %10s\n",
+			"test", "ops", "mean(us)", "p50", "p90", "p99",
+			"max", "reads", "writes", "rbytes", "wbytes");
+
+	bench_foreach("startup linkkeys", linkkeys);
+	bench_foreach("startup names", names);
+	bench_foreach("startup ccc", ccc);
+	bench_linkkey();
+	bench_ccc();
+	bench_lastseen();
+	bench_lastseen_batch();
+
+	if (log_backend)
+		kvstore_exit();
+
+	return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2012  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "kvstore.h"
+
+static gboolean export = FALSE;
+static int files = 0, keys = 0;
+
+static int convert_file(const char *pathname)
+{
+	int count;
+
+	if (export)
+		count = kvstore_export(pathname);
+	else
+		count = kvstore_migrate(pathname);
+
+	if (count < 0) {
+		fprintf(stderr, "%s: %s (%d)\n", pathname, strerror(-count),
+									-count);
+		return count;
+	}
+
+	printf("%s: %d keys\n", pathname, count);
+
+	files++;
+	keys += count;
+
+	return 0;
+}
+
+static int convert_dir(const char *path)
+{
+	const char *name;
+	GDir *dir;
+	int err = 0;
+
+	dir = g_dir_open(path, 0, NULL);
+	if (dir == NULL) {
+		fprintf(stderr, "Unable to open %s\n", path);
+		return -ENOENT;
+	}
+
+	while ((name = g_dir_read_name(dir)) != NULL) {
+		char *pathname = g_build_filename(path, name, NULL);
+
+		/* GATT caches are binary files not using the textfile API */
+		if (g_file_test(pathname, G_FILE_TEST_IS_DIR)) {
+			if (strcmp(name, "gatt") != 0 &&
+						convert_dir(pathname) < 0)
+				err = -EIO;
+		} else if (export && g_str_has_suffix(pathname, ".log")) {
+			pathname[strlen(pathname) - 4] = '\0';
+			if (convert_file(pathname) < 0)
+				err = -EIO;
+		} else if (!export && !g_str_has_suffix(pathname, ".log") &&
+				!g_str_has_suffix(pathname, ".tmp")) {
+			if (convert_file(pathname) < 0)
+				err = -EIO;
+		}
+
+		g_free(pathname);
+	}
+
+	g_dir_close(dir);
+
+	return err;
+}
+
+static void usage(void)
+{
+	printf("btstorage - Bluetooth storage migration\n");
+	printf("Usage:\n");
+	printf("\tbtstorage [-e] [directory]\n");
+	printf("\t-e  Export logs back to textfiles\n");
+	printf("Converts the textfiles below directory (default %s)\n"
+		"to the log storage backend. bluetoothd must not be running.\n",
+		STORAGEDIR);
+}
+
+static struct option main_options[] = {
+	{ "export",	0, 0, 'e' },
+	{ "help",	0, 0, 'h' },
+	{ 0, 0, 0, 0 }
+};
+
+int main(int argc, char *argv[])
+{
+	const char *path = STORAGEDIR;
+	int opt, err;
+
+	while ((opt = getopt_long(argc, argv, "eh", main_options,
+							NULL)) != -1) {
+		switch (opt) {
+		case 'e':
+			export = TRUE;
+			break;
+		case 'h':
+			usage();
+			exit(0);
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	if (optind < argc)
+		path = argv[optind];
+
+	err = convert_dir(path);
+
+	printf("%s %d files, %d keys\n", export ? "Exported" : "Migrated",
+								files, keys);
+
+	return err < 0 ? 1 : 0;
+}